@@ -0,0 +1,96 @@
+/* -*- C++ -*-
+ *
+ *  bench.h - Shared helpers of the benchmark suite
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <benchmark/benchmark.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "Parallel.h"
+
+namespace bench {
+// the screen sizes every pixel benchmark is swept over
+static const int resolutions[][2] = {
+    {640, 480}, {1280, 720}, {1920, 1080}, {2560, 1440}, {3840, 2160}};
+
+// an .nsa archive whose entries the decoder benchmarks read instead of
+// synthetic data, from --archive=<file> or ONS_BENCH_ARCHIVE
+inline const char *&sampleArchive() {
+    static const char *path = getenv("ONS_BENCH_ARCHIVE");
+    return path;
+}
+
+// the number of threads parallel::For may use on this machine
+inline int maxThreads() {
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+    return parallel::thread_num;
+#else
+    return 1;
+#endif
+}
+
+// args {w, h}: one run per resolution
+inline void resolutionArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"w", "h"});
+    for (const auto &res : resolutions) b->Args({res[0], res[1]});
+}
+
+// args {w, h, workers}: each resolution with 1, 2, 4, ... threads and
+// with all of them
+inline void resolutionThreadArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"w", "h", "workers"});
+    for (const auto &res : resolutions) {
+        for (int t = 1; t < maxThreads(); t *= 2) b->Args({res[0], res[1], t});
+        b->Args({res[0], res[1], maxThreads()});
+    }
+}
+
+// caps parallel::For at state.range(2) threads while in scope
+class ThreadLimit {
+   public:
+    explicit ThreadLimit(const benchmark::State &state) {
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+        parallel::setThreadLimit((int)state.range(2));
+#endif
+    }
+    ~ThreadLimit() {
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+        parallel::setThreadLimit(0);
+#endif
+    }
+};
+
+// fills buf with reproducible noise, so no run takes a shortcut for
+// fully opaque or fully transparent pixels
+inline void fillNoise(void *buf, size_t length, uint32_t seed) {
+    unsigned char *p = (unsigned char *)buf;
+    uint32_t x = seed | 1;
+    for (size_t i = 0; i < length; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        p[i] = (unsigned char)x;
+    }
+}
+}  // namespace bench
+
+#endif  // __BENCH_H__
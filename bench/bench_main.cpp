@@ -0,0 +1,65 @@
+/* -*- C++ -*-
+ *
+ *  bench_main.cpp - Entry of the benchmark suite
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ONScripter.h"
+#include "bench.h"
+#include "gbk2utf16.h"
+
+#ifdef ONSCRIPTER_UNDEF_MAIN
+#undef main
+#endif
+
+// the engine code refers to these, see entry/onscripter_main.cpp
+ONScripter ons;
+Coding2UTF16 *coding2utf16 = NULL;
+
+// usage: bench [--benchmark_filter=<regex>] [--benchmark_format=json]
+//              [--benchmark_out=<file>] [--archive=<file.nsa>]
+int main(int argc, char **argv) {
+    coding2utf16 = new GBK2UTF16();
+
+    // ours, taken out before google benchmark sees the rest
+    int n = 1;
+    for (int i = 1; i < argc; i++) {
+        if (!strncmp(argv[i], "--archive=", 10))
+            bench::sampleArchive() = argv[i] + 10;
+        else
+            argv[n++] = argv[i];
+    }
+    argc = n;
+
+    // SIMD is chosen at build time; configure with --simd=n for the
+    // scalar numbers
+#ifdef USE_SIMD
+    benchmark::AddCustomContext("simd", "on");
+#else
+    benchmark::AddCustomContext("simd", "off");
+#endif
+    if (bench::sampleArchive())
+        benchmark::AddCustomContext("archive", bench::sampleArchive());
+    benchmark::AddCustomContext("max_workers",
+                                std::to_string(bench::maxThreads()));
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
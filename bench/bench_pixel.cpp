@@ -0,0 +1,378 @@
+/* -*- C++ -*-
+ *
+ *  bench_pixel.cpp - Benchmarks of the pixel kernels and effects
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "AnimationInfo.h"
+#include "ONScripter.h"
+#include "bench.h"
+#include "builtin_layer.h"
+
+extern ONScripter ons;
+
+#define BENCH_FORMAT SDL_PIXELFORMAT_ARGB8888
+// frames an effect is sampled at per iteration
+#define EFFECT_FRAMES 16
+#define EFFECT_DURATION 1000
+
+static SDL_Surface *allocNoiseSurface(int w, int h, uint32_t seed) {
+    SDL_Surface *surface = AnimationInfo::allocSurface(w, h, BENCH_FORMAT);
+    bench::fillNoise(surface->pixels, (size_t)surface->pitch * h, seed);
+    return surface;
+}
+
+static void setPixelCounters(benchmark::State &state, int w, int h) {
+    state.SetItemsProcessed(state.iterations() * w * h);
+    state.SetBytesProcessed(state.iterations() * w * h *
+                            sizeof(AnimationInfo::ONSBuf));
+}
+
+// ONScripter keeps its kernels and effect state private; this friend sets
+// up just enough of that state to run them on surfaces of a given size.
+class ONScripterBench {
+   public:
+    enum {
+        ALPHA_BLEND_CONST = ONScripter::ALPHA_BLEND_CONST,
+        ALPHA_BLEND_FADE_MASK = ONScripter::ALPHA_BLEND_FADE_MASK,
+        ALPHA_BLEND_CROSSFADE_MASK = ONScripter::ALPHA_BLEND_CROSSFADE_MASK
+    };
+
+    static void setScreen(int w, int h) {
+        if (ons.screen_width == w && ons.screen_height == h &&
+            ons.accumulation_surface)
+            return;
+        freeScreen();
+
+        ons.screen_width = w;
+        ons.screen_height = h;
+        ons.screen_rect.x = ons.screen_rect.y = 0;
+        ons.screen_rect.w = w;
+        ons.screen_rect.h = h;
+        ons.dirty_rect.setDimension(w, h);
+        ons.dirty_rect.fill(w, h);
+
+        ons.accumulation_surface = allocNoiseSurface(w, h, 1);
+        ons.effect_src_surface = allocNoiseSurface(w, h, 2);
+        ons.effect_dst_surface = allocNoiseSurface(w, h, 3);
+        ons.effect_tmp_surface = allocNoiseSurface(w, h, 4);
+        mask_surface = allocNoiseSurface(w, h, 5);
+
+        // a sepia tint, as set by the monocro command
+        for (int i = 0; i < 256; i++) {
+            ons.monocro_color_lut[i][0] = (0xff * i) >> 8;
+            ons.monocro_color_lut[i][1] = (0xe0 * i) >> 8;
+            ons.monocro_color_lut[i][2] = (0xa0 * i) >> 8;
+        }
+#ifdef USE_BUILTIN_EFFECTS
+        ons.buildSinTable();
+        ons.buildCosTable();
+        ons.buildWhirlTable();
+#endif
+    }
+
+    static void alphaBlend(int trans_mode, Uint32 mask_value) {
+        ons.alphaBlend(
+            trans_mode == ALPHA_BLEND_CONST ? NULL : mask_surface,
+            trans_mode,
+            mask_value,
+            &ons.dirty_rect.bounding_box);
+    }
+    static void makeNegaSurface() {
+        ons.makeNegaSurface(ons.accumulation_surface,
+                            ons.dirty_rect.bounding_box);
+    }
+    static void makeMonochromeSurface() {
+        ons.makeMonochromeSurface(ons.accumulation_surface,
+                                  ons.dirty_rect.bounding_box);
+    }
+    static void resizeSurface(SDL_Surface *src) {
+        ons.resizeSurface(src, ons.accumulation_surface);
+    }
+
+    // runs an effect from its first frame to its last
+    static void effectBreakup() {
+        char params[] = "breakup/llp";
+        ons.effect_counter = 0;
+        ons.initBreakup(params);
+        for (int i = 1; i <= EFFECT_FRAMES; i++) {
+            ons.effect_counter = EFFECT_DURATION * i / EFFECT_FRAMES;
+            ons.effectBreakup(params, EFFECT_DURATION);
+        }
+    }
+#ifdef USE_BUILTIN_EFFECTS
+    static void effectWhirl() {
+        char params[] = "r";
+        for (int i = 1; i <= EFFECT_FRAMES; i++) {
+            ons.effect_counter = EFFECT_DURATION * i / EFFECT_FRAMES;
+            ons.effectWhirl(params, EFFECT_DURATION);
+        }
+    }
+    static void effectTrvswave() {
+        char params[] = "";
+        for (int i = 1; i <= EFFECT_FRAMES; i++) {
+            ons.effect_counter = EFFECT_DURATION * i / EFFECT_FRAMES;
+            ons.effectTrvswave(params, EFFECT_DURATION);
+        }
+    }
+#endif
+
+   private:
+    // the breakup and whirl tables are sized by the screen the first time
+    // they are built, so they have to go with it
+    static void freeScreen() {
+        SDL_Surface **surfaces[] = {&ons.accumulation_surface,
+                                    &ons.effect_src_surface,
+                                    &ons.effect_dst_surface,
+                                    &ons.effect_tmp_surface,
+                                    &mask_surface};
+        for (SDL_Surface **surface : surfaces) {
+            if (*surface) SDL_FreeSurface(*surface);
+            *surface = NULL;
+        }
+        delete[] ons.breakup_cells;
+        ons.breakup_cells = NULL;
+        delete[] ons.breakup_mask;
+        ons.breakup_mask = NULL;
+#ifdef USE_BUILTIN_EFFECTS
+        delete[] ons.whirl_table;
+        ons.whirl_table = NULL;
+#endif
+    }
+
+    static SDL_Surface *mask_surface;
+};
+
+SDL_Surface *ONScripterBench::mask_surface = NULL;
+
+// ----------------------------------------
+// AnimationInfo
+
+static void BM_BlendOnSurface(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    AnimationInfo anim;
+    anim.allocImage(w, h, BENCH_FORMAT);
+    bench::fillNoise(anim.image_surface->pixels,
+                     (size_t)anim.image_surface->pitch * h,
+                     6);
+    SDL_Surface *dst = allocNoiseSurface(w, h, 7);
+    SDL_Rect clip = {0, 0, w, h};
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) anim.blendOnSurface(dst, 0, 0, clip, 255);
+
+    setPixelCounters(state, w, h);
+    SDL_FreeSurface(dst);
+}
+BENCHMARK(BM_BlendOnSurface)->Apply(bench::resolutionThreadArgs);
+
+// a screen sized sprite turned by 30 degrees and scaled up by half
+static void BM_BlendOnSurface2(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    AnimationInfo anim;
+    anim.allocImage(w, h, BENCH_FORMAT);
+    bench::fillNoise(anim.image_surface->pixels,
+                     (size_t)anim.image_surface->pitch * h,
+                     8);
+    anim.pos.x = w / 2;
+    anim.pos.y = h / 2;
+    anim.scale_x = anim.scale_y = 150;
+    anim.rot = 30;
+    anim.calcAffineMatrix();
+    SDL_Surface *dst = allocNoiseSurface(w, h, 9);
+    SDL_Rect clip = {0, 0, w, h};
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) anim.blendOnSurface2(dst, 0, 0, clip, 255);
+
+    setPixelCounters(state, w, h);
+    SDL_FreeSurface(dst);
+}
+BENCHMARK(BM_BlendOnSurface2)->Apply(bench::resolutionThreadArgs);
+
+// a screen sized glyph coverage map, the 8bit surfaces fonts render to
+static void BM_BlendText(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    AnimationInfo anim;
+    anim.allocImage(w, h, BENCH_FORMAT);
+    SDL_Surface *glyph =
+        SDL_CreateRGBSurfaceWithFormat(0, w, h, 8, SDL_PIXELFORMAT_INDEX8);
+    bench::fillNoise(glyph->pixels, (size_t)glyph->pitch * h, 10);
+    SDL_Color color = {0xff, 0xff, 0xff, 0xff};
+    SDL_Rect clip = {0, 0, w, h};
+
+    for (auto _ : state) anim.blendText(glyph, 0, 0, color, &clip, false);
+
+    setPixelCounters(state, w, h);
+    SDL_FreeSurface(glyph);
+}
+BENCHMARK(BM_BlendText)->Apply(bench::resolutionArgs);
+
+// ----------------------------------------
+// ONScripter
+
+static void BM_AlphaBlend(benchmark::State &state, int trans_mode) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) ONScripterBench::alphaBlend(trans_mode, 128);
+
+    setPixelCounters(state, w, h);
+}
+BENCHMARK_CAPTURE(BM_AlphaBlend, const, ONScripterBench::ALPHA_BLEND_CONST)
+    ->Apply(bench::resolutionThreadArgs);
+BENCHMARK_CAPTURE(BM_AlphaBlend,
+                  fade_mask,
+                  ONScripterBench::ALPHA_BLEND_FADE_MASK)
+    ->Apply(bench::resolutionThreadArgs);
+BENCHMARK_CAPTURE(BM_AlphaBlend,
+                  crossfade_mask,
+                  ONScripterBench::ALPHA_BLEND_CROSSFADE_MASK)
+    ->Apply(bench::resolutionThreadArgs);
+
+static void BM_MakeNegaSurface(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+
+    for (auto _ : state) ONScripterBench::makeNegaSurface();
+
+    setPixelCounters(state, w, h);
+}
+BENCHMARK(BM_MakeNegaSurface)->Apply(bench::resolutionArgs);
+
+static void BM_MakeMonochromeSurface(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+
+    for (auto _ : state) ONScripterBench::makeMonochromeSurface();
+
+    setPixelCounters(state, w, h);
+}
+BENCHMARK(BM_MakeMonochromeSurface)->Apply(bench::resolutionArgs);
+
+// a 640x480 script scaled up to the screen
+static void BM_ResizeSurface(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+    SDL_Surface *src = allocNoiseSurface(640, 480, 11);
+
+    for (auto _ : state) ONScripterBench::resizeSurface(src);
+
+    setPixelCounters(state, w, h);
+    SDL_FreeSurface(src);
+}
+BENCHMARK(BM_ResizeSurface)->Apply(bench::resolutionArgs);
+
+// ----------------------------------------
+// effects, EFFECT_FRAMES frames per iteration
+
+static void setEffectCounters(benchmark::State &state, int w, int h) {
+    state.SetItemsProcessed(state.iterations() * EFFECT_FRAMES * w * h);
+    state.counters["frames"] =
+        benchmark::Counter((double)state.iterations() * EFFECT_FRAMES,
+                           benchmark::Counter::kIsRate);
+    // seconds per frame, printed as e.g. 4.2m for 4.2 ms
+    state.counters["frame_time"] =
+        benchmark::Counter((double)state.iterations() * EFFECT_FRAMES,
+                           benchmark::Counter::kIsRate |
+                               benchmark::Counter::kInvert);
+}
+
+static void BM_EffectBreakup(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) ONScripterBench::effectBreakup();
+
+    setEffectCounters(state, w, h);
+}
+BENCHMARK(BM_EffectBreakup)
+    ->Apply(bench::resolutionThreadArgs)
+    ->Unit(benchmark::kMillisecond);
+
+#ifdef USE_BUILTIN_EFFECTS
+static void BM_EffectWhirl(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) ONScripterBench::effectWhirl();
+
+    setEffectCounters(state, w, h);
+}
+BENCHMARK(BM_EffectWhirl)
+    ->Apply(bench::resolutionThreadArgs)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_EffectTrvswave(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    ONScripterBench::setScreen(w, h);
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) ONScripterBench::effectTrvswave();
+
+    setEffectCounters(state, w, h);
+}
+BENCHMARK(BM_EffectTrvswave)
+    ->Apply(bench::resolutionThreadArgs)
+    ->Unit(benchmark::kMillisecond);
+#endif
+
+#ifdef USE_BUILTIN_LAYER_EFFECTS
+// ----------------------------------------
+// layers
+
+// heavy snow: a new flake of each size every frame, all of them drawn
+// every frame
+static void BM_LayerSnow(benchmark::State &state) {
+    const int w = state.range(0), h = state.range(1);
+    AnimationInfo flakes[N_FURU_ELEMENTS], layer_sprite;
+    for (int i = 0; i < N_FURU_ELEMENTS; i++) {
+        const int size = w / (80 - 20 * i);
+        flakes[i].allocImage(size, size, BENCH_FORMAT);
+        bench::fillNoise(flakes[i].image_surface->pixels,
+                         (size_t)flakes[i].image_surface->pitch * size,
+                         11 + i);
+    }
+    FuruLayer layer(w, h, false);
+    layer.setSpriteInfo(flakes, &layer_sprite);
+    int ret;
+    layer.message("i|0,1,2", ret);
+    layer.message("s|1,4,2,8,10", ret);
+    layer.message("f", ret);
+    // fall until as many flakes leave the screen as enter it
+    for (int i = 0; i < h; i++) layer.update();
+    SDL_Surface *dst = allocNoiseSurface(w, h, 14);
+    SDL_Rect clip = {0, 0, w, h};
+    bench::ThreadLimit limit(state);
+
+    for (auto _ : state) {
+        layer.update();
+        layer.refresh(dst, clip);
+    }
+
+    layer.message("n", ret);
+    state.counters["flakes"] = ret;
+    state.counters["frames"] = benchmark::Counter(
+        (double)state.iterations(), benchmark::Counter::kIsRate);
+    SDL_FreeSurface(dst);
+}
+BENCHMARK(BM_LayerSnow)
+    ->Apply(bench::resolutionThreadArgs)
+    ->Unit(benchmark::kMillisecond);
+#endif
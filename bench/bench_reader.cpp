@@ -0,0 +1,475 @@
+/* -*- C++ -*-
+ *
+ *  bench_reader.cpp - Benchmarks of the archive decoders and readers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include <bzlib.h>
+
+#include <config.hpp>
+
+#include "ArchiveDecoder.h"
+#include "NsaReader.h"
+#include "bench.h"
+
+#define ENTRY_SIZE (1 << 20)
+#define ARCHIVE_ENTRIES 32
+
+typedef onscripter::Vector<unsigned char> Bytes;
+
+// a smooth gradient with a little noise, compressing about as well as
+// the bitmaps games ship
+static Bytes makeImageData(size_t length, uint32_t seed) {
+    Bytes data(length);
+    bench::fillNoise(data.data(), length, seed);
+    for (size_t i = 0; i < length; i++)
+        data[i] = (unsigned char)(i / 3 % 640 / 4 + i / 1920 / 8) +
+                  (data[i] & 3);
+    return data;
+}
+
+class BitWriter {
+   public:
+    void put(int value, int n) {
+        while (n-- > 0) {
+            cur = cur << 1 | ((value >> n) & 1);
+            if (++num_bits == 8) {
+                out.push_back(cur);
+                cur = 0;
+                num_bits = 0;
+            }
+        }
+    }
+    Bytes finish() {
+        if (num_bits > 0) put(0, 8 - num_bits);
+        return out;
+    }
+
+   private:
+    Bytes out;
+    unsigned char cur = 0;
+    int num_bits = 0;
+};
+
+// greedy encoder for the LZSS variant ons_decoder::decodeLZSS reads: a
+// 256 byte ring starting at 256 - 17, matches of 2 to 17 bytes
+static Bytes encodeLZSS(const Bytes &src) {
+    const int N = 256, F = 17;
+    unsigned char ring[N] = {0};
+    int r = N - F;
+    BitWriter bits;
+    size_t pos = 0;
+    while (pos < src.size()) {
+        int best_len = 0, best_i = 0;
+        const int max_len = (int)(src.size() - pos < F ? src.size() - pos : F);
+        for (int i = 0; i < N; i++) {
+            int len = 0;
+            while (len < max_len) {
+                // bytes copied earlier in this match are already in the ring
+                int ahead = (i + len - r) & (N - 1);
+                unsigned char c =
+                    ahead < len ? src[pos + ahead] : ring[(i + len) & (N - 1)];
+                if (c != src[pos + len]) break;
+                len++;
+            }
+            if (len > best_len) {
+                best_len = len;
+                best_i = i;
+            }
+        }
+        if (best_len >= 2) {
+            bits.put(0, 1);
+            bits.put(best_i, 8);
+            bits.put(best_len - 2, 4);
+        } else {
+            best_len = 1;
+            bits.put(1, 1);
+            bits.put(src[pos], 8);
+        }
+        for (int k = 0; k < best_len; k++) {
+            ring[r] = src[pos++];
+            r = (r + 1) & (N - 1);
+        }
+    }
+    return bits.finish();
+}
+
+static Bytes encodeNBZ(const Bytes &src) {
+    Bytes dst(src.size() + src.size() / 100 + 600 + 4);
+    unsigned int length = dst.size() - 4;
+    BZ2_bzBuffToBuffCompress((char *)dst.data() + 4,
+                             &length,
+                             (char *)src.data(),
+                             src.size(),
+                             9,
+                             0,
+                             30);
+    dst.resize(length + 4);
+    for (int i = 0; i < 4; i++) dst[i] = src.size() >> (24 - i * 8);
+    return dst;
+}
+
+// SPB encoder for the format ons_decoder::decodeSPB reads: each colour of
+// the bitmap in rows of alternating direction from the top, as a first
+// value and then groups of four sized by their largest change
+static Bytes encodeSPB(const Bytes &bitmap, int w, int h) {
+    const int pitch = (w * 3 + 3) / 4 * 4;
+    const size_t pixels = (size_t)w * h;
+    // the last group is filled up with the last value
+    onscripter::Vector<int> plane(1 + (pixels + 2) / 4 * 4);
+    BitWriter bits;
+    bits.put(w, 16);
+    bits.put(h, 16);
+    for (int i = 0; i < 3; i++) {
+        size_t count = 0;
+        for (int y = 0; y < h; y++) {
+            // BMP keeps the top row last
+            const unsigned char *row =
+                bitmap.data() + 54 + (size_t)pitch * (h - 1 - y) + i;
+            for (int x = 0; x < w; x++)
+                plane[count++] = row[(y & 1 ? w - 1 - x : x) * 3];
+        }
+        for (; count < plane.size(); count++) plane[count] = plane[count - 1];
+
+        int c = plane[0];
+        bits.put(c, 8);
+        for (size_t p = 1; p < plane.size(); p += 4) {
+            int k[4], m = 0, prev = c;
+            for (int j = 0; j < 4; j++) {
+                int d = plane[p + j] - prev;
+                k[j] = d > 0 ? d * 2 - 1 : -d * 2;
+                while (k[j] >> m) m++;
+                prev = plane[p + j];
+            }
+            if (m == 0) {
+                bits.put(0, 3);
+                continue;
+            }
+            if (m <= 2) {
+                bits.put(7, 3);
+                bits.put(m - 1, 1);
+            } else if (m <= 7) {
+                bits.put(m - 2, 3);
+            } else {
+                m = 8;
+                bits.put(6, 3);
+            }
+            for (int j = 0; j < 4; j++)
+                bits.put(m == 8 ? plane[p + j] : k[j], m);
+            c = plane[p + 3];
+        }
+    }
+    return bits.finish();
+}
+
+// a 24 bit bitmap of makeImageData pixels; only the fields decodeSPB checks
+// against are set in the header
+static Bytes makeBitmap(int w, int h, uint32_t seed) {
+    const size_t body = (size_t)(w * 3 + 3) / 4 * 4 * h;
+    Bytes bitmap = makeImageData(54 + body, seed);
+    memset(bitmap.data(), 0, 54);
+    bitmap[0] = 'B';
+    bitmap[1] = 'M';
+    return bitmap;
+}
+
+// true if decoded is the bitmap the SPB stream encoded holds, checked by
+// encoding it again and decoding that
+static bool checkSPB(const Bytes &encoded, const Bytes &decoded) {
+    int w = encoded[0] << 8 | encoded[1], h = encoded[2] << 8 | encoded[3];
+    if (w == 0 || h == 0) return decoded.size() == 54;
+    Bytes again = encodeSPB(decoded, w, h);
+    Bytes redecoded(decoded.size());
+    ons_decoder::decodeSPB(again.data(), again.size(), redecoded.data());
+    return decoded[0] == 'B' && decoded[1] == 'M' &&
+           memcmp(redecoded.data() + 54, decoded.data() + 54,
+                  decoded.size() - 54) == 0;
+}
+
+// ----------------------------------------
+// decoders
+
+// at most this much of the sample archive is read for one benchmark
+#define SAMPLE_BYTES (64 << 20)
+
+// the raw entries of the sample archive compressed as compression_type,
+// false if no archive was given or it holds none of them
+static bool loadSampleEntries(int compression_type,
+                              onscripter::Vector<Bytes> &entries,
+                              onscripter::Vector<size_t> &lengths) {
+    const char *path = bench::sampleArchive();
+    if (!path) return false;
+    NsaReader reader;
+    if (reader.openForConvert((char *)path)) return false;
+
+    size_t total = 0;
+    for (int i = 0; i < reader.getNumFiles() && total < SAMPLE_BYTES; i++) {
+        BaseReader::ArchiveInfo *ai = reader.getArchiveInfoByIndex(i);
+        const BaseReader::FileInfo &fi = ai->fi_list[i];
+        if (fi.compression_type != compression_type || fi.length < 4)
+            continue;
+
+        Bytes data(fi.length);
+        if (ons_fseek64(ai->file_handle, fi.offset, SEEK_SET) != 0 ||
+            fread(data.data(), 1, fi.length, ai->file_handle) != fi.length)
+            return false;
+        lengths.push_back(compression_type == BaseReader::SPB_COMPRESSION
+                              ? ons_decoder::getSPBLength(data.data(),
+                                                          data.size())
+                              : fi.original_length);
+        entries.push_back(std::move(data));
+        total += fi.length;
+    }
+    return !entries.empty();
+}
+
+static void BM_DecodeLZSS(benchmark::State &state) {
+    onscripter::Vector<Bytes> encoded;
+    onscripter::Vector<size_t> lengths;
+    Bytes original;
+    bool sample = loadSampleEntries(
+        BaseReader::LZSS_COMPRESSION, encoded, lengths);
+    if (!sample) {
+        original = makeImageData(ENTRY_SIZE, 1);
+        encoded.push_back(encodeLZSS(original));
+        lengths.push_back(original.size());
+    }
+    onscripter::Vector<Bytes> decoded(encoded.size());
+    size_t total = 0;
+    for (size_t i = 0; i < encoded.size(); i++) {
+        decoded[i].resize(lengths[i]);
+        total += lengths[i];
+    }
+
+    bool short_entry = false;
+    for (auto _ : state) {
+        for (size_t i = 0; i < encoded.size(); i++) {
+            if (ons_decoder::decodeLZSS(encoded[i].data(),
+                                        encoded[i].size(),
+                                        decoded[i].data(),
+                                        decoded[i].size()) != lengths[i])
+                short_entry = true;
+        }
+        benchmark::DoNotOptimize(decoded.data());
+    }
+
+    if (short_entry)
+        state.SkipWithError("an LZSS entry decoded short");
+    else if (!sample && decoded[0] != original)
+        state.SkipWithError("LZSS round trip failed");
+    state.SetLabel(sample ? bench::sampleArchive() : "synthetic");
+    state.SetBytesProcessed(state.iterations() * total);
+}
+BENCHMARK(BM_DecodeLZSS);
+
+static void BM_DecodeSPB(benchmark::State &state) {
+    onscripter::Vector<Bytes> encoded;
+    onscripter::Vector<size_t> lengths;
+    Bytes original;
+    bool sample =
+        loadSampleEntries(BaseReader::SPB_COMPRESSION, encoded, lengths);
+    if (!sample) {
+        const int w = 640, h = 480;
+        original = makeBitmap(w, h, 2);
+        encoded.push_back(encodeSPB(original, w, h));
+        lengths.push_back(original.size());
+    }
+    onscripter::Vector<Bytes> decoded(encoded.size());
+    size_t total = 0;
+    for (size_t i = 0; i < encoded.size(); i++) {
+        decoded[i].resize(lengths[i]);
+        total += lengths[i];
+    }
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < encoded.size(); i++)
+            ons_decoder::decodeSPB(
+                encoded[i].data(), encoded[i].size(), decoded[i].data());
+        benchmark::DoNotOptimize(decoded.data());
+    }
+
+    if (!sample) {
+        if (memcmp(decoded[0].data() + 54,
+                   original.data() + 54,
+                   original.size() - 54) != 0)
+            state.SkipWithError("SPB round trip failed");
+    } else {
+        for (size_t i = 0; i < encoded.size(); i++) {
+            if (!checkSPB(encoded[i], decoded[i])) {
+                state.SkipWithError("an SPB entry decoded wrong");
+                break;
+            }
+        }
+    }
+    state.SetLabel(sample ? bench::sampleArchive() : "synthetic");
+    state.SetBytesProcessed(state.iterations() * total);
+}
+BENCHMARK(BM_DecodeSPB);
+
+static void BM_DecodeNBZ(benchmark::State &state) {
+    Bytes original = makeImageData(ENTRY_SIZE, 3);
+    Bytes encoded = encodeNBZ(original);
+    Bytes decoded(ons_decoder::getNBZLength(encoded.data(), encoded.size()));
+
+    for (auto _ : state) {
+        ons_decoder::decodeNBZ(encoded.data(), encoded.size(), decoded.data());
+        benchmark::DoNotOptimize(decoded.data());
+    }
+
+    if (decoded != original) state.SkipWithError("NBZ round trip failed");
+    state.SetBytesProcessed(state.iterations() * decoded.size());
+}
+BENCHMARK(BM_DecodeNBZ)->Unit(benchmark::kMillisecond);
+
+// ----------------------------------------
+// NsaReader shared by several threads
+
+#define LOOSE_FILES 4
+#define LOOSE_FILE_SIZE (256 << 10)
+
+static onscripter::String archive_dir;
+static NsaReader *archive_reader = NULL;
+// what every entry of arc.nsa and every loose file decodes to
+static onscripter::Vector<Bytes> archive_originals, loose_originals;
+
+static void writeBE(FILE *fp, unsigned long value, int bytes) {
+    while (bytes-- > 0) fputc((value >> (bytes * 8)) & 0xff, fp);
+}
+
+// arc.nsa in a temporary directory, odd entries stored and even entries
+// LZSS compressed, next to a few loose files DirectReader serves
+static void createArchive() {
+    archive_dir =
+        (onscripter::fs::temp_directory_path() / "ons_bench_arc").string() +
+        DELIMITER;
+    onscripter::fs::create_directories(archive_dir);
+
+    onscripter::Vector<Bytes> bodies(ARCHIVE_ENTRIES);
+    size_t header_length = 6;
+    for (int i = 0; i < ARCHIVE_ENTRIES; i++) {
+        archive_originals.push_back(makeImageData(ENTRY_SIZE, 100 + i));
+        const Bytes &original = archive_originals.back();
+        bodies[i] = i % 2 ? original : encodeLZSS(original);
+        header_length += strlen("e00.bmp") + 1 + 1 + 4 * 3;
+    }
+
+    FILE *fp = fopen((archive_dir + "arc.nsa").c_str(), "wb");
+    writeBE(fp, ARCHIVE_ENTRIES, 2);
+    writeBE(fp, header_length, 4);
+    size_t offset = 0;
+    for (int i = 0; i < ARCHIVE_ENTRIES; i++) {
+        fprintf(fp, "e%02d.bmp", i);
+        fputc(0, fp);
+        fputc(i % 2 ? BaseReader::NO_COMPRESSION : BaseReader::LZSS_COMPRESSION,
+              fp);
+        writeBE(fp, offset, 4);
+        writeBE(fp, bodies[i].size(), 4);
+        writeBE(fp, ENTRY_SIZE, 4);
+        offset += bodies[i].size();
+    }
+    for (const Bytes &body : bodies) fwrite(body.data(), 1, body.size(), fp);
+    fclose(fp);
+
+    char name[32];
+    for (int i = 0; i < LOOSE_FILES; i++) {
+        loose_originals.push_back(makeImageData(LOOSE_FILE_SIZE, 200 + i));
+        snprintf(name, sizeof(name), "loose%d.dat", i);
+        fp = fopen((archive_dir + name).c_str(), "wb");
+        fwrite(loose_originals[i].data(), 1, LOOSE_FILE_SIZE, fp);
+        fclose(fp);
+    }
+}
+
+static void BM_NsaReaderGetFile(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        if (archive_dir.empty()) createArchive();
+        archive_reader = new NsaReader(0, (char *)archive_dir.c_str());
+        archive_reader->open();
+    }
+    Bytes buffer(ENTRY_SIZE);
+    int no = state.thread_index();
+    char name[16];
+
+    // the loop starts once every thread got here, the archive open
+    for (auto _ : state) {
+        snprintf(name, sizeof(name), "e%02d.bmp", no % ARCHIVE_ENTRIES);
+        if (archive_reader->getFile(name, buffer.data()) != ENTRY_SIZE) {
+            state.SkipWithError("short read");
+            break;
+        }
+        no += state.threads();
+    }
+
+    state.SetBytesProcessed(state.iterations() * ENTRY_SIZE);
+    if (state.thread_index() == 0) {
+        delete archive_reader;
+        archive_reader = NULL;
+    }
+}
+BENCHMARK(BM_NsaReaderGetFile)
+    ->ThreadRange(1, 8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// not a measure so much as a check that readers shared by threads hand out
+// the right bytes: each thread reads entries and loose files at random
+// with getFileLength and getFile and compares them with what was written
+static void BM_NsaReaderRandomRead(benchmark::State &state) {
+    if (state.thread_index() == 0) {
+        if (archive_dir.empty()) createArchive();
+        archive_reader = new NsaReader(0, (char *)archive_dir.c_str());
+        archive_reader->open();
+    }
+    Bytes buffer;
+    uint32_t x = 2654435761u * (state.thread_index() + 1);
+    char name[32];
+    size_t bytes = 0;
+
+    for (auto _ : state) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        int no = x % (ARCHIVE_ENTRIES + LOOSE_FILES);
+        const Bytes *original;
+        if (no < ARCHIVE_ENTRIES) {
+            snprintf(name, sizeof(name), "e%02d.bmp", no);
+            original = &archive_originals[no];
+        } else {
+            snprintf(name, sizeof(name), "loose%d.dat", no - ARCHIVE_ENTRIES);
+            original = &loose_originals[no - ARCHIVE_ENTRIES];
+        }
+
+        size_t length = archive_reader->getFileLength(name);
+        buffer.assign(length, 0);
+        if (length != original->size() ||
+            archive_reader->getFile(name, buffer.data()) != length ||
+            buffer != *original) {
+            state.SkipWithError(name);
+            break;
+        }
+        bytes += length;
+    }
+
+    state.SetBytesProcessed(bytes);
+    if (state.thread_index() == 0) {
+        delete archive_reader;
+        archive_reader = NULL;
+    }
+}
+BENCHMARK(BM_NsaReaderRandomRead)
+    ->ThreadRange(1, 8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,204 @@
+/* -*- C++ -*-
+ *
+ *  bench_script.cpp - Benchmarks of the script handler
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ScriptHandler.h"
+#include "bench.h"
+
+// how many names a long title puts in NScrflog.dat
+static void logSizeArgs(benchmark::internal::Benchmark *b) {
+    b->ArgName("entries");
+    for (int n : {1000, 10000, 50000}) b->Arg(n);
+}
+
+static void fileName(char *buf, size_t length, int i) {
+    snprintf(buf, length, "image/ev/cg%05d_%02d.png", i / 8, i % 8);
+}
+
+// every image load with filelog on: the names are mostly logged already
+static void BM_FindAndAddLog(benchmark::State &state) {
+    const int entries = (int)state.range(0);
+    ScriptHandler script_h;
+    ScriptHandler::LogInfo &info = script_h.log_info[ScriptHandler::FILE_LOG];
+    char name[64];
+    for (int i = 0; i < entries; i++) {
+        fileName(name, sizeof(name), i);
+        script_h.findAndAddLog(info, name, true);
+    }
+
+    // walk the names in a stride, so hits are spread over the whole log
+    int i = 0;
+    for (auto _ : state) {
+        fileName(name, sizeof(name), i);
+        benchmark::DoNotOptimize(script_h.findAndAddLog(info, name, true));
+        i = (i + 7919) % entries;
+    }
+
+    if ((int)info.order.size() != entries)
+        state.SkipWithError("a logged name was added twice");
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindAndAddLog)->Apply(logSizeArgs);
+
+// fchk of names that were never shown
+static void BM_FindLogMiss(benchmark::State &state) {
+    const int entries = (int)state.range(0);
+    ScriptHandler script_h;
+    ScriptHandler::LogInfo &info = script_h.log_info[ScriptHandler::FILE_LOG];
+    char name[64];
+    for (int i = 0; i < entries; i++) {
+        fileName(name, sizeof(name), i);
+        script_h.findAndAddLog(info, name, true);
+    }
+
+    int i = entries;
+    for (auto _ : state) {
+        fileName(name, sizeof(name), i++);
+        benchmark::DoNotOptimize(script_h.findAndAddLog(info, name, false));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindLogMiss)->Apply(logSizeArgs);
+
+// variables past variable_range, as scripts using %4096 and up have them;
+// a bare ScriptHandler has a range of 0, so every variable is extended
+static void BM_ExtendedVariable(benchmark::State &state) {
+    const int entries = (int)state.range(0);
+    ScriptHandler script_h;
+    for (int i = 0; i < entries; i++) script_h.getVariableData(i).num = i;
+
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(script_h.getVariableData(i).num);
+        i = (i + 7919) % entries;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ExtendedVariable)->Apply(logSizeArgs);
+
+// ----------------------------------------
+// integer expressions
+
+#define EXPRESSION_LINES 20000
+#define EXPRESSION_VARIABLES 200
+
+static onscripter::String script_dir;
+
+// 0.txt in a temporary directory: a label followed by one expression per
+// line, literals and integer variables as conditions and mov arguments
+// have them
+static void createExpressionScript() {
+    script_dir =
+        (onscripter::fs::temp_directory_path() / "ons_bench_script").string() +
+        DELIMITER;
+    onscripter::fs::create_directories(script_dir);
+
+    FILE *fp = fopen((script_dir + "0.txt").c_str(), "wb");
+    fprintf(fp, "*define\ngame\n*start\n");
+    for (int i = 0; i < EXPRESSION_LINES; i++) {
+        int v = i % EXPRESSION_VARIABLES;
+        if (i % 4 == 1)
+            fprintf(fp,
+                    "%%%d * %d + (%%%d - %d) / %d mod %d - %d\n",
+                    v,
+                    i % 7 + 1,
+                    (v + 1) % EXPRESSION_VARIABLES,
+                    i % 13,
+                    i % 5 + 1,
+                    i % 11 + 2,
+                    i);
+        else if (i % 4 == 3)
+            fprintf(fp, "%d * %%%d\n", i, v);
+        else if (i % 8 == 2)
+            fprintf(fp, "%%%d\n", v);
+        else
+            fprintf(fp, "%%%d + %d\n", v, i);
+    }
+    fclose(fp);
+}
+
+// the values of the expressions and the current_variable each one leaves,
+// which commands such as mov go on to read
+struct ExpressionResults {
+    int64_t sum = 0;
+    uint64_t variables = 0;
+};
+
+static ExpressionResults evaluateAll(ScriptHandler &script_h,
+                                     const onscripter::Vector<char *> &lines) {
+    ExpressionResults results;
+    for (char *line : lines) {
+        char *p = line;
+        results.sum += script_h.parseIntExpression(&p);
+        const ScriptHandler::VariableInfo &var = script_h.current_variable;
+        results.variables = (results.variables ^ (uint32_t)var.type) * 31 ^
+                            (uint32_t)var.var_no;
+    }
+    return results;
+}
+
+// every expression of the script with the postfix cache off (text parser)
+// and on; both have to give the same values and current_variable
+static void BM_IntExpression(benchmark::State &state) {
+    if (script_dir.empty()) createExpressionScript();
+    ScriptHandler script_h;
+    if (script_h.openScript((char *)script_dir.c_str())) {
+        state.SkipWithError("can't open the script");
+        return;
+    }
+    for (int i = 0; i < EXPRESSION_VARIABLES; i++)
+        script_h.getVariableData(i).num = i * 37 - 1000;
+
+    onscripter::Vector<char *> lines;
+    char *p = script_h.lookupLabel("start").start_address;
+    for (int i = 0; i < EXPRESSION_LINES && p; i++) {
+        lines.push_back(p);
+        p = strchr(p, '\n');
+        if (p) p++;
+    }
+    if (lines.size() != EXPRESSION_LINES) {
+        state.SkipWithError("the script lost lines");
+        return;
+    }
+
+    script_h.setIntExpressionCache(false);
+    ExpressionResults expected = evaluateAll(script_h, lines);
+    script_h.setIntExpressionCache(state.range(0) != 0);
+
+    for (auto _ : state) {
+        ExpressionResults results = evaluateAll(script_h, lines);
+        benchmark::DoNotOptimize(results);
+        if (results.sum != expected.sum) {
+            state.SkipWithError("cached expressions differ from the text");
+            break;
+        }
+        if (results.variables != expected.variables) {
+            state.SkipWithError("cached expressions leave another variable");
+            break;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * lines.size());
+}
+BENCHMARK(BM_IntExpression)
+    ->ArgName("cache")
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMicrosecond);
@@ -25,6 +25,8 @@
 #include "AnimationInfo.h"
 
 #include <math.h>
+
+#include <algorithm>
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
@@ -45,11 +47,16 @@
 static bool is_inv_alpha_lut_initialized = false;
 static Uint32 inv_alpha_lut[256];
 
+unsigned int AnimationInfo::surface_generation = 0;
+unsigned int AnimationInfo::image_serial = 0;
+
 AnimationInfo::AnimationInfo() {
     image_name = NULL;
     surface_name = NULL;
     mask_surface_name = NULL;
     image_surface = NULL;
+    opacity_checked = is_opaque = false;
+    image_version = 0;
     alpha_buf = NULL;
     mutex = SDL_CreateMutex();
 
@@ -82,6 +89,7 @@ AnimationInfo::~AnimationInfo() {
 AnimationInfo &AnimationInfo::operator=(const AnimationInfo &anim) {
     if (this != &anim) {
         memcpy(this, &anim, sizeof(AnimationInfo));
+        image_version = ++image_serial;
 
         mutex = SDL_CreateMutex();
 
@@ -125,6 +133,7 @@ AnimationInfo &AnimationInfo::operator=(const AnimationInfo &anim) {
                    anim.image_surface->pixels,
                    anim.image_surface->pitch * anim.image_surface->h);
         }
+        surface_generation++;
     }
 
     return *this;
@@ -183,8 +192,12 @@ void AnimationInfo::deleteSurface(bool delete_surface_name) {
         mask_surface_name = NULL;
     }
     SDL_mutexP(mutex);
-    if (image_surface) SDL_FreeSurface(image_surface);
+    if (image_surface) {
+        SDL_FreeSurface(image_surface);
+        surface_generation++;
+    }
     image_surface = NULL;
+    imageChanged();
     SDL_mutexV(mutex);
     if (alpha_buf) delete[] alpha_buf;
     alpha_buf = NULL;
@@ -515,6 +528,108 @@ inline void rainAddBlend32(const Uint32 *src_buffer,
         alphap += 4;                                                           \
     }
 
+// blends dst_rect_w pixels of a row of the image onto dst
+static void blendRow(const AnimationInfo::ONSBuf *src_buffer,
+                     AnimationInfo::ONSBuf *dst_buffer,
+                     const int dst_rect_w,
+                     const int alpha,
+                     const int blendmode) {
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+    unsigned char *alphap = (unsigned char *)src_buffer + 3;
+#else
+    unsigned char *alphap = (unsigned char *)src_buffer;
+#endif  // SDL_BYTEORDER == SDL_LIL_ENDIAN
+#ifdef USE_BUILTIN_LAYER_EFFECTS
+    if (blendmode == AnimationInfo::BLEND_ADD) {
+#ifdef USE_SIMD
+        rainAddBlend32(src_buffer, dst_buffer, dst_rect_w);
+#else
+        for (int j = dst_rect_w; j != 0; j--, src_buffer++, dst_buffer++) {
+            if (*src_buffer != AMASK)
+                rainAddBlendPixel32(src_buffer, dst_buffer);
+        }
+#endif  // USE_SIMD
+    } else
+#endif
+#ifdef USE_SIMD
+    {
+        using namespace simd;
+#ifdef USE_SIMD_X86_AVX2
+        ivec256 zero = ivec256::zero();
+        uint8x32 mask = uint8x32::set8(3, 7, 11, 15, 19, 23, 27, 31);
+        uint8x32 amask =
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+            uint8x32::set(0, 0, 0, 0xFF);
+#else
+            uint8x32::set(0xFF, 0, 0, 0);
+#endif
+        ivec128 zerol = zero.lo();
+        uint8x16 maskl = mask.lo();
+        uint8x16 amaskl = amask.lo();
+#else
+        ivec128 zerol = ivec128::zero();
+        uint8x16 maskl = uint8x16::set4(3, 7, 11, 15);
+        uint8x16 amaskl =
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+            uint8x16::set(0, 0, 0, 0xFF);
+#else
+            uint8x16::set(0xFF, 0, 0, 0);
+#endif
+#endif
+        int remain = dst_rect_w;
+        while (remain > 0) {
+            if (*alphap == 0) {
+                --remain;
+                ++src_buffer;
+                ++dst_buffer;
+                alphap += 4;
+            } else if ((*alphap == 255) && (alpha == 255)) {
+                *dst_buffer = *src_buffer;
+                --remain;
+                ++src_buffer;
+                ++dst_buffer;
+                alphap += 4;
+            }
+#ifdef USE_SIMD_X86_AVX2
+            else if (remain >= 8) {
+                blend8Pixel32(src_buffer,
+                              dst_buffer,
+                              uint16x16(alpha),
+                              mask,
+                              zero,
+                              amask);
+                remain -= 8;
+                src_buffer += 8;
+                dst_buffer += 8;
+                alphap += 32;
+            }
+#endif
+            else if (remain >= 4) {
+                blend4Pixel32(src_buffer,
+                              dst_buffer,
+                              uint16x8(alpha),
+                              maskl,
+                              zerol,
+                              amaskl);
+                remain -= 4;
+                src_buffer += 4;
+                dst_buffer += 4;
+                alphap += 16;
+            } else {
+                BLEND_PIXEL();
+                --remain;
+                ++src_buffer;
+                ++dst_buffer;
+            }
+        }
+    }
+#else
+    for (int j = dst_rect_w; j != 0; j--, src_buffer++, dst_buffer++) {
+        BLEND_PIXEL();
+    }
+#endif
+}
+
 void AnimationInfo::blendOnSurface(
     SDL_Surface *dst_surface, int dst_x, int dst_y, SDL_Rect &clip, int alpha) {
     if (image_surface == NULL) return;
@@ -542,103 +657,11 @@ void AnimationInfo::blendOnSurface(
             blendmode;
 
         void operator()(const int i) const {
-            const ONSBuf *src_buffer = stsrc_buffer + (pitch)*i;
-            ONSBuf *dst_buffer = stdst_buffer + (dst_surface_w)*i;
-#if SDL_BYTEORDER == SDL_LIL_ENDIAN
-            unsigned char *alphap = (unsigned char *)src_buffer + 3;
-#else
-            unsigned char *alphap = (unsigned char *)src_buffer;
-#endif  // SDL_BYTEORDER == SDL_LIL_ENDIAN
-#ifdef USE_BUILTIN_LAYER_EFFECTS
-            if (blendmode == AnimationInfo::BLEND_ADD) {
-#ifdef USE_SIMD
-                rainAddBlend32(src_buffer, dst_buffer, dst_rect_w);
-#else
-                for (int j = dst_rect_w; j != 0;
-                     j--, src_buffer++, dst_buffer++) {
-                    if (*src_buffer != AMASK)
-                        rainAddBlendPixel32(src_buffer, dst_buffer);
-                }
-#endif  // USE_SIMD
-            } else
-#endif
-#ifdef USE_SIMD
-            {
-                using namespace simd;
-#ifdef USE_SIMD_X86_AVX2
-                ivec256 zero = ivec256::zero();
-                uint8x32 mask = uint8x32::set8(3, 7, 11, 15, 19, 23, 27, 31);
-                uint8x32 amask =
-#if SDL_BYTEORDER == SDL_LIL_ENDIAN
-                    uint8x32::set(0, 0, 0, 0xFF);
-#else
-                    uint8x32::set(0xFF, 0, 0, 0);
-#endif
-                ivec128 zerol = zero.lo();
-                uint8x16 maskl = mask.lo();
-                uint8x16 amaskl = amask.lo();
-#else
-                ivec128 zerol = ivec128::zero();
-                uint8x16 maskl = uint8x16::set4(3, 7, 11, 15);
-                uint8x16 amaskl =
-#if SDL_BYTEORDER == SDL_LIL_ENDIAN
-                    uint8x16::set(0, 0, 0, 0xFF);
-#else
-                    uint8x16::set(0xFF, 0, 0, 0);
-#endif
-#endif
-                int remain = dst_rect_w;
-                while (remain > 0) {
-                    if (*alphap == 0) {
-                        --remain;
-                        ++src_buffer;
-                        ++dst_buffer;
-                        alphap += 4;
-                    } else if ((*alphap == 255) && (alpha == 255)) {
-                        *dst_buffer = *src_buffer;
-                        --remain;
-                        ++src_buffer;
-                        ++dst_buffer;
-                        alphap += 4;
-                    }
-#ifdef USE_SIMD_X86_AVX2
-                    else if (remain >= 8) {
-                        blend8Pixel32(src_buffer,
-                                      dst_buffer,
-                                      uint16x16(alpha),
-                                      mask,
-                                      zero,
-                                      amask);
-                        remain -= 8;
-                        src_buffer += 8;
-                        dst_buffer += 8;
-                        alphap += 32;
-                    }
-#endif
-                    else if (remain >= 4) {
-                        blend4Pixel32(src_buffer,
-                                      dst_buffer,
-                                      uint16x8(alpha),
-                                      maskl,
-                                      zerol,
-                                      amaskl);
-                        remain -= 4;
-                        src_buffer += 4;
-                        dst_buffer += 4;
-                        alphap += 16;
-                    } else {
-                        BLEND_PIXEL();
-                        --remain;
-                        ++src_buffer;
-                        ++dst_buffer;
-                    }
-                }
-            }
-#else
-            for (int j = dst_rect_w; j != 0; j--, src_buffer++, dst_buffer++) {
-                BLEND_PIXEL();
-            }
-#endif
+            blendRow(stsrc_buffer + (pitch)*i,
+                     stdst_buffer + (dst_surface_w)*i,
+                     dst_rect_w,
+                     alpha,
+                     blendmode);
         }
     } blender = {(ONSBuf *)image_surface->pixels + pitch * src_rect.y +
                      image_surface->w * current_cell / num_of_cells +
@@ -662,6 +685,100 @@ void AnimationInfo::blendOnSurface(
     SDL_mutexV(mutex);
 }
 
+void AnimationInfo::blendBatchOnSurface(SDL_Surface *dst_surface,
+                                        int n,
+                                        const int *xs,
+                                        const int *ys,
+                                        const int *cells,
+                                        SDL_Rect &clip,
+                                        int alpha) {
+    enum {
+        // rows of the destination blended together; small enough that a
+        // band stays in cache while every copy crossing it is drawn
+        BATCH_BAND_HEIGHT = 16
+    };
+    if (image_surface == NULL || alpha == 0) return;
+
+    struct Copy {
+        int x, y, w, h;
+        const ONSBuf *src;
+    };
+    int pitch = image_surface->pitch / sizeof(ONSBuf);
+    onscripter::Vector<Copy> copies;
+    copies.reserve(n);
+    int top = clip.y + clip.h, bottom = clip.y, pixels = 0;
+    for (int k = 0; k < n; k++) {
+        SDL_Rect dst_rect, src_rect;
+        dst_rect.x = xs[k];
+        dst_rect.y = ys[k];
+        dst_rect.w = pos.w;
+        dst_rect.h = pos.h;
+        if (doClipping(&dst_rect, &clip, &src_rect)) continue;
+        copies.push_back({dst_rect.x,
+                          dst_rect.y,
+                          dst_rect.w,
+                          dst_rect.h,
+                          (ONSBuf *)image_surface->pixels +
+                              pitch * src_rect.y +
+                              image_surface->w * cells[k] / num_of_cells +
+                              src_rect.x});
+        if (dst_rect.y < top) top = dst_rect.y;
+        if (dst_rect.y + dst_rect.h > bottom) bottom = dst_rect.y + dst_rect.h;
+        pixels += dst_rect.w * dst_rect.h;
+    }
+    if (copies.empty()) return;
+
+    /* ---------------------------------------- */
+
+    SDL_mutexP(mutex);
+    SDL_LockSurface(dst_surface);
+    SDL_LockSurface(image_surface);
+
+    // each band draws the rows of every copy crossing it, copies in order,
+    // so a pixel sees the same blends in the same order as copy by copy
+    struct BandBlender {
+        const Copy *copies;
+        const int n_copies;
+        ONSBuf *const dst_buffer;
+        const int alpha, top, bottom, pitch, dst_surface_w, blendmode;
+
+        void operator()(const int band) const {
+            const int y0 = top + band * BATCH_BAND_HEIGHT;
+            const int y1 = std::min(y0 + BATCH_BAND_HEIGHT, bottom);
+            for (int k = 0; k < n_copies; k++) {
+                const Copy &copy = copies[k];
+                const int first = std::max(y0, copy.y);
+                const int last = std::min(y1, copy.y + copy.h);
+                for (int y = first; y < last; y++)
+                    blendRow(copy.src + pitch * (y - copy.y),
+                             dst_buffer + dst_surface_w * y + copy.x,
+                             copy.w,
+                             alpha,
+                             blendmode);
+            }
+        }
+    } blender = {copies.data(),
+                 (int)copies.size(),
+                 (ONSBuf *)dst_surface->pixels,
+                 alpha & 0xff,
+                 top,
+                 bottom,
+                 pitch,
+                 dst_surface->w,
+                 blending_mode};
+    const int bands =
+        (bottom - top + BATCH_BAND_HEIGHT - 1) / BATCH_BAND_HEIGHT;
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+    parallel::For(0, bands, 1, blender, pixels);
+#else
+    for (int i = 0; i < bands; i++) blender(i);
+#endif
+
+    SDL_UnlockSurface(image_surface);
+    SDL_UnlockSurface(dst_surface);
+    SDL_mutexV(mutex);
+}
+
 void AnimationInfo::blendOnSurface2(
     SDL_Surface *dst_surface, int dst_x, int dst_y, SDL_Rect &clip, int alpha) {
     if (image_surface == NULL) return;
@@ -948,6 +1065,7 @@ void AnimationInfo::blendText(SDL_Surface *surface,
                               SDL_Rect *clip,
                               bool rotate_flag) {
     if (image_surface == NULL || surface == NULL) return;
+    imageChanged();
 
     SDL_Rect dst_rect;
     dst_rect.x = dst_x;
@@ -1106,7 +1224,9 @@ void AnimationInfo::allocImage(int w, int h, Uint32 texture_format) {
         SDL_mutexP(mutex);
         image_surface = allocSurface(w, h, texture_format);
         SDL_mutexV(mutex);
+        surface_generation++;
     }
+    imageChanged();
 
     abs_flag = true;
     pos.w = w / num_of_cells;
@@ -1123,6 +1243,7 @@ void AnimationInfo::copySurface(SDL_Surface *surface,
                                 SDL_Rect *dst_rect,
                                 bool blended) {
     if (!image_surface || !surface) return;
+    imageChanged();
 
     SDL_Rect _dst_rect = {0, 0};
     if (dst_rect) _dst_rect = *dst_rect;
@@ -1210,6 +1331,7 @@ void AnimationInfo::copySurface(SDL_Surface *surface,
 
 void AnimationInfo::fill(Uint8 r, Uint8 g, Uint8 b, Uint8 a) {
     if (!image_surface) return;
+    imageChanged();
 
     SDL_mutexP(mutex);
     SDL_LockSurface(image_surface);
@@ -1424,9 +1546,42 @@ void AnimationInfo::setImage(SDL_Surface *surface, Uint32 texture_format) {
 
     this->texture_format = texture_format;
     image_surface = surface;  // deleteSurface() should be called beforehand
+    surface_generation++;
     allocImage(surface->w, surface->h, texture_format);
 }
 
+bool AnimationInfo::isOpaque() {
+    if (!opacity_checked) {
+        SDL_mutexP(mutex);
+        is_opaque = image_surface && isOpaqueSurface(image_surface);
+        SDL_mutexV(mutex);
+        opacity_checked = true;
+    }
+    return is_opaque;
+}
+
+bool AnimationInfo::isOpaqueSurface(SDL_Surface *surface) {
+    SDL_PixelFormat *fmt = surface->format;
+    if (fmt->BytesPerPixel != 4 || fmt->Amask == 0) return false;
+
+    // transparent images usually fail on the first rows
+    SDL_LockSurface(surface);
+    bool opaque = true;
+    for (int i = 0; i < surface->h && opaque; i++) {
+        ONSBuf *buf =
+            (ONSBuf *)((unsigned char *)surface->pixels + surface->pitch * i);
+        for (int j = surface->w; j != 0; j--, buf++) {
+            if ((*buf & fmt->Amask) != fmt->Amask) {
+                opaque = false;
+                break;
+            }
+        }
+    }
+    SDL_UnlockSurface(surface);
+
+    return opaque;
+}
+
 unsigned char AnimationInfo::getAlpha(int x, int y) {
     if (image_surface == NULL) return 0;
 
@@ -94,6 +94,11 @@ class AnimationInfo {
     char *surface_name;       // used to avoid reloading images
     char *mask_surface_name;  // used to avoid reloading images
     SDL_Surface *image_surface;
+    // whether every pixel has full alpha, worked out by isOpaque() when first
+    // asked and forgotten whenever the pixels change
+    bool opacity_checked;
+    bool is_opaque;
+    unsigned int image_version;  // changes whenever the pixels may change
     unsigned char *alpha_buf;
     Uint32 texture_format;
     SDL_mutex *mutex;
@@ -116,6 +121,11 @@ class AnimationInfo {
     int max_param;  // used by bar
     int max_width;  // used by bar
 
+    // bumped whenever an image_surface is allocated or freed, so that the
+    // list of sprites holding an image is only rebuilt when it may change
+    static unsigned int surface_generation;
+    static unsigned int image_serial;
+
     AnimationInfo();
     AnimationInfo(const AnimationInfo &anim);
     ~AnimationInfo();
@@ -153,6 +163,15 @@ class AnimationInfo {
                         int dst_y,
                         SDL_Rect &clip,
                         int alpha = 255);
+    // blendOnSurface for n copies of the image, copy k at (xs[k], ys[k])
+    // showing cell cells[k]; overlapping copies are drawn in order
+    void blendBatchOnSurface(SDL_Surface *dst_surface,
+                             int n,
+                             const int *xs,
+                             const int *ys,
+                             const int *cells,
+                             SDL_Rect &clip,
+                             int alpha = 255);
     void blendOnSurface2(SDL_Surface *dst_surface,
                          int dst_x,
                          int dst_y,
@@ -178,6 +197,13 @@ class AnimationInfo {
                                  SDL_Surface *surface_m,
                                  bool has_alpha);
     void setImage(SDL_Surface *surface, Uint32 texture_format);
+    bool isOpaque();
+    static bool isOpaqueSurface(SDL_Surface *surface);
+    // to be called after writing to image_surface from outside
+    void imageChanged() {
+        opacity_checked = false;
+        image_version = ++image_serial;
+    }
     unsigned char getAlpha(int x, int y);
 
 #ifdef USE_SMPEG
@@ -26,6 +26,8 @@
 #define __BASE_READER_H__
 
 #include <stdio.h>
+
+#include <config.hpp>
 #ifdef _WIN32
 #define ons_fseek64 _fseeki64
 #define ons_ftell64 _ftelli64
@@ -103,6 +105,11 @@ struct BaseReader {
         unsigned int num_of_files;
         unsigned long base_offset;
         char flags;
+        // read-only mapping of the whole archive, created on first use
+        onscripter::SharedPtr<void> mapping;
+        const unsigned char *mapped_data;
+        size_t mapped_length;
+        bool map_failed;
 
         ArchiveInfo() {
             next = NULL;
@@ -112,6 +119,9 @@ struct BaseReader {
             fi_list = NULL;
             num_of_files = 0;
             flags = ArchiveFlag::ARCHIVE_FLAG_NONE;
+            mapped_data = NULL;
+            mapped_length = 0;
+            map_failed = false;
         }
         ~ArchiveInfo() {
             if (file_handle) fclose(file_handle);
@@ -120,6 +130,64 @@ struct BaseReader {
         }
     };
 
+    // Borrowed bytes of an archive entry. |data| stays valid as long as
+    // |handle| is held, even after the reader is closed.
+    struct FileView {
+        const unsigned char *data;
+        size_t length;
+        onscripter::SharedPtr<void> handle;
+
+        FileView() : data(NULL), length(0) {}
+    };
+
+    // An entry stored without compression, read in pieces through a file
+    // handle of its own. It does not touch the reader once opened, so it
+    // may be read from another thread and outlive the reader.
+    class FileStream {
+       public:
+        FileStream(FILE *fp,
+                   size_t offset,
+                   size_t length,
+                   const unsigned char *key_table = NULL)
+            : fp(fp), offset(offset), length(length), pos(0), file_pos(-1) {
+            key_table_flag = key_table != NULL;
+            if (key_table_flag)
+                for (int i = 0; i < 256; i++) this->key_table[i] = key_table[i];
+        }
+        ~FileStream() { fclose(fp); }
+
+        size_t getLength() const { return length; }
+        size_t tell() const { return pos; }
+        bool seek(size_t new_pos) {
+            if (new_pos > length) return false;
+            pos = new_pos;
+            return true;
+        }
+        size_t read(void *buf, size_t size) {
+            if (size > length - pos) size = length - pos;
+            if (size == 0) return 0;
+            // seeking drops the stdio buffer, so only do it when needed
+            if (file_pos != (long long)(offset + pos)) {
+                if (ons_fseek64(fp, offset + pos, SEEK_SET) != 0) return 0;
+            }
+            size_t ret = fread(buf, 1, size, fp);
+            pos += ret;
+            file_pos = ret == size ? (long long)(offset + pos) : -1;
+            if (key_table_flag) {
+                unsigned char *p = (unsigned char *)buf;
+                for (size_t i = 0; i < ret; i++) p[i] = key_table[p[i]];
+            }
+            return ret;
+        }
+
+       private:
+        FILE *fp;
+        size_t offset, length, pos;
+        long long file_pos;  // position of fp, -1 if unknown
+        bool key_table_flag;
+        unsigned char key_table[256];
+    };
+
     virtual ~BaseReader(){};
 
     virtual int open(const char *name = NULL) = 0;
@@ -130,10 +198,25 @@ struct BaseReader {
     virtual void registerCompressionType(const char *ext, int type) = 0;
 
     // virtual FileInfo getFileByIndex( unsigned int index ) = 0;
+    // getFileLength() and getFile() may be called from several threads at
+    // once, as long as open()/close() are not running at the same time.
     virtual size_t getFileLength(const char *file_name) = 0;
     virtual size_t getFile(const char *file_name,
                            unsigned char *buffer,
                            int *location = NULL) = 0;
+    // Zero-copy access for entries stored without compression or key table.
+    // Returns false when the caller has to fall back to getFile().
+    virtual bool getFileView(const char *file_name,
+                             FileView &view,
+                             int *location = NULL) {
+        return false;
+    }
+    // Streaming access for entries stored without compression, NULL when
+    // the caller has to fall back to getFile(). The caller deletes it.
+    virtual FileStream *openFileStream(const char *file_name,
+                                       int *location = NULL) {
+        return NULL;
+    }
 };
 
 #endif  // __BASE_READER_H__
@@ -24,21 +24,23 @@
 
 #include "DirtyRect.h"
 
+// merging two rectangles may redraw this many pixels that are not dirty
+#define MERGE_SLACK (64 * 64)
+
 DirtyRect::DirtyRect() {
     screen_width = screen_height = 0;
     bounding_box.w = bounding_box.h = 0;
+    num_rects = 0;
 }
 
-DirtyRect::DirtyRect(const DirtyRect &d) {
-    screen_width = d.screen_width;
-    screen_height = d.screen_height;
-    bounding_box = d.bounding_box;
-}
+DirtyRect::DirtyRect(const DirtyRect &d) { *this = d; }
 
 DirtyRect &DirtyRect::operator=(const DirtyRect &d) {
     screen_width = d.screen_width;
     screen_height = d.screen_height;
     bounding_box = d.bounding_box;
+    num_rects = d.num_rects;
+    for (int i = 0; i < num_rects; i++) rects[i] = d.rects[i];
 
     return *this;
 }
@@ -72,6 +74,68 @@ void DirtyRect::add(SDL_Rect src) {
     if (src.y + src.h >= screen_height) src.h = screen_height - src.y;
 
     bounding_box = calcBoundingBox(bounding_box, src);
+    addRect(src);
+}
+
+// pixels redrawn in vain if src1 and src2 are replaced by their bounding box
+int DirtyRect::mergeCost(const SDL_Rect &src1, SDL_Rect &src2) {
+    SDL_Rect box = calcBoundingBox(src1, src2);
+    SDL_Rect overlap;
+    int overlap_area =
+        SDL_IntersectRect(&src1, &src2, &overlap) ? area(overlap) : 0;
+    return area(box) - area(src1) - area(src2) + overlap_area;
+}
+
+void DirtyRect::merge(int no1, int no2) {
+    rects[no1] = calcBoundingBox(rects[no1], rects[no2]);
+    rects[no2] = rects[--num_rects];
+}
+
+void DirtyRect::addRect(SDL_Rect &src) {
+    rects[num_rects++] = src;
+
+    // merge what is cheap to merge; a merged rectangle may then be cheap
+    // to merge with another one
+    bool merged = true;
+    while (merged && num_rects > 1) {
+        merged = false;
+        int last = num_rects - 1;
+        for (int i = 0; i < last; i++) {
+            if (mergeCost(rects[i], rects[last]) <= MERGE_SLACK) {
+                merge(i, last);
+                // keep the merged rectangle last for the next round
+                SDL_Rect tmp = rects[i];
+                rects[i] = rects[num_rects - 1];
+                rects[num_rects - 1] = tmp;
+                merged = true;
+                break;
+            }
+        }
+    }
+
+    if (num_rects < MAX_DIRTY_RECTS) return;
+
+    // out of room, merge the cheapest pair
+    int min_cost = -1, min_i = 0, min_j = 1;
+    for (int i = 0; i < num_rects; i++)
+        for (int j = i + 1; j < num_rects; j++) {
+            int cost = mergeCost(rects[i], rects[j]);
+            if (min_cost < 0 || cost < min_cost) {
+                min_cost = cost;
+                min_i = i;
+                min_j = j;
+            }
+        }
+    merge(min_i, min_j);
+}
+
+bool DirtyRect::isFragmented() const {
+    if (num_rects < 2) return false;
+    int total = 0;
+    for (int i = 0; i < num_rects; i++) total += area(rects[i]);
+    // the rectangles may overlap a little, and each one costs a pass over
+    // the sprites in refreshSurface()
+    return total * 4 < area(bounding_box) * 3;
 }
 
 SDL_Rect DirtyRect::calcBoundingBox(SDL_Rect src1, SDL_Rect &src2) {
@@ -100,10 +164,15 @@ SDL_Rect DirtyRect::calcBoundingBox(SDL_Rect src1, SDL_Rect &src2) {
     return src1;
 }
 
-void DirtyRect::clear() { bounding_box.w = bounding_box.h = 0; }
+void DirtyRect::clear() {
+    bounding_box.w = bounding_box.h = 0;
+    num_rects = 0;
+}
 
 void DirtyRect::fill(int w, int h) {
     bounding_box.x = bounding_box.y = 0;
     bounding_box.w = w;
     bounding_box.h = h;
+    rects[0] = bounding_box;
+    num_rects = 1;
 }
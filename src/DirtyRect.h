@@ -26,6 +26,11 @@
 
 #include <SDL.h>
 
+#define MAX_DIRTY_RECTS 8
+
+// The invalid region is kept both as one bounding box and as up to
+// MAX_DIRTY_RECTS rectangles, so that changes far apart from each other
+// do not make the whole area between them redrawn.
 struct DirtyRect {
     DirtyRect();
     DirtyRect(const DirtyRect &d);
@@ -38,9 +43,19 @@ struct DirtyRect {
     void fill(int w, int h);
 
     SDL_Rect calcBoundingBox(SDL_Rect src1, SDL_Rect &src2);
+    // true if drawing the rectangles one by one beats the bounding box
+    bool isFragmented() const;
 
     int screen_width, screen_height;
     SDL_Rect bounding_box;
+    SDL_Rect rects[MAX_DIRTY_RECTS];
+    int num_rects;
+
+   private:
+    static int area(const SDL_Rect &rect) { return rect.w * rect.h; }
+    int mergeCost(const SDL_Rect &src1, SDL_Rect &src2);
+    void merge(int no1, int no2);
+    void addRect(SDL_Rect &src);
 };
 
 #endif  // __DIRTY_RECT__
@@ -0,0 +1,144 @@
+/* -*- C++ -*-
+ *
+ *  FramePacer.cpp - Frame pacing and frame times of effects
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "FramePacer.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "private/utils.h"
+
+// how far a new measure moves the compose and present estimates
+static const double ESTIMATE_WEIGHT = 0.125;
+
+FramePacer::FramePacer() {
+    setRate(60, false);
+    slot = carry = 0;
+    frame_start = wait_end = 0;
+    compose_estimate = present_estimate = 0;
+    last_present = -1;
+    memset(histogram, 0, sizeof(histogram));
+    frames = dropped = 0;
+}
+
+void FramePacer::setRate(double hz, bool present_paced) {
+    if (hz <= 0) hz = 60;
+    period = 1000.0 / hz;
+    this->present_paced = present_paced;
+}
+
+void FramePacer::start(double now) {
+    slot = now;
+    carry = 0;
+    frame_start = now;
+    last_present = -1;
+}
+
+int FramePacer::advance(double now) {
+    // a renderer waiting for the refresh is not work done for the frame
+    double ready = now + compose_estimate;
+    if (!present_paced) ready += present_estimate;
+
+    double next = slot + period;
+    if (ready > next) {
+        int late = (int)ceil((ready - next) / period);
+        next += late * period;
+        dropped += late;
+    }
+
+    double step = next - slot + carry;
+    int ms = (int)step;
+    carry = step - ms;
+    slot = next;
+    frame_start = now;
+
+    return ms;
+}
+
+double FramePacer::composed(double now) {
+    compose_estimate +=
+        (now - frame_start - compose_estimate) * ESTIMATE_WEIGHT;
+
+    wait_end = now;
+    if (!present_paced && slot - present_estimate > now)
+        wait_end = slot - present_estimate;
+
+    return wait_end;
+}
+
+void FramePacer::presented(double now) {
+    double present = now > wait_end ? now - wait_end : 0;
+    present_estimate += (present - present_estimate) * ESTIMATE_WEIGHT;
+    // the effect starts when its first frame is shown; a later frame shown
+    // after its slot moves the ones after it along, and the effect time it
+    // missed goes to the next one
+    if (now > slot && last_present >= 0) {
+        dropped += (int)((now - slot) / period + 0.01);
+        carry += now - slot;
+    }
+    if (now > slot) slot = now;
+
+    if (last_present >= 0) {
+        int bin = (int)(now - last_present);
+        if (bin < 0) bin = 0;
+        if (bin >= HISTOGRAM_BINS) bin = HISTOGRAM_BINS - 1;
+        histogram[bin]++;
+        frames++;
+    }
+    last_present = now;
+}
+
+bool FramePacer::writeHistogram(const char *path) const {
+    FILE *fp = ::fopen(path, "w");
+    if (fp == NULL) {
+        utils::printError("can't write the frame times to %s\n", path);
+        return false;
+    }
+
+    // the bins holding the median and the 99th percentile frame
+    int p50 = 0, p99 = 0;
+    Uint32 seen = 0;
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        if (seen < (frames + 1) / 2) p50 = i;
+        if (seen < frames - frames / 100) p99 = i;
+        seen += histogram[i];
+    }
+
+    fprintf(fp,
+            "# effect frames at %.2f Hz: %u frames, %u dropped, "
+            "median %d ms, 99%% %d ms\n",
+            getRate(),
+            frames,
+            dropped,
+            p50,
+            p99);
+    fprintf(fp, "# ms\tframes\n");
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        if (histogram[i] == 0) continue;
+        fprintf(fp,
+                "%d%s\t%u\n",
+                i,
+                i == HISTOGRAM_BINS - 1 ? "+" : "",
+                histogram[i]);
+    }
+    fclose(fp);
+
+    return true;
+}
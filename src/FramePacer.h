@@ -0,0 +1,73 @@
+/* -*- C++ -*-
+ *
+ *  FramePacer.h - Frame pacing and frame times of effects
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __FRAME_PACER_H__
+#define __FRAME_PACER_H__
+
+#include <SDL.h>
+
+// Hands the frames of an effect out on the refresh slots of the display.
+// Each frame is given the first slot it can still be composed and shown
+// in, so a frame that runs over its budget makes the effect skip the
+// slots in between rather than slow down. Times are in milliseconds of a
+// clock the caller reads, the virtual one in headless runs.
+//
+//   start()/advance()  a frame is about to be composed
+//   composed()         it is composed; wait until the time returned, then
+//                      show it
+//   presented()        it is on screen
+class FramePacer {
+   public:
+    enum {
+        HISTOGRAM_BINS = 100  // 1 ms each, the last one for 99 ms and up
+    };
+
+    FramePacer();
+
+    // hz is the rate frames are shown at; when present_paced is set the
+    // renderer waits for the refresh itself and composed() returns now
+    void setRate(double hz, bool present_paced);
+    double getRate() const { return 1000.0 / period; }
+
+    // the first frame of an effect
+    void start(double now);
+    // the next frame; returns the ms of effect time since the previous one
+    int advance(double now);
+    // returns the time to show the frame at, on the same clock; the wait
+    // is meant to be kept to a fraction of a ms, not to the ms of a timer
+    double composed(double now);
+    void presented(double now);
+
+    bool writeHistogram(const char *path) const;
+
+   private:
+    double period;
+    bool present_paced;
+
+    double slot;   // the slot the current frame is shown in
+    double carry;  // the effect time advance() has not handed out
+    double frame_start, wait_end;
+    double compose_estimate, present_estimate;
+    double last_present;  // < 0 before the first frame of an effect
+
+    Uint32 histogram[HISTOGRAM_BINS];
+    Uint32 frames, dropped;
+};
+
+#endif  // __FRAME_PACER_H__
@@ -0,0 +1,153 @@
+/* -*- C++ -*-
+ *
+ *  ImagePrefetcher.cpp - Background image loader fed by script lookahead
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ImagePrefetcher.h"
+
+ImagePrefetcher::ImagePrefetcher(const Loader &loader,
+                                 int num_workers,
+                                 size_t max_queue)
+    : loader(loader), max_queue(max_queue), exit_flag(false) {
+    for (int i = 0; i < num_workers; i++)
+        workers.emplace_back(&ImagePrefetcher::workerMain, this);
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit_flag = true;
+    }
+    queue_cond.notify_all();
+    for (auto &worker : workers) worker.join();
+
+    for (auto &it : jobs)
+        if (it.second.image.surface) SDL_FreeSurface(it.second.image.surface);
+}
+
+void ImagePrefetcher::makeKey(onscripter::String &key, const char *file_name) {
+    key = file_name;
+    for (auto &ch : key) {
+        if (ch >= 'A' && ch <= 'Z')
+            ch += 'a' - 'A';
+        else if (ch == '/')
+            ch = '\\';
+    }
+}
+
+bool ImagePrefetcher::request(const char *file_name) {
+    onscripter::String key;
+    makeKey(key, file_name);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (jobs.find(key) != jobs.end()) return true;
+    if (queue.size() >= max_queue) return false;
+
+    Job &job = jobs[key];
+    job.state = QUEUED;
+    job.file_name = file_name;
+    queue.push_back(key);
+    stats.requested++;
+    queue_cond.notify_one();
+    return true;
+}
+
+bool ImagePrefetcher::take(const char *file_name, Image &image) {
+    onscripter::String key;
+    makeKey(key, file_name);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = jobs.find(key);
+    if (it == jobs.end()) return false;
+    if (it->second.state == QUEUED) {
+        // the caller is about to load it anyway
+        queue.remove(key);
+        jobs.erase(it);
+        stats.cancelled++;
+        return false;
+    }
+    ready_cond.wait(lock, [&] {
+        it = jobs.find(key);
+        return it == jobs.end() || it->second.state == READY;
+    });
+    if (it == jobs.end()) return false;
+
+    image = it->second.image;
+    ready.remove(key);
+    jobs.erase(it);
+    if (!image.surface) return false;
+    stats.taken++;
+    return true;
+}
+
+void ImagePrefetcher::cancel() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &key : queue) jobs.erase(key);
+    stats.cancelled += queue.size();
+    queue.clear();
+}
+
+size_t ImagePrefetcher::pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size();
+}
+
+ImagePrefetcher::Stats ImagePrefetcher::getStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void ImagePrefetcher::dropReady() {
+    while (ready.size() > max_queue) {
+        auto it = jobs.find(ready.front());
+        SDL_Surface *surface = it->second.image.surface;
+        if (surface) SDL_FreeSurface(surface);
+        jobs.erase(it);
+        ready.pop_front();
+        stats.dropped++;
+    }
+}
+
+void ImagePrefetcher::workerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        queue_cond.wait(lock, [this] { return exit_flag || !queue.empty(); });
+        if (exit_flag) break;
+
+        onscripter::String key = queue.front();
+        queue.pop_front();
+        jobs[key].state = LOADING;
+        onscripter::String file_name = jobs[key].file_name;
+
+        lock.unlock();
+        Image image;
+        bool ret = loader(file_name.c_str(), image);
+        lock.lock();
+
+        Job &job = jobs[key];
+        job.state = READY;
+        job.image = image;
+        if (ret && image.surface) {
+            stats.loaded++;
+        } else {
+            stats.failed++;
+        }
+        ready.push_back(key);
+        dropReady();
+        ready_cond.notify_all();
+    }
+}
@@ -0,0 +1,94 @@
+/* -*- C++ -*-
+ *
+ *  ImagePrefetcher.h - Background image loader fed by script lookahead
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __IMAGE_PREFETCHER_H__
+#define __IMAGE_PREFETCHER_H__
+
+#include <SDL.h>
+
+#include <condition_variable>
+#include <config.hpp>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Loads images on worker threads ahead of the script. Requests wait in a
+// bounded queue; decoded surfaces wait until the script thread take()s them
+// and the oldest ones are dropped when too many are left unclaimed.
+class ImagePrefetcher {
+   public:
+    struct Image {
+        SDL_Surface *surface;
+        bool has_alpha;
+        int location;
+        Image() : surface(NULL), has_alpha(false), location(0) {}
+    };
+    // runs on a worker thread, must not touch script state
+    typedef std::function<bool(const char *file_name, Image &image)> Loader;
+
+    struct Stats {
+        size_t requested = 0;
+        size_t loaded = 0;
+        size_t failed = 0;
+        size_t taken = 0;
+        size_t cancelled = 0;
+        size_t dropped = 0;
+    };
+
+    ImagePrefetcher(const Loader &loader, int num_workers, size_t max_queue);
+    ~ImagePrefetcher();
+
+    // false if the queue is full; names already queued or loaded are ignored
+    bool request(const char *file_name);
+    // hand over a prefetched image, waiting if a worker is loading it;
+    // a request that has not started yet is withdrawn and false returned
+    bool take(const char *file_name, Image &image);
+    // drop every request that has not started, e.g. after a jump
+    void cancel();
+
+    size_t capacity() const { return max_queue; }
+    size_t pending();
+    Stats getStats();
+
+   private:
+    enum State { QUEUED, LOADING, READY };
+    struct Job {
+        State state;
+        onscripter::String file_name;  // as requested, keys are normalized
+        Image image;
+    };
+
+    static void makeKey(onscripter::String &key, const char *file_name);
+    void workerMain();
+    void dropReady();
+
+    Loader loader;
+    size_t max_queue;
+    onscripter::Vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queue_cond, ready_cond;
+    bool exit_flag;
+
+    onscripter::UnorderedMap<onscripter::String, Job> jobs;
+    onscripter::List<onscripter::String> queue;  // QUEUED, in request order
+    onscripter::List<onscripter::String> ready;  // READY, oldest first
+    Stats stats;
+};
+
+#endif  // __IMAGE_PREFETCHER_H__
@@ -421,7 +421,8 @@ int NSLuaAnimationMode(lua_State *state) {
     int val = lua_toboolean(state, 1);
 
     lh->is_animatable = (val == 1);
-    if (lh->is_animatable) lh->next_time = SDL_GetTicks() + lh->duration_time;
+    if (lh->is_animatable)
+        lh->next_time = lh->ons->getTicks() + lh->duration_time;
 
     return 0;
 }
@@ -904,7 +905,7 @@ int NSSpVisible(lua_State *state) {
 
 int NSTimer(lua_State *state) {
     lua_getglobal(state, ONS_LUA_HANDLER_PTR);
-    lua_pushinteger(state, SDL_GetTicks());
+    lua_pushinteger(state, lh->ons->getTicks());
 
     return 1;
 }
@@ -19,72 +19,153 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#ifdef USE_OMP_PARALLEL
-#elif defined(USE_PARALLEL)
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
 #include "Parallel.h"
-using namespace parallel;
 
-ThreadPool parallel::threadPool;
+#include <atomic>
 
 namespace parallel {
-void ThreadPool::createThread() {
-    assert(threadCreated < thread_num);
-    Thread *thread = &threads[threadCreated];
-    thread->threadData.sem = SDL_CreateSemaphore(0);
-    thread->thread = SDL_CreateThread(
-        [](void *ptr) {
-            auto *td = (Thread::ThreadData *)ptr;
-            for (;;) {
-                td->body(td->data);
-                int status = Thread::Status::IDLE;
-                SDL_AtomicSet(&td->status, status);
-                while (status != Thread::Status::RUNNING) {
-                    if (status == Thread::Status::EXIT) goto exit_thread;
-                    SDL_SemWait(td->sem);
-                    status = SDL_AtomicGet(&td->status);
-                }
-            }
-        exit_thread:
-            SDL_DestroySemaphore(td->sem);
-            return 0;
-        },
-        "Parallel",
-        &thread->threadData);
-    SDL_DetachThread(thread->thread);
-    ++threadCreated;
+static std::atomic<int> thread_limit(0);
+
+void setThreadLimit(int limit) { thread_limit = limit > 0 ? limit : 0; }
+
+int getThreadLimit() {
+    const int limit = thread_limit;
+    return limit > 0 && limit < thread_num ? limit : thread_num;
+}
+}  // namespace parallel
+#endif
+
+#ifdef USE_PARALLEL
+namespace parallel {
+// index of the worker owned by this thread, -1 for other threads
+static thread_local int worker_index = -1;
+
+Scheduler &Scheduler::instance() {
+    static Scheduler scheduler;
+    return scheduler;
+}
+
+Scheduler::Scheduler()
+    : workers(thread_num), num_tasks(0), num_sleeping(0), exit_flag(false) {
+    // the thread calling For() runs tasks too
+    for (int i = 0; i < thread_num - 1; ++i)
+        threads.emplace_back(&Scheduler::workerMain, this, i);
+}
+
+Scheduler::~Scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        exit_flag = true;
+    }
+    sleep_cond.notify_all();
+    for (auto &thread : threads) thread.join();
+}
+
+void Scheduler::submit(const Task &task) {
+    task.group->pending++;
+    Worker &worker =
+        workers[worker_index >= 0 ? worker_index : workers.size() - 1];
+    num_tasks++;
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(task);
+    }
+    if (num_sleeping > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        sleep_cond.notify_one();
+    }
+}
+
+bool Scheduler::pop(Task &task) {
+    if (worker_index < 0) return false;
+    Worker &worker = workers[worker_index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) return false;
+    task = worker.tasks.back();
+    worker.tasks.pop_back();
+    num_tasks--;
+    return true;
 }
 
-ThreadPool::~ThreadPool() {
-    sync();
-    for (int i = 0; i < threadCreated; ++i) {
-        SDL_AtomicSet(&threads[i].threadData.status, Thread::Status::EXIT);
-        SDL_SemPost(threads[i].threadData.sem);
+bool Scheduler::steal(Task &task) {
+    if (num_tasks == 0) return false;
+    const int n = workers.size();
+    const int start = worker_index >= 0 ? worker_index + 1 : 0;
+    for (int i = 0; i < n; ++i) {
+        Worker &victim = workers[(start + i) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+        task = victim.tasks.front();
+        victim.tasks.pop_front();
+        num_tasks--;
+        return true;
     }
+    return false;
 }
 
-ThreadPool::Thread *ThreadPool::newThread(void (*func)(void *body),
-                                          void *threadData) {
-    assert(threadNum < thread_num);
-    Thread *thread = &threads[threadNum];
-    Thread::ThreadData &td = thread->threadData;
-    td.body = func;
-    td.data = threadData;
-    SDL_AtomicSet(&td.status, Thread::Status::RUNNING);
-    if (threadNum + 1 > threadCreated)
-        createThread();
-    else
-        SDL_SemPost(td.sem);
-    ++threadNum;
-    return thread;
+void Scheduler::execute(Task task) {
+    // split in halves, leaving the far half for thieves
+    while (task.last - task.first > task.grain) {
+        Task rest = task;
+        rest.first = task.first + (task.last - task.first) / 2;
+        task.last = rest.first;
+        submit(rest);
+    }
+    task.body(task.data, task.first, task.last);
+    if (--task.group->pending == 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        done_cond.notify_all();
+    }
 }
 
-void ThreadPool::sync() {
-    for (int i = threadNum - 1; i >= 0; --i) {
-        while (SDL_AtomicGet(&threads[i].threadData.status) !=
-               Thread::Status::IDLE)
-            SDL_Delay(0);
-        --threadNum;
+void Scheduler::wait(TaskGroup &group) {
+    Task task;
+    while (group.pending > 0) {
+        if (pop(task) || steal(task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        done_cond.wait(lock,
+                       [&] { return group.pending == 0 || num_tasks > 0; });
     }
 }
+
+void Scheduler::workerMain(int index) {
+    worker_index = index;
+    Task task;
+    for (;;) {
+        if (pop(task) || steal(task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        num_sleeping++;
+        sleep_cond.wait(lock, [this] { return exit_flag || num_tasks > 0; });
+        num_sleeping--;
+        if (exit_flag) break;
+    }
+}
+
+void TaskGroup::run(
+    RangeBody body, void *data, int first, int last, int grain) {
+    if (last <= first) return;
+    Scheduler::instance().submit({body, data, first, last, grain, this});
+}
+
+void TaskGroup::run(const std::function<void()> &func) {
+    auto *copy = new std::function<void()>(func);
+    run(
+        [](void *data, int, int) {
+            auto *func = (std::function<void()> *)data;
+            (*func)();
+            delete func;
+        },
+        copy,
+        0,
+        1,
+        1);
+}
 }  // namespace parallel
 #endif
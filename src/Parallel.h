@@ -25,10 +25,15 @@
 #endif
 
 #ifdef USE_PARALLEL
-#include "SDL_atomic.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "SDL_cpuinfo.h"
-#include "SDL_thread.h"
-#include "SDL_timer.h"
 #endif
 
 #ifdef USE_OMP_PARALLEL
@@ -46,76 +51,144 @@ static const int thread_num = omp_get_num_procs();
 #elif defined(USE_PARALLEL)
 static const int thread_num = (utils::min)(SDL_GetCPUCount(), 64);
 
-class ThreadPool {
-    struct Thread {
-        enum Status { IDLE, RUNNING, EXIT };
-        SDL_Thread *thread;
-        struct ThreadData {
-            void (*body)(void *data);
-            void *data;
-            SDL_atomic_t status;
-            SDL_sem *sem;
-        } threadData;
-    };
-    Thread *threads = new Thread[thread_num];
-    int threadNum = 0, threadCreated = 0;
-    void createThread();
+// runs [first, last) of a range task
+typedef void (*RangeBody)(void *data, int first, int last);
+
+class TaskGroup;
 
+// Work-stealing scheduler. Each worker owns a deque: it pushes and pops
+// at the back, idle workers steal from the front where the biggest
+// pieces of a split range are. Threads waiting for a group execute
+// queued tasks instead of spinning and sleep on a condition variable
+// when there is nothing left to run.
+class Scheduler {
    public:
-    ~ThreadPool();
-    Thread *newThread(void (*func)(void *body), void *threadData);
-    void sync();
+    struct Task {
+        RangeBody body;
+        void *data;
+        int first, last, grain;
+        TaskGroup *group;
+    };
+
+    static Scheduler &instance();
+    ~Scheduler();
+
+    void submit(const Task &task);
+    void wait(TaskGroup &group);
+
+   private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    Scheduler();
+    bool pop(Task &task);
+    bool steal(Task &task);
+    void execute(Task task);
+    void workerMain(int index);
+
+    // workers[thread_num - 1] takes tasks submitted by other threads
+    std::vector<Worker> workers;
+    std::vector<std::thread> threads;
+    std::atomic<int> num_tasks, num_sleeping;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cond, done_cond;
+    bool exit_flag;
 };
 
-extern ThreadPool threadPool;
+// A set of tasks that can be waited for. Tasks may run more tasks on the
+// same or another group, e.g. a nested For.
+class TaskGroup {
+   public:
+    TaskGroup() : pending(0) {}
+    ~TaskGroup() { wait(); }
+
+    // run body over [first, last) split into pieces of at least grain
+    void run(RangeBody body, void *data, int first, int last, int grain);
+    // run a single function asynchronously
+    void run(const std::function<void()> &func);
+    void wait() { Scheduler::instance().wait(*this); }
+
+   private:
+    friend class Scheduler;
+    std::atomic<int> pending;
+};
 #endif
+// caps the number of threads For runs on, e.g. to measure how a kernel
+// scales; 0, the default, uses all of them
+void setThreadLimit(int limit);
+// the number of threads For may use, at most thread_num
+int getThreadLimit();
+
 static int thread_clamp(int threadnum) {
-    if (threadnum > thread_num) threadnum = thread_num;
+    const int limit = getThreadLimit();
+    if (threadnum > limit) threadnum = limit;
     if (threadnum < 1) threadnum = 1;
     return threadnum;
 }
 
+// scale is the total amount of work (usually pixels), used to keep small
+// jobs on the calling thread; grain is the least number of iterations a
+// task runs, 0 picks one from scale
 template <typename Body>
 void For(const int first,
          const int last,
          const int step,
          const Body &body,
-         const int scale = -1) {
+         const int scale = -1,
+         int grain = 0) {
     assert(step > 0);
     if (last > first) {
         static const int MINSCALE = 65536;
 #ifdef USE_OMP_PARALLEL
         scale > 0 ? omp_set_num_threads(thread_clamp(scale / MINSCALE))
-                  : omp_set_num_threads(thread_num);
+                  : omp_set_num_threads(thread_clamp(thread_num));
 #pragma omp parallel for
         for (int i = first; i < last; i += step) body(i);
 #elif defined USE_PARALLEL
-        int range = last - first;
-        struct ThreadData {
-            int lr[2];
+        const int count = (last - first + step - 1) / step;
+        const int threads = thread_clamp(thread_num);
+        if (threads == 1 || count == 1 ||
+            (scale > 0 && thread_clamp(scale / MINSCALE) == 1)) {
+            for (int i = first; i < last; i += step) body(i);
+            return;
+        }
+        if (grain <= 0) {
+            // a few tasks per thread for balance, none smaller than
+            // MINSCALE / 4 units of work
+            grain = count / (threads * 4);
+            if (scale > 0) {
+                long long min_grain =
+                    (long long)count * (MINSCALE / 4) / scale + 1;
+                if (grain < min_grain) grain = (int)min_grain;
+            }
+            if (grain < 1) grain = 1;
+        }
+
+        struct Range {
+            int first, step;
             const Body *body;
+        } range = {first, step, &body};
+        RangeBody run_range = [](void *data, int first, int last) {
+            const Range &range = *(const Range *)data;
+            for (int i = first; i < last; ++i)
+                (*range.body)(range.first + i * range.step);
         };
-        int nthread = scale > 0 ? thread_clamp(scale / MINSCALE) : thread_num;
-        if (range < nthread) nthread = range;
-        typedef void (*FunctionBody)(void *);
-        ThreadData td[63];
-        int ssize = range / nthread;
-        int lend = last;
-        int i = nthread;
-        while (i > 1) {
-            int lstart = lend - ssize;
-            td[i - 2] = {{lstart, lend}, &body};
-            threadPool.newThread(
-                [](void *ptr) {
-                    ThreadData td = *(ThreadData *)ptr;
-                    for (int i = td.lr[0]; i < td.lr[1]; ++i) (*td.body)(i);
-                },
-                (void *)&td[i - 2]);
-            lend = lstart;
-            --i;
+        TaskGroup group;
+        if (threads < thread_num) {
+            // one piece per thread that is never split, so no more than
+            // threads of them run at once
+            for (int t = 0; t < threads; ++t)
+                group.run(run_range,
+                          &range,
+                          (long long)count * t / threads,
+                          (long long)count * (t + 1) / threads,
+                          count);
+        } else {
+            group.run(run_range, &range, 0, count, grain);
         }
-        for (int i = first; i < lend; ++i) body(i);
-        threadPool.sync();
+        group.wait();
 #endif
     }
 }
@@ -0,0 +1,162 @@
+/* -*- C++ -*-
+ *
+ *  Replay.cpp - Input traces and timings of headless runs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "Replay.h"
+
+#include <algorithm>
+
+#include "private/utils.h"
+
+bool ReplayTrace::open(const char *path) {
+    FILE *fp = ::fopen(path, "r");
+    if (fp == NULL) {
+        utils::printError("can't open replay trace %s\n", path);
+        return false;
+    }
+
+    char line[256], arg[256];
+    int line_no = 0, x = 0, y = 0, px, py;
+    Uint32 delay = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char *p = strchr(line, '#');
+        if (p) *p = '\0';
+        p = line + strlen(line);
+        while (p > line && isspace((unsigned char)p[-1])) *--p = '\0';
+        p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '\0') continue;
+
+        unsigned int ms;
+        SDL_Event event;
+        SDL_zero(event);
+        int n = sscanf(p, "%255s %d %d", arg, &px, &py);
+        if (sscanf(p, "wait %u", &ms) == 1) {
+            delay += ms;
+        } else if ((!strcmp(arg, "click") || !strcmp(arg, "rclick")) &&
+                   n != 2) {
+            if (n == 3) {
+                x = px;
+                y = py;
+            }
+            pushClick(delay,
+                      strcmp(arg, "click") ? SDL_BUTTON_RIGHT : SDL_BUTTON_LEFT,
+                      x,
+                      y);
+        } else if (sscanf(p, "wheel %255s", arg) == 1 &&
+                   (!strcmp(arg, "up") || !strcmp(arg, "down"))) {
+            event.type = SDL_MOUSEWHEEL;
+            event.wheel.y = strcmp(arg, "up") ? -1 : 1;
+            push(delay, event);
+        } else if (!strncmp(p, "key ", 4) &&
+                   SDL_GetKeyFromName(p + 4) != SDLK_UNKNOWN) {
+            event.key.keysym.sym = SDL_GetKeyFromName(p + 4);
+            event.key.keysym.scancode =
+                SDL_GetScancodeFromKey(event.key.keysym.sym);
+            event.type = SDL_KEYDOWN;
+            event.key.state = SDL_PRESSED;
+            push(delay, event);
+            event.type = SDL_KEYUP;
+            event.key.state = SDL_RELEASED;
+            push(delay, event);
+        } else if (!strcmp(p, "quit")) {
+            event.type = SDL_QUIT;
+            push(delay, event);
+        } else {
+            utils::printError(
+                "replay trace %s:%d: unknown input [%s]\n", path, line_no, p);
+            ok = false;
+        }
+    }
+    fclose(fp);
+
+    return ok;
+}
+
+void ReplayTrace::push(Uint32 &delay, const SDL_Event &event) {
+    events.push_back({delay, event});
+    delay = 0;
+}
+
+// a click without a position lands where the previous one did
+void ReplayTrace::pushClick(Uint32 &delay, Uint8 button, int x, int y) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = SDL_MOUSEMOTION;
+    event.motion.x = x;
+    event.motion.y = y;
+    push(delay, event);
+
+    SDL_zero(event);
+    event.button.button = button;
+    event.button.clicks = 1;
+    event.button.x = x;
+    event.button.y = y;
+    event.type = SDL_MOUSEBUTTONDOWN;
+    event.button.state = SDL_PRESSED;
+    push(delay, event);
+    event.type = SDL_MOUSEBUTTONUP;
+    event.button.state = SDL_RELEASED;
+    push(delay, event);
+}
+
+void ReplayProfile::addCommand(const char *command, float ms) {
+    commands[command].add(ms);
+}
+
+void ReplayProfile::addFrame(float compose_ms, float upload_ms) {
+    compose.add(compose_ms);
+    upload.add(upload_ms);
+}
+
+void ReplayProfile::print(Uint32 virtual_ms) const {
+    utils::printInfo("replay: %.3fs wall, %.3fs virtual\n",
+                     utils::duration(start) / 1000,
+                     virtual_ms / 1000.0);
+
+    onscripter::Vector<std::pair<const char *, Stat>> sorted(commands.begin(),
+                                                             commands.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second.total > b.second.total;
+    });
+    utils::printInfo("%-16s %10s %12s %10s %10s\n",
+                     "command",
+                     "calls",
+                     "total ms",
+                     "avg ms",
+                     "max ms");
+    for (const auto &it : sorted)
+        utils::printInfo("%-16s %10zu %12.3f %10.3f %10.3f\n",
+                         it.first,
+                         it.second.count,
+                         it.second.total,
+                         it.second.total / it.second.count,
+                         it.second.max);
+
+    if (compose.count == 0) return;
+    utils::printInfo(
+        "%zu frames: compose %.3f ms avg %.3f ms max, "
+        "upload %.3f ms avg %.3f ms max\n",
+        compose.count,
+        compose.total / compose.count,
+        compose.max,
+        upload.total / upload.count,
+        upload.max);
+}
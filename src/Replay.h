@@ -0,0 +1,88 @@
+/* -*- C++ -*-
+ *
+ *  Replay.h - Input traces and timings of headless runs
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <SDL.h>
+
+#include <chrono>
+#include <config.hpp>
+
+// Input fed to a headless run, one line per input:
+//
+//   wait <ms>       let <ms> of virtual time pass before the next input
+//   click [x y]     left click, at screen pixel (x, y) when given
+//   rclick [x y]    right click
+//   wheel up|down
+//   key <name>      press and release a key named as SDL_GetKeyFromName does
+//   quit
+//
+// '#' starts a comment. Each input is handed out only when the engine has
+// nothing left to do, so a run replays the same way on every machine.
+class ReplayTrace {
+   public:
+    bool open(const char *path);
+
+    bool empty() const { return next == events.size(); }
+    // virtual time between the previous input and the next one
+    Uint32 nextDelay() const { return events[next].delay; }
+    SDL_Event pop() { return events[next++].event; }
+
+   private:
+    struct Input {
+        Uint32 delay;
+        SDL_Event event;
+    };
+
+    void push(Uint32 &delay, const SDL_Event &event);
+    void pushClick(Uint32 &delay, Uint8 button, int x, int y);
+
+    onscripter::Vector<Input> events;
+    size_t next = 0;
+};
+
+// Wall time spent per command and per frame of a headless run.
+class ReplayProfile {
+   public:
+    ReplayProfile() : start(std::chrono::steady_clock::now()) {}
+
+    // command names are the static strings of the command table
+    void addCommand(const char *command, float ms);
+    void addFrame(float compose_ms, float upload_ms);
+    void print(Uint32 virtual_ms) const;
+
+   private:
+    struct Stat {
+        size_t count = 0;
+        double total = 0;
+        float max = 0;
+        void add(float ms) {
+            count++;
+            total += ms;
+            if (ms > max) max = ms;
+        }
+    };
+
+    onscripter::UnorderedMap<const char *, Stat> commands;
+    Stat compose, upload;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif  // __REPLAY_H__
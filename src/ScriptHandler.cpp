@@ -24,6 +24,7 @@
 
 #include "ScriptHandler.h"
 
+#include <algorithm>
 #include <vector>
 
 #include "coding2utf16.h"
@@ -40,6 +41,10 @@ ScriptHandler::ScriptHandler() {
     save_dir = NULL;
     num_of_labels = 0;
     script_buffer = NULL;
+    num_alias_generation = 0;
+    script_encrypt_mode = 0;
+    script_snapshot_flag = script_snapshot_pending = false;
+    int_expression_cache_flag = true;
     kidoku_buffer = NULL;
     log_info[LABEL_LOG].filename = "NScrllog.dat";
     log_info[FILE_LOG].filename = "NScrflog.dat";
@@ -50,9 +55,6 @@ ScriptHandler::ScriptHandler() {
     saved_string_buffer = new char[STRING_BUFFER_LENGTH]{0};
 
     variable_data = NULL;
-    extended_variable_data = NULL;
-    num_extended_variable_data = 0;
-    max_extended_variable_data = 1;
     root_array_variable = NULL;
 
     screen_width = 640;
@@ -85,10 +87,8 @@ void ScriptHandler::reset() {
     current_variable_data.reset(true);
     for (int i = 0; i < variable_range; i++) variable_data[i].reset(true);
 
-    if (extended_variable_data) delete[] extended_variable_data;
-    extended_variable_data = NULL;
-    num_extended_variable_data = 0;
-    max_extended_variable_data = 1;
+    for (auto &it : extended_variable_data) it.second.reset(true);
+    extended_variable_data.clear();
 
     ArrayVariable *av = root_array_variable;
     while (av) {
@@ -112,6 +112,7 @@ void ScriptHandler::reset() {
     };
     last_num_alias = &root_num_alias;
     last_num_alias->next = NULL;
+    num_alias_generation++;
 
     // reset string alias
     alias = root_str_alias.next;
@@ -150,6 +151,9 @@ void ScriptHandler::setSaveDir(const char *path) {
     if (save_dir) delete[] save_dir;
     save_dir = new char[strlen(path) + 1]{0};
     strcpy(save_dir, path);
+
+    // the game directory may be read-only, so the snapshot waits for this
+    if (script_snapshot_pending) saveScriptSnapshot();
 }
 
 FILE *ScriptHandler::fopen(const char *path,
@@ -590,50 +594,136 @@ int ScriptHandler::getOffset(char *pos) { return pos - script_buffer; }
 
 char *ScriptHandler::getAddress(int offset) { return script_buffer + offset; }
 
+// number of newlines in script_buffer before address
+int ScriptHandler::getLineIndex(char *address) {
+    int offset = address - script_buffer;
+    return std::upper_bound(line_offsets.begin(), line_offsets.end(), offset) -
+           line_offsets.begin() - 1;
+}
+
 int ScriptHandler::getLineByAddress(char *address) {
     LabelInfo label = getLabelByAddress(address);
 
-    char *addr = label.label_header;
-    int line = 0;
-    while (address > addr) {
-        if (*addr == '\n') line++;
-        addr++;
-    }
-    return line;
+    if (address <= label.label_header) return 0;
+    return getLineIndex(address) - getLineIndex(label.label_header);
 }
 
 char *ScriptHandler::getAddressByLine(int line) {
     LabelInfo label = getLabelByLine(line);
 
     int l = line - label.start_line;
-    char *addr = label.label_header;
-    while (l > 0) {
-        while (*addr != '\n' && *addr != '\0') addr++;
-        if (*addr == '\0') {
-            addr = label.label_header;
-            utils::printError("save file is error goto start\n");
-            break;
-        }
-        addr++;
-        l--;
+    if (l <= 0) return label.label_header;
+    l += getLineIndex(label.label_header);
+    if (l >= (int)line_offsets.size()) {
+        utils::printError("save file is error goto start\n");
+        return label.label_header;
     }
-    return addr;
+    return script_buffer + line_offsets[l];
 }
 
 ScriptHandler::LabelInfo ScriptHandler::getLabelByAddress(char *address) {
-    int i;
-    for (i = 0; i < num_of_labels - 1; i++) {
-        if (label_info[i + 1].start_address > address) return label_info[i];
-    }
-    return label_info[i];
+    if (num_of_labels <= 1) return label_info[0];
+    LabelInfo *it = std::upper_bound(
+        label_info + 1,
+        label_info + num_of_labels,
+        address,
+        [](char *addr, const LabelInfo &label) {
+            return label.start_address > addr;
+        });
+    return *(it - 1);
 }
 
 ScriptHandler::LabelInfo ScriptHandler::getLabelByLine(int line) {
-    int i;
-    for (i = 0; i < num_of_labels - 1; i++) {
-        if (label_info[i + 1].start_line > line) return label_info[i];
+    if (num_of_labels <= 1) return label_info[0];
+    LabelInfo *it = std::upper_bound(
+        label_info + 1,
+        label_info + num_of_labels,
+        line,
+        [](int l, const LabelInfo &label) { return label.start_line > l; });
+    return *(it - 1);
+}
+
+static void addImageName(const char *buf,
+                         const char *end,
+                         onscripter::Vector<onscripter::String> &names) {
+    if (buf < end && buf[0] == ':') {
+        // skip the tag the same way as parseTaggedString()
+        const char *tag = buf + 1;
+        while (tag < end && *tag == ' ') tag++;
+        if (tag == end || *tag == 's') return;
+        const char *p = tag;
+        while (p < end && *p != ';') p++;
+        if (p == end) return;
+        if (tag[0] == 'm' && (tag + 1 == end || !strchr("tblr", tag[1])) &&
+            p > tag + 1)
+            names.emplace_back(tag + 1, p - tag - 1);
+        buf = p + 1;
+    } else if (buf < end && buf[0] == '/') {
+        while (buf < end && *buf != ';') buf++;
+        if (buf++ == end) return;
+    }
+    if (buf == end || buf[0] == '>' || buf[0] == '*' || buf[0] == '#' ||
+        buf[0] == '$')
+        return;
+    names.emplace_back(buf, end - buf);
+}
+
+int ScriptHandler::scanImageNames(
+    char *&pos,
+    int max_lines,
+    size_t max_names,
+    onscripter::Vector<onscripter::String> &names) {
+    static const char *commands[] = {"bg", "ld", "lsp", "lsph"};
+    char *end = script_buffer + script_buffer_length;
+    if (pos < script_buffer || pos >= end) return 0;
+
+    int lines = 0;
+    while (pos < end && lines < max_lines && names.size() < max_names) {
+        char *line_end = (char *)memchr(pos, '\n', end - pos);
+        if (!line_end) line_end = end;
+
+        char *buf = pos;
+        while (buf < line_end) {
+            while (buf < line_end &&
+                   (*buf == ' ' || *buf == '\t' || *buf == ':'))
+                buf++;
+            // labels, comments and text lines hold no image commands
+            char *cmd = buf;
+            while (buf < line_end && (isalnum((unsigned char)*buf) ||
+                                      *buf == '_'))
+                buf++;
+            size_t len = buf - cmd;
+            if (len == 0) break;
+
+            bool image_cmd = false;
+            for (const char *name : commands) {
+                size_t i = 0;
+                while (i < len && name[i] == tolower((unsigned char)cmd[i]))
+                    i++;
+                if (i == len && name[i] == '\0') image_cmd = true;
+            }
+
+            // the first string literal of the statement is the image name
+            bool first_literal = true;
+            while (buf < line_end && *buf != ':' && *buf != ';') {
+                if (*buf == '"') {
+                    char *str = ++buf;
+                    while (buf < line_end && *buf != '"') buf++;
+                    if (image_cmd && first_literal)
+                        addImageName(str, buf, names);
+                    first_literal = false;
+                } else if (IS_TWO_BYTE(*buf) && buf + 1 < line_end) {
+                    buf++;
+                }
+                buf++;
+            }
+            if (buf < line_end && *buf == ';') break;
+        }
+
+        pos = line_end < end ? line_end + 1 : end;
+        lines++;
     }
-    return label_info[i];
+    return lines;
 }
 
 bool ScriptHandler::isName(const char *name) {
@@ -947,7 +1037,10 @@ int ScriptHandler::openScript(char *path) {
     if (readScript(path) < 0) return -1;
     readConfiguration();
     variable_data = new VariableData[variable_range];
-    return labelScript();
+    if (labelScript()) return -1;
+    script_snapshot_pending = !script_snapshot_flag;
+    if (save_dir) saveScriptSnapshot();
+    return 0;
 }
 
 struct ScriptHandler::LabelInfo ScriptHandler::lookupLabel(const char *label) {
@@ -968,46 +1061,31 @@ struct ScriptHandler::LabelInfo ScriptHandler::lookupLabelNext(
     return label_info[num_of_labels];
 }
 
-ScriptHandler::LogLink *ScriptHandler::findAndAddLog(LogInfo &info,
-                                                     const char *name,
-                                                     bool add_flag) {
-    char capital_name[256];
-    for (unsigned int i = 0; i < strlen(name) + 1; i++) {
-        capital_name[i] = name[i];
-        if ('a' <= capital_name[i] && capital_name[i] <= 'z')
-            capital_name[i] += 'A' - 'a';
-        else if (capital_name[i] == '/')
-            capital_name[i] = '\\';
+const char *ScriptHandler::findAndAddLog(LogInfo &info,
+                                         const char *name,
+                                         bool add_flag) {
+    log_key.assign(name);
+    for (char &ch : log_key) {
+        if ('a' <= ch && ch <= 'z')
+            ch += 'A' - 'a';
+        else if (ch == '/')
+            ch = '\\';
     }
 
-    LogLink *cur = info.root_log.next;
-    while (cur) {
-        if (!strcmp(cur->name, capital_name)) break;
-        cur = cur->next;
+    auto it = info.names.find(log_key);
+    if (it == info.names.end()) {
+        if (!add_flag) return NULL;
+        // set nodes never move, so order can point into them
+        it = info.names.insert(log_key).first;
+        info.order.push_back(it->c_str());
     }
-    if (!add_flag || cur) return cur;
-
-    LogLink *link = new LogLink();
-    link->name = new char[strlen(capital_name) + 1]{0};
-    strcpy(link->name, capital_name);
-    info.current_log->next = link;
-    info.current_log = info.current_log->next;
-    info.num_logs++;
 
-    return link;
+    return it->c_str();
 }
 
 void ScriptHandler::resetLog(LogInfo &info) {
-    LogLink *link = info.root_log.next;
-    while (link) {
-        LogLink *tmp = link;
-        link = link->next;
-        delete tmp;
-    }
-
-    info.root_log.next = NULL;
-    info.current_log = &info.root_log;
-    info.num_logs = 0;
+    info.order.clear();
+    info.names.clear();
 }
 
 ScriptHandler::ArrayVariable *ScriptHandler::getRootArrayVariable() {
@@ -1018,6 +1096,7 @@ void ScriptHandler::addNumAlias(const char *str, int no) {
     Alias *p_num_alias = new Alias(str, no);
     last_num_alias->next = p_num_alias;
     last_num_alias = last_num_alias->next;
+    num_alias_generation++;
 }
 
 void ScriptHandler::addStrAlias(const char *str1, const char *str2) {
@@ -1041,27 +1120,8 @@ void ScriptHandler::addStringBuffer(char ch) {
 ScriptHandler::VariableData &ScriptHandler::getVariableData(int no) {
     if (no >= 0 && no < variable_range) return variable_data[no];
 
-    for (int i = 0; i < num_extended_variable_data; i++)
-        if (extended_variable_data[i].no == no)
-            return extended_variable_data[i].vd;
-
-    num_extended_variable_data++;
-    if (num_extended_variable_data == max_extended_variable_data) {
-        ExtendedVariableData *tmp = extended_variable_data;
-        extended_variable_data =
-            new ExtendedVariableData[max_extended_variable_data * 2];
-        if (tmp) {
-            memcpy(extended_variable_data,
-                   tmp,
-                   sizeof(ExtendedVariableData) * max_extended_variable_data);
-            delete[] tmp;
-        }
-        max_extended_variable_data *= 2;
-    }
-
-    extended_variable_data[num_extended_variable_data - 1].no = no;
-
-    return extended_variable_data[num_extended_variable_data - 1].vd;
+    // map nodes never move, so references stay valid as it grows
+    return extended_variable_data[no];
 }
 
 // ----------------------------------------
@@ -1071,25 +1131,28 @@ int ScriptHandler::readScript(char *path) {
     archive_path = new char[strlen(path) + 1]{0};
     strcpy(archive_path, path);
 
+    static const struct {
+        const char *name;
+        int encrypt_mode;
+    } script_files[] = {
+        {"0.txt", 0},
+        {"00.txt", 0},
+        {"nscr_sec.dat", 2},
+        {"nscript.___", 3},
+        {"nscript.dat", 1},
+        {"onscript.nt", 15},
+        {"onscript.nt2", 16},
+        {"onscript.nt3", 17},
+    };
     FILE *fp = NULL;
-    char filename[10];
-    int i, encrypt_mode = 0;
-    if ((fp = fopen("0.txt", "rb")) != NULL) {
-        encrypt_mode = 0;
-    } else if ((fp = fopen("00.txt", "rb")) != NULL) {
-        encrypt_mode = 0;
-    } else if ((fp = fopen("nscr_sec.dat", "rb")) != NULL) {
-        encrypt_mode = 2;
-    } else if ((fp = fopen("nscript.___", "rb")) != NULL) {
-        encrypt_mode = 3;
-    } else if ((fp = fopen("nscript.dat", "rb")) != NULL) {
-        encrypt_mode = 1;
-    } else if ((fp = fopen("onscript.nt", "rb")) != NULL) {
-        encrypt_mode = 15;
-    } else if ((fp = fopen("onscript.nt2", "rb")) != NULL) {
-        encrypt_mode = 16;
-    } else if ((fp = fopen("onscript.nt3", "rb")) != NULL) {
-        encrypt_mode = 17;
+    const char *script_file = NULL;
+    int encrypt_mode = 0;
+    for (auto &file : script_files) {
+        if ((fp = fopen(file.name, "rb")) != NULL) {
+            script_file = file.name;
+            encrypt_mode = file.encrypt_mode;
+            break;
+        }
     }
 
     if (fp == NULL) {
@@ -1138,6 +1201,20 @@ int ScriptHandler::readScript(char *path) {
         }
         std::sort(unencrypt.begin(), unencrypt.end());
     }
+
+    script_encrypt_mode = encrypt_mode;
+    script_sources.clear();
+    if (encrypt_mode > 0) {
+        addScriptSource(script_file);
+    } else {
+        for (auto &f : unencrypt) addScriptSource(f.c_str());
+    }
+    script_snapshot_flag = loadScriptSnapshot();
+    if (script_snapshot_flag) {
+        if (encrypt_mode > 0) fclose(fp);
+        return 0;
+    }
+
     static size_t BUFFER_MAX = 1024 * 1024 * 100;
     if (estimated_buffer_length > BUFFER_MAX) {
         // 超过 100MB 的大小可能是 bug
@@ -1428,10 +1505,29 @@ void ScriptHandler::readConfiguration() {
 }
 
 int ScriptHandler::labelScript() {
+    label_index.clear();
+    label_index.reserve(num_of_labels);
+    int_expression_cache.clear();
+    if (!script_snapshot_flag) scanLabels();
+
+    for (int i = 0; i < num_of_labels; i++) {
+        // the first of duplicated labels wins, as in a linear search
+        if (label_info[i].name) label_index.emplace(label_info[i].name, i);
+    }
+
+    line_offsets.clear();
+    line_offsets.push_back(0);
+    for (int i = 0; i < script_buffer_length; i++)
+        if (script_buffer[i] == '\n') line_offsets.push_back(i + 1);
+
+    return 0;
+}
+
+void ScriptHandler::scanLabels() {
     int label_counter = -1;
     int current_line = 0;
     char *buf = script_buffer;
-    label_info = new LabelInfo[num_of_labels + 1];
+    label_info = new LabelInfo[num_of_labels + 1]();
 
     while (buf < script_buffer + script_buffer_length) {
         SKIP_SPACE(buf);
@@ -1461,22 +1557,16 @@ int ScriptHandler::labelScript() {
     }
 
     label_info[num_of_labels].start_address = NULL;
-
-    return 0;
 }
 
 int ScriptHandler::findLabel(const char *label) {
-    int i;
-    char capital_label[256];
+    onscripter::String capital_label(label);
+    for (auto &ch : capital_label)
+        if ('A' <= ch && ch <= 'Z') ch += 'a' - 'A';
+
+    auto it = label_index.find(capital_label);
+    if (it != label_index.end()) return it->second;
 
-    for (i = 0; i < (int)strlen(label) + 1; i++) {
-        capital_label[i] = label[i];
-        if ('A' <= capital_label[i] && capital_label[i] <= 'Z')
-            capital_label[i] += 'a' - 'A';
-    }
-    for (i = 0; i < num_of_labels; i++) {
-        if (!strcmp(label_info[i].name, capital_label)) return i;
-    }
     int size = strlen(label) + 32;
     char *p = new char[size]{0};
     snprintf(p, size, "Label \"%s\" is not found.", label);
@@ -1656,68 +1746,80 @@ int ScriptHandler::parseInt(char **buf, bool ignore_exit) {
         }
         return *ret;
     } else {
-        char ch, alias_buf[256];
-        int alias_buf_len = 0, alias_no = 0;
-        bool direct_num_flag = false;
-        bool num_alias_flag = false;
+        if (!parseNumber(buf, ret)) {
+            current_variable.type = VAR_NONE;
+            return 0;
+        }
+        current_variable.type = VAR_INT | VAR_CONST;
+    }
 
-        char *buf_start = *buf;
-        while (1) {
-            ch = **buf;
+    SKIP_SPACE(*buf);
 
-            if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
-                ch == '_') {
-                if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
-                if (direct_num_flag) break;
-                num_alias_flag = true;
+    return ret;
+}
+
+// a decimal number or a num alias; *buf is left untouched if there is none
+bool ScriptHandler::parseNumber(char **buf, int &num) {
+    char ch, alias_buf[256];
+    int alias_buf_len = 0, alias_no = 0;
+    bool direct_num_flag = false;
+    bool num_alias_flag = false;
+
+    char *buf_start = *buf;
+    while (1) {
+        ch = **buf;
+
+        if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+            ch == '_') {
+            if (ch >= 'A' && ch <= 'Z') ch += 'a' - 'A';
+            if (direct_num_flag) break;
+            num_alias_flag = true;
+            alias_buf[alias_buf_len++] = ch;
+        } else if (ch >= '0' && ch <= '9') {
+            if (!num_alias_flag) direct_num_flag = true;
+            if (direct_num_flag)
+                alias_no = alias_no * 10 + ch - '0';
+            else
                 alias_buf[alias_buf_len++] = ch;
-            } else if (ch >= '0' && ch <= '9') {
-                if (!num_alias_flag) direct_num_flag = true;
-                if (direct_num_flag)
-                    alias_no = alias_no * 10 + ch - '0';
-                else
-                    alias_buf[alias_buf_len++] = ch;
-            } else
-                break;
-            (*buf)++;
-        }
+        } else
+            break;
+        (*buf)++;
+    }
 
-        if (*buf - buf_start == 0) {
-            current_variable.type = VAR_NONE;
-            return 0;
-        }
+    if (*buf - buf_start == 0) return false;
 
-        /* ---------------------------------------- */
-        /* Solve num aliases */
-        if (num_alias_flag) {
-            alias_buf[alias_buf_len] = '\0';
-            Alias *p_num_alias = root_num_alias.next;
+    /* ---------------------------------------- */
+    /* Solve num aliases */
+    if (num_alias_flag) {
+        alias_buf[alias_buf_len] = '\0';
+        Alias *p_num_alias = root_num_alias.next;
 
-            while (p_num_alias) {
-                if (!strcmp(p_num_alias->alias, (const char *)alias_buf)) {
-                    alias_no = p_num_alias->num;
-                    break;
-                }
-                p_num_alias = p_num_alias->next;
-            }
-            if (!p_num_alias) {
-                // utils::printInfo("can't find num alias for %s... assume
-                // 0.\n", alias_buf );
-                current_variable.type = VAR_NONE;
-                *buf = buf_start;
-                return 0;
+        while (p_num_alias) {
+            if (!strcmp(p_num_alias->alias, (const char *)alias_buf)) {
+                alias_no = p_num_alias->num;
+                break;
             }
+            p_num_alias = p_num_alias->next;
+        }
+        if (!p_num_alias) {
+            // utils::printInfo("can't find num alias for %s... assume
+            // 0.\n", alias_buf );
+            *buf = buf_start;
+            return false;
         }
-        current_variable.type = VAR_INT | VAR_CONST;
-        ret = alias_no;
     }
+    num = alias_no;
 
-    SKIP_SPACE(*buf);
-
-    return ret;
+    return true;
 }
 
 int ScriptHandler::parseIntExpression(char **buf) {
+    IntExpression *expr = getIntExpression(*buf);
+    if (expr) {
+        *buf += expr->length;
+        return evalIntExpression(*expr);
+    }
+
     int num[3], op[2];  // internal buffer
 
     SKIP_SPACE(*buf);
@@ -1805,6 +1907,220 @@ void ScriptHandler::readNextOp(char **buf, int *op, int *num) {
     }
 }
 
+void ScriptHandler::setIntExpressionCache(bool enabled) {
+    int_expression_cache_flag = enabled;
+    int_expression_cache.clear();
+}
+
+// compiled form of the expression at buf, NULL if it must be parsed as text
+ScriptHandler::IntExpression *ScriptHandler::getIntExpression(char *buf) {
+    if (!int_expression_cache_flag || !isScriptAddress(buf)) return NULL;
+
+    IntExpression &expr = int_expression_cache[buf - script_buffer];
+    if (expr.code.empty() ||
+        expr.num_alias_generation != num_alias_generation) {
+        // current_variable is only updated when the code is evaluated
+        char *p = buf;
+        expr.code.clear();
+        expr.var_type = VAR_NONE;
+        expr.var_no = -1;
+        expr.num_alias_generation = num_alias_generation;
+        expr.valid = compileIntExpression(&p, expr.code, expr);
+        expr.length = p - buf;
+
+        // deep nesting would overflow the evaluation stack
+        int depth = 0;
+        for (auto &c : expr.code) {
+            if (c.type == IntExpression::PUSH_CONST ||
+                c.type == IntExpression::PUSH_VAR)
+                depth++;
+            else if (c.type == IntExpression::ARITHMETIC)
+                depth--;
+            if (depth > MAX_INT_EXPRESSION_DEPTH) expr.valid = false;
+        }
+        if (expr.code.empty()) expr.valid = false;
+        if (!expr.valid) {
+            expr.code.clear();
+            expr.code.push_back({IntExpression::PUSH_CONST, 0});
+        }
+    }
+
+    return expr.valid ? &expr : NULL;
+}
+
+/*
+ * The compiler follows parseIntExpression, readNextOp and parseInt step by
+ * step, emitting code where they compute, so that evaluating the code gives
+ * the same result and leaves the same current_variable.  Only literals, num
+ * aliases and integer variables with a constant number are accepted.
+ */
+void ScriptHandler::appendArithmetic(
+    onscripter::Vector<IntExpression::Code> &dst,
+    int op,
+    const onscripter::Vector<IntExpression::Code> &src,
+    IntExpression &expr) {
+    dst.insert(dst.end(), src.begin(), src.end());
+    dst.push_back({IntExpression::ARITHMETIC, op});
+    // as calcArithmetic leaves it; the variable number is kept
+    expr.var_type = VAR_INT | VAR_CONST;
+}
+
+bool ScriptHandler::compileIntExpression(
+    char **buf,
+    onscripter::Vector<IntExpression::Code> &code,
+    IntExpression &expr) {
+    onscripter::Vector<IntExpression::Code> num[3];
+    int op[2];
+
+    SKIP_SPACE(*buf);
+
+    if (!compileNextOp(buf, NULL, num[0], expr)) return false;
+
+    if (!compileNextOp(buf, &op[0], num[1], expr)) return false;
+    if (op[0] == OP_INVALID) {
+        code.insert(code.end(), num[0].begin(), num[0].end());
+        return true;
+    }
+
+    while (1) {
+        num[2].clear();
+        if (!compileNextOp(buf, &op[1], num[2], expr)) return false;
+        if (op[1] == OP_INVALID) break;
+
+        if (!(op[0] & 0x04) && (op[1] & 0x04)) {
+            appendArithmetic(num[1], op[1], num[2], expr);
+        } else {
+            appendArithmetic(num[0], op[0], num[1], expr);
+            op[0] = op[1];
+            num[1].swap(num[2]);
+        }
+    }
+    appendArithmetic(num[0], op[0], num[1], expr);
+    code.insert(code.end(), num[0].begin(), num[0].end());
+    return true;
+}
+
+bool ScriptHandler::compileNextOp(char **buf,
+                                  int *op,
+                                  onscripter::Vector<IntExpression::Code> &code,
+                                  IntExpression &expr) {
+    bool minus_flag = false;
+    SKIP_SPACE(*buf);
+    char *buf_start = *buf;
+
+    if (op) {
+        if ((*buf)[0] == '+')
+            *op = OP_PLUS;
+        else if ((*buf)[0] == '-')
+            *op = OP_MINUS;
+        else if ((*buf)[0] == '*')
+            *op = OP_MULT;
+        else if ((*buf)[0] == '/')
+            *op = OP_DIV;
+        else if ((*buf)[0] == 'm' && (*buf)[1] == 'o' && (*buf)[2] == 'd' &&
+                 ((*buf)[3] == ' ' || (*buf)[3] == '\t' || (*buf)[3] == '$' ||
+                  (*buf)[3] == '%' || (*buf)[3] == '?' ||
+                  ((*buf)[3] >= '0' && (*buf)[3] <= '9')))
+            *op = OP_MOD;
+        else {
+            *op = OP_INVALID;
+            return true;
+        }
+        if (*op == OP_MOD)
+            *buf += 3;
+        else
+            (*buf)++;
+        SKIP_SPACE(*buf);
+    }
+
+    SKIP_SPACE(*buf);
+    if ((*buf)[0] == '-') {
+        minus_flag = true;
+        (*buf)++;
+        SKIP_SPACE(*buf);
+    }
+
+    if ((*buf)[0] == '(') {
+        (*buf)++;
+        if (!compileIntExpression(buf, code, expr)) return false;
+        if (minus_flag) code.push_back({IntExpression::NEGATE, 0});
+        SKIP_SPACE(*buf);
+        if ((*buf)[0] != ')') return false;  // reported by the text parser
+        (*buf)++;
+    } else {
+        if (!compileInt(buf, code, expr)) return false;
+        if (minus_flag) code.push_back({IntExpression::NEGATE, 0});
+        if (expr.var_type == VAR_NONE) {
+            if (op) *op = OP_INVALID;
+            *buf = buf_start;
+        }
+    }
+    return true;
+}
+
+bool ScriptHandler::compileInt(char **buf,
+                               onscripter::Vector<IntExpression::Code> &code,
+                               IntExpression &expr) {
+    SKIP_SPACE(*buf);
+
+    if (**buf == '%') {
+        (*buf)++;
+        if (**buf == '(') return false;
+        onscripter::Vector<IntExpression::Code> no;
+        if (!compileInt(buf, no, expr)) return false;
+        if (no.size() != 1 || no[0].type != IntExpression::PUSH_CONST)
+            return false;
+        code.push_back({IntExpression::PUSH_VAR, no[0].value});
+        expr.var_type = VAR_INT;
+        expr.var_no = no[0].value;
+        return true;
+    } else if (**buf == '(') {
+        return compileIntExpression(buf, code, expr);
+    } else if (**buf == '?') {
+        return false;
+    }
+
+    int num = 0;
+    if (parseNumber(buf, num)) {
+        expr.var_type = VAR_INT | VAR_CONST;
+    } else {
+        expr.var_type = VAR_NONE;
+        num = 0;
+    }
+    code.push_back({IntExpression::PUSH_CONST, num});
+    if (expr.var_type != VAR_NONE) SKIP_SPACE(*buf);
+
+    return true;
+}
+
+int ScriptHandler::evalIntExpression(const IntExpression &expr) {
+    int stack[MAX_INT_EXPRESSION_DEPTH];
+    int sp = 0;
+
+    for (auto &c : expr.code) {
+        switch (c.type) {
+            case IntExpression::PUSH_CONST:
+                stack[sp++] = c.value;
+                break;
+            case IntExpression::PUSH_VAR:
+                stack[sp++] = getVariableData(c.value).num;
+                break;
+            case IntExpression::NEGATE:
+                stack[sp - 1] = -stack[sp - 1];
+                break;
+            case IntExpression::ARITHMETIC:
+                sp--;
+                stack[sp - 1] =
+                    calcArithmetic(stack[sp - 1], c.value, stack[sp]);
+                break;
+        }
+    }
+
+    current_variable.type = expr.var_type;
+    if (expr.var_no >= 0) current_variable.var_no = expr.var_no;
+    return stack[0];
+}
+
 int ScriptHandler::calcArithmetic(int num1, int op, int num2) {
     int ret = 0;
 
@@ -41,6 +41,7 @@
      ((unsigned char)(x) != (unsigned char)0xff))
 
 #define STRING_BUFFER_LENGTH 4096
+#define MAX_INT_EXPRESSION_DEPTH 32
 
 typedef unsigned char uchar3[3];
 
@@ -125,6 +126,7 @@ class ScriptHandler {
     void skipToken();
     int parseInt(char **buf, bool ignore_exit = false);
     int parseIntExpression(char **buf);
+    void setIntExpressionCache(bool enabled);
     void readVariable(bool reread_flag = false);
     void skipAnyVariable();
     bool readColor(utils::uchar4 *color);
@@ -152,12 +154,24 @@ class ScriptHandler {
     bool isExternalScript();
 
     int getOffset(char *pos);
+    inline bool isScriptAddress(const char *pos) {
+        return pos >= script_buffer &&
+               pos < script_buffer + script_buffer_length;
+    }
     char *getAddress(int offset);
     int getLineByAddress(char *address);
     char *getAddressByLine(int line);
     LabelInfo getLabelByAddress(char *address);
     LabelInfo getLabelByLine(int line);
 
+    // lookahead for image prefetching: collect the string literal file names
+    // of bg/ld/lsp/lsph commands in the next max_lines lines from pos,
+    // advancing pos line by line; returns the number of lines scanned
+    int scanImageNames(char *&pos,
+                       int max_lines,
+                       size_t max_names,
+                       onscripter::Vector<onscripter::String> &names);
+
     bool isName(const char *name);
     bool isText();
     bool compareString(const char *buf);
@@ -206,25 +220,16 @@ class ScriptHandler {
     void addStrAlias(const char *str1, const char *str2);
 
     enum { LABEL_LOG = 0, FILE_LOG = 1 };
-    struct LogLink {
-        LogLink *next;
-        char *name;
-
-        LogLink() {
-            next = NULL;
-            name = NULL;
-        };
-        ~LogLink() {
-            if (name) delete[] name;
-        };
-    };
     struct LogInfo {
-        LogLink root_log;
-        LogLink *current_log;
-        int num_logs;
+        // names upper-cased with backslash separators; the log file keeps
+        // them in the order they were first seen
+        onscripter::UnorderedSet<onscripter::String> names;
+        onscripter::Vector<const char *> order;
         const char *filename;
     } log_info[2];
-    LogLink *findAndAddLog(LogInfo &info, const char *name, bool add_flag);
+    // the logged name, or NULL if name is not in the log and add_flag is
+    // false
+    const char *findAndAddLog(LogInfo &info, const char *name, bool add_flag);
     void resetLog(LogInfo &info);
 
     /* ---------------------------------------- */
@@ -322,15 +327,36 @@ class ScriptHandler {
 
     int readScript(char *path);
     int readScriptSub(FILE *fp, char **buf, int encrypt_mode);
+
+    // the decoded script and label table are kept in the save dir and
+    // reused while the script files keep their size, mtime and contents,
+    // see ScriptHandler_snapshot.cpp; with no save dir given before the
+    // script is opened, it is written once savedir sets one
+    struct ScriptSource {
+        onscripter::String name;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t hash;  // of the file as it is on disk
+    };
+    onscripter::Vector<ScriptSource> script_sources;
+    int script_encrypt_mode;
+    bool script_snapshot_flag;     // loaded from the snapshot
+    bool script_snapshot_pending;  // to be saved once there is a save dir
+    void addScriptSource(const char *name);
+    bool loadScriptSnapshot();
+    void saveScriptSnapshot();
     void readConfiguration();
     int labelScript();
+    void scanLabels();
     int setFontConfig(const char *buf);
 
     int findLabel(const char *label);
+    int getLineIndex(char *address);
 
     char *checkComma(char *buf);
     void parseStr(char **buf);
     void readNextOp(char **buf, int *op, int *num);
+    bool parseNumber(char **buf, int &num);
     int calcArithmetic(int num1, int op, int num2);
     int parseArray(char **buf, ArrayVariable &array, bool ignore_exit = false);
     int *getArrayPtr(int no,
@@ -341,14 +367,49 @@ class ScriptHandler {
     /* ---------------------------------------- */
     /* Variable */
     struct VariableData *variable_data;
-    struct ExtendedVariableData {
-        int no;
-        VariableData vd;
-    } *extended_variable_data;
-    int num_extended_variable_data;
-    int max_extended_variable_data;
+    // variables outside variable_range, created on first use
+    onscripter::UnorderedMap<int, VariableData> extended_variable_data;
+    onscripter::String log_key;  // scratch for findAndAddLog
 
     Alias root_num_alias, *last_num_alias;
+    unsigned int num_alias_generation;  // changes when num aliases change
+
+    /* ---------------------------------------- */
+    /* Integer expressions read from script_buffer are lowered once to
+       postfix code with num aliases folded, and re-evaluated from it */
+    struct IntExpression {
+        enum { PUSH_CONST, PUSH_VAR, NEGATE, ARITHMETIC };
+        struct Code {
+            int type;
+            int value;  // constant, variable number or operator
+        };
+        onscripter::Vector<Code> code;
+        bool valid;     // false if it needs the text parser, e.g. arrays
+        int length;     // bytes of text consumed
+        int var_type;   // current_variable.type left by the text parser
+        int var_no;     // current_variable.var_no, -1 if left untouched
+        unsigned int num_alias_generation;
+    };
+    onscripter::UnorderedMap<int, IntExpression> int_expression_cache;
+    bool int_expression_cache_flag;
+
+    IntExpression *getIntExpression(char *buf);
+    bool compileIntExpression(char **buf,
+                              onscripter::Vector<IntExpression::Code> &code,
+                              IntExpression &expr);
+    bool compileNextOp(char **buf,
+                       int *op,
+                       onscripter::Vector<IntExpression::Code> &code,
+                       IntExpression &expr);
+    bool compileInt(char **buf,
+                    onscripter::Vector<IntExpression::Code> &code,
+                    IntExpression &expr);
+    static void appendArithmetic(
+        onscripter::Vector<IntExpression::Code> &dst,
+        int op,
+        const onscripter::Vector<IntExpression::Code> &src,
+        IntExpression &expr);
+    int evalIntExpression(const IntExpression &expr);
     Alias root_str_alias, *last_str_alias;
 
     ArrayVariable *root_array_variable, *current_array_variable;
@@ -366,6 +427,10 @@ class ScriptHandler {
 
     LabelInfo *label_info;
     int num_of_labels;
+    // built by labelScript: label name -> first index in label_info, and
+    // the offset of the start of every line in script_buffer
+    onscripter::UnorderedMap<onscripter::String, int> label_index;
+    onscripter::Vector<int> line_offsets;
 
     bool skip_enabled;
     bool kidokuskip_flag;
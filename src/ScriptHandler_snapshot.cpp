@@ -0,0 +1,276 @@
+/* -*- C++ -*-
+ *
+ *  ScriptHandler_snapshot.cpp - Decoded script and label table kept on disk
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ScriptHandler.h"
+
+#include "private/utils.h"
+
+#define SCRIPT_SNAPSHOT_FILE "scriptcache.dat"
+#define SCRIPT_SNAPSHOT_MAGIC "ONSSNAP2"
+#define SCRIPT_SNAPSHOT_MAGIC_LENGTH 8
+#define SNAPSHOT_HASH_SEED 0xcbf29ce484222325ULL
+
+/*
+ * Layout, in host byte order:
+ *   magic[8] meta_length:u32 meta[meta_length] script[script_buffer_length]
+ *   checksum:u64 (of magic to meta, then of script)
+ * meta holds the encryption mode, the key table hash, the name, size, mtime
+ * and content hash of every source file, script_buffer_length and the label
+ * table with addresses stored as offsets.  A file saved back with the same
+ * size within the mtime resolution is only caught by its hash.  The file
+ * only lives in the save dir, as the game directory may be read-only.
+ */
+
+namespace {
+uint64_t snapshotHash(const void *data, size_t length, uint64_t h) {
+    const unsigned char *p = (const unsigned char *)data;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+        p += 8;
+        length -= 8;
+    }
+    while (length--) h = (h ^ *p++) * 0x100000001b3ULL;
+    return h;
+}
+
+struct SnapshotWriter {
+    onscripter::Vector<char> data;
+    template <typename T>
+    void put(T value) {
+        const char *p = (const char *)&value;
+        data.insert(data.end(), p, p + sizeof(T));
+    }
+    void putString(const char *str) {
+        uint32_t length = strlen(str);
+        put(length);
+        data.insert(data.end(), str, str + length);
+    }
+};
+
+struct SnapshotReader {
+    const char *p, *end;
+    bool ok = true;
+    template <typename T>
+    T get() {
+        T value = T();
+        if (end - p < (ptrdiff_t)sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, p, sizeof(T));
+        p += sizeof(T);
+        return value;
+    }
+    onscripter::String getString() {
+        uint32_t length = get<uint32_t>();
+        if (!ok || end - p < (ptrdiff_t)length) {
+            ok = false;
+            return onscripter::String();
+        }
+        onscripter::String str(p, length);
+        p += length;
+        return str;
+    }
+};
+}  // namespace
+
+void ScriptHandler::addScriptSource(const char *name) {
+    char path[STRING_BUFFER_LENGTH] = {0};
+    fpath(name, path);
+
+    std::error_code ec;
+    ScriptSource source;
+    source.name = name;
+    source.size = onscripter::fs::file_size(path, ec);
+    if (ec) source.size = 0;
+    source.mtime =
+        onscripter::fs::last_write_time(path, ec).time_since_epoch().count();
+    if (ec) source.mtime = 0;
+
+    // read in whole words, so the hash is the one of the file in one piece
+    source.hash = SNAPSHOT_HASH_SEED;
+    FILE *fp = ::fopen(path, "rb");
+    if (fp) {
+        onscripter::Vector<char> buf(1 << 16);
+        size_t length;
+        while ((length = fread(buf.data(), 1, buf.size(), fp)) > 0)
+            source.hash = snapshotHash(buf.data(), length, source.hash);
+        fclose(fp);
+    }
+    script_sources.push_back(source);
+}
+
+bool ScriptHandler::loadScriptSnapshot() {
+    if (!save_dir) return false;
+    FILE *fp = fopen(SCRIPT_SNAPSHOT_FILE, "rb", true);
+    if (!fp) return false;
+
+    ons_fseek64(fp, 0, SEEK_END);
+    size_t length = ons_ftell64(fp);
+    ons_fseek64(fp, 0, SEEK_SET);
+    onscripter::Vector<char> file_data(length);
+    if (fread(file_data.data(), 1, length, fp) != length) length = 0;
+    fclose(fp);
+    const char *data = file_data.data();
+
+    // magic, meta_length and checksum
+    const size_t overhead = SCRIPT_SNAPSHOT_MAGIC_LENGTH + 4 + 8;
+    if (length < overhead ||
+        memcmp(data, SCRIPT_SNAPSHOT_MAGIC, SCRIPT_SNAPSHOT_MAGIC_LENGTH))
+        return false;
+    uint32_t meta_length;
+    memcpy(&meta_length, data + SCRIPT_SNAPSHOT_MAGIC_LENGTH, 4);
+    if (meta_length > length - overhead) return false;
+    uint64_t checksum;
+    memcpy(&checksum, data + length - 8, 8);
+    size_t head_length = SCRIPT_SNAPSHOT_MAGIC_LENGTH + 4 + meta_length;
+    if (snapshotHash(data + head_length,
+                     length - head_length - 8,
+                     snapshotHash(data, head_length, SNAPSHOT_HASH_SEED)) !=
+        checksum)
+        return false;
+
+    SnapshotReader meta;
+    meta.p = data + SCRIPT_SNAPSHOT_MAGIC_LENGTH + 4;
+    meta.end = meta.p + meta_length;
+
+    if (meta.get<int32_t>() != script_encrypt_mode) return false;
+    uint64_t key_hash =
+        key_table_flag ? snapshotHash(key_table, sizeof(key_table), 0) : 0;
+    if (meta.get<uint64_t>() != key_hash) return false;
+
+    uint32_t num_sources = meta.get<uint32_t>();
+    if (!meta.ok || num_sources != script_sources.size()) return false;
+    for (auto &source : script_sources) {
+        if (meta.getString() != source.name ||
+            meta.get<uint64_t>() != source.size ||
+            meta.get<int64_t>() != source.mtime ||
+            meta.get<uint64_t>() != source.hash || !meta.ok)
+            return false;
+    }
+
+    int64_t buffer_length = meta.get<int64_t>();
+    int32_t num_labels = meta.get<int32_t>();
+    if (!meta.ok || num_labels < 0 ||
+        buffer_length != (int64_t)(length - overhead - meta_length))
+        return false;
+
+    LabelInfo *labels = new LabelInfo[num_labels + 1]();
+    for (int i = 0; i < num_labels && meta.ok; i++) {
+        onscripter::String name = meta.getString();
+        int32_t header = meta.get<int32_t>();
+        int32_t start = meta.get<int32_t>();
+        labels[i].start_line = meta.get<int32_t>();
+        labels[i].num_of_lines = meta.get<int32_t>();
+        if (header < 0 || header > buffer_length || start < 0 ||
+            start > buffer_length)
+            meta.ok = false;
+        labels[i].name = new char[name.size() + 1]{0};
+        strcpy(labels[i].name, name.c_str());
+        labels[i].label_header = (char *)(intptr_t)header;
+        labels[i].start_address = (char *)(intptr_t)start;
+    }
+    if (!meta.ok) {
+        for (int i = 0; i < num_labels; i++)
+            if (labels[i].name) delete[] labels[i].name;
+        delete[] labels;
+        return false;
+    }
+
+    if (script_buffer) delete[] script_buffer;
+    script_buffer = new char[buffer_length + 1]{0};
+    memcpy(script_buffer, meta.end, buffer_length);
+    script_buffer_length = buffer_length;
+    current_script = script_buffer;
+
+    for (int i = 0; i < num_labels; i++) {
+        labels[i].label_header =
+            script_buffer + (intptr_t)labels[i].label_header;
+        labels[i].start_address =
+            script_buffer + (intptr_t)labels[i].start_address;
+    }
+    labels[num_labels].start_address = NULL;
+    label_info = labels;
+    num_of_labels = num_labels;
+
+    return true;
+}
+
+void ScriptHandler::saveScriptSnapshot() {
+    if (!save_dir || !script_snapshot_pending) return;
+    script_snapshot_pending = false;
+    for (int i = 0; i < num_of_labels; i++)
+        if (!label_info[i].name) return;  // the label count was off
+
+    SnapshotWriter meta;
+    meta.put<int32_t>(script_encrypt_mode);
+    meta.put<uint64_t>(
+        key_table_flag ? snapshotHash(key_table, sizeof(key_table), 0) : 0);
+    meta.put<uint32_t>(script_sources.size());
+    for (auto &source : script_sources) {
+        meta.putString(source.name.c_str());
+        meta.put<uint64_t>(source.size);
+        meta.put<int64_t>(source.mtime);
+        meta.put<uint64_t>(source.hash);
+    }
+    meta.put<int64_t>(script_buffer_length);
+    meta.put<int32_t>(num_of_labels);
+    for (int i = 0; i < num_of_labels; i++) {
+        meta.putString(label_info[i].name);
+        meta.put<int32_t>(label_info[i].label_header - script_buffer);
+        meta.put<int32_t>(label_info[i].start_address - script_buffer);
+        meta.put<int32_t>(label_info[i].start_line);
+        meta.put<int32_t>(label_info[i].num_of_lines);
+    }
+
+    uint32_t meta_length = meta.data.size();
+    SnapshotWriter head;
+    head.data.insert(head.data.end(),
+                     SCRIPT_SNAPSHOT_MAGIC,
+                     SCRIPT_SNAPSHOT_MAGIC + SCRIPT_SNAPSHOT_MAGIC_LENGTH);
+    head.put(meta_length);
+    head.data.insert(head.data.end(), meta.data.begin(), meta.data.end());
+    uint64_t checksum = snapshotHash(
+        script_buffer,
+        script_buffer_length,
+        snapshotHash(head.data.data(), head.data.size(), SNAPSHOT_HASH_SEED));
+
+    char tmp_path[STRING_BUFFER_LENGTH] = {0}, path[STRING_BUFFER_LENGTH] = {0};
+    fpath(SCRIPT_SNAPSHOT_FILE ".tmp", tmp_path, true);
+    fpath(SCRIPT_SNAPSHOT_FILE, path, true);
+
+    FILE *fp = ::fopen(tmp_path, "wb");
+    if (!fp) return;
+    bool ok =
+        fwrite(head.data.data(), 1, head.data.size(), fp) == head.data.size() &&
+        fwrite(script_buffer, 1, script_buffer_length, fp) ==
+            (size_t)script_buffer_length &&
+        fwrite(&checksum, 1, 8, fp) == 8;
+    if (fclose(fp) != 0) ok = false;
+
+    // rename does not replace an existing file on Windows
+    remove(path);
+    if (!ok || rename(tmp_path, path) != 0) {
+        remove(tmp_path);
+        utils::printError("can't write %s\n", path);
+    }
+}
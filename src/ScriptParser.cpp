@@ -56,6 +56,7 @@ void deleteLayerInfo() {
 
 ScriptParser::ScriptParser() {
     debug_level = 0;
+    user_func_generation = 0;
     srand(time(NULL));
     rand();
 
@@ -155,6 +156,24 @@ const int ScriptParser::calcFontSize(const int v, ons_font::FONT_TYPE types) {
     return v;
 }
 
+ScriptParser::UserFuncLUT *ScriptParser::addUserFunc(const char *cmd) {
+    if (cmd[0] < 'a' || cmd[0] > 'z') return NULL;
+
+    UserFuncHash &ufh = user_func_hash[cmd[0] - 'a'];
+    ufh.last->next = new UserFuncLUT();
+    ufh.last = ufh.last->next;
+    setStr(&ufh.last->command, cmd);
+    user_func_map.emplace(cmd, ufh.last);
+    user_func_generation++;
+
+    return ufh.last;
+}
+
+ScriptParser::UserFuncLUT *ScriptParser::findUserFunc(const char *cmd) {
+    auto it = user_func_map.find(cmd);
+    return it != user_func_map.end() ? it->second : NULL;
+}
+
 void ScriptParser::reset(bool isDestroy) {
     int i;
     for (i = 'z' - 'a'; i >= 0; i--) {
@@ -168,6 +187,8 @@ void ScriptParser::reset(bool isDestroy) {
         ufh.root.next = NULL;
         ufh.last = &ufh.root;
     }
+    user_func_map.clear();
+    user_func_generation++;
 
     // reset misc variables
     if (nsa_path) {
@@ -633,17 +654,14 @@ void ScriptParser::writeLog(ScriptHandler::LogInfo &info) {
         int i, j;
         char buf[10];
 
-        snprintf(buf, 10, "%d", info.num_logs);
+        snprintf(buf, 10, "%d", (int)info.order.size());
         for (i = 0; i < (int)strlen(buf); i++) writeChar(buf[i], output_flag);
         writeChar('\n', output_flag);
 
-        ScriptHandler::LogLink *cur = info.root_log.next;
-        for (i = 0; i < info.num_logs; i++) {
+        for (const char *name : info.order) {
             writeChar('"', output_flag);
-            for (j = 0; j < (int)strlen(cur->name); j++)
-                writeChar(cur->name[j] ^ 0x84, output_flag);
+            for (j = 0; name[j]; j++) writeChar(name[j] ^ 0x84, output_flag);
             writeChar('"', output_flag);
-            cur = cur->next;
         }
 
         if (n == 1) break;
@@ -200,6 +200,12 @@ class ScriptParser {
         UserFuncLUT root;
         UserFuncLUT *last;
     } user_func_hash['z' - 'a' + 1];
+    // defsub/luasub by name, first definition wins; the generation changes
+    // whenever a function is added or all are dropped
+    onscripter::UnorderedMap<onscripter::String, UserFuncLUT *> user_func_map;
+    unsigned int user_func_generation;
+    UserFuncLUT *addUserFunc(const char *cmd);
+    UserFuncLUT *findUserFunc(const char *cmd);
 
     struct NestInfo {
         enum { LABEL = 0, FOR = 1 };
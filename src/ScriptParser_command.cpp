@@ -749,15 +749,8 @@ int ScriptParser::maxkaisoupageCommand() {
 }
 
 int ScriptParser::luasubCommand() {
-    const char *cmd = script_h.readLabel();
-
-    if (cmd[0] >= 'a' && cmd[0] <= 'z') {
-        UserFuncHash &ufh = user_func_hash[cmd[0] - 'a'];
-        ufh.last->next = new UserFuncLUT();
-        ufh.last = ufh.last->next;
-        ufh.last->lua_flag = true;
-        setStr(&ufh.last->command, cmd);
-    }
+    UserFuncLUT *func = addUserFunc(script_h.readLabel());
+    if (func) func->lua_flag = true;
 
     return RET_CONTINUE;
 }
@@ -1310,14 +1303,7 @@ int ScriptParser::defvoicevolCommand() {
 }
 
 int ScriptParser::defsubCommand() {
-    const char *cmd = script_h.readLabel();
-
-    if (cmd[0] >= 'a' && cmd[0] <= 'z') {
-        UserFuncHash &ufh = user_func_hash[cmd[0] - 'a'];
-        ufh.last->next = new UserFuncLUT();
-        ufh.last = ufh.last->next;
-        setStr(&ufh.last->command, cmd);
-    }
+    addUserFunc(script_h.readLabel());
 
     return RET_CONTINUE;
 }
@@ -25,7 +25,10 @@
  *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #ifdef USE_BUILTIN_EFFECTS
+#include <algorithm>
+
 #include "ONScripter.h"
+#include "Parallel.h"
 
 enum {
     // some constants for trig tables
@@ -66,10 +69,7 @@ void ONScripter::effectTrvswave(char *params, int duration) {
         TRVSWAVE_WVLEN_START = 256
     };
 
-    SDL_Rect src_rect = {0, 0, screen_width, 1};
-    SDL_Rect dst_rect = {0, 0, screen_width, 1};
     int ampl, wvlen;
-    int y_offset = -screen_height / 2;
     int width = 256 * effect_counter / duration;
     alphaBlend(NULL,
                ALPHA_BLEND_CONST,
@@ -93,21 +93,55 @@ void ONScripter::effectTrvswave(char *params, int duration) {
                        2 * (duration - effect_counter) / duration) +
                       (1.0 / TRVSWAVE_WVLEN_START)));
     }
-    SDL_FillRect(accumulation_surface,
-                 NULL,
-                 SDL_MapRGBA(accumulation_surface->format, 0, 0, 0, 0xff));
-    for (int i = 0; i < screen_height; i++) {
-        int theta = TRIG_TABLE_SIZE * y_offset / wvlen;
-        while (theta < 0) theta += TRIG_TABLE_SIZE;
-        theta %= TRIG_TABLE_SIZE;
-        dst_rect.x = (Sint16)(ampl * sin_table[theta] / TRIG_FACTOR);
-        // dst_rect.x = (Sint16)(ampl * sin(M_PI * 2.0 * y_offset / wvlen));
-        SDL_BlitSurface(
-            effect_tmp_surface, &src_rect, accumulation_surface, &dst_rect);
-        ++src_rect.y;
-        ++dst_rect.y;
-        ++y_offset;
-    }
+
+    // each row is the blended row shifted sideways, black where it moved
+    // away from; rows are written whole, so no clearing pass is needed
+    struct Waver {
+        const ONSBuf *src_buffer;
+        ONSBuf *dst_buffer;
+        const int *sin_table;
+        int width, y_offset, ampl, wvlen;
+        ONSBuf black;
+
+        void operator()(const int i) const {
+            // & wraps negative angles the same as adding TRIG_TABLE_SIZE
+            int theta = TRIG_TABLE_SIZE * (y_offset + i) / wvlen;
+            int dx = ampl * sin_table[theta & (TRIG_TABLE_SIZE - 1)] /
+                     TRIG_FACTOR;
+            // dx = ampl * sin(M_PI * 2.0 * (y_offset + i) / wvlen);
+            const ONSBuf *src = src_buffer + width * i;
+            ONSBuf *dst = dst_buffer + width * i;
+            int len = width - (dx < 0 ? -dx : dx);
+            if (len <= 0) {
+                std::fill_n(dst, width, black);
+            } else if (dx >= 0) {
+                std::fill_n(dst, dx, black);
+                memcpy(dst + dx, src, len * sizeof(ONSBuf));
+            } else {
+                memcpy(dst, src - dx, len * sizeof(ONSBuf));
+                std::fill_n(dst + len, -dx, black);
+            }
+        }
+    };
+
+    SDL_LockSurface(effect_tmp_surface);
+    SDL_LockSurface(accumulation_surface);
+    Waver waver = {
+        (ONSBuf *)effect_tmp_surface->pixels,
+        (ONSBuf *)accumulation_surface->pixels,
+        sin_table,
+        screen_width,
+        -screen_height / 2,
+        ampl,
+        wvlen,
+        (ONSBuf)SDL_MapRGBA(accumulation_surface->format, 0, 0, 0, 0xff)};
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+    parallel::For(0, screen_height, 1, waver, screen_width * screen_height);
+#else
+    for (int i = 0; i < screen_height; i++) waver(i);
+#endif
+    SDL_UnlockSurface(accumulation_surface);
+    SDL_UnlockSurface(effect_tmp_surface);
 }
 
 //
@@ -119,19 +153,53 @@ void ONScripter::effectTrvswave(char *params, int duration) {
 void ONScripter::buildWhirlTable() {
     if (whirl_table) return;
 
-    whirl_table = new int[screen_height * screen_width];
-    int *dst_buffer = whirl_table;
+    // radius * 4 of each pixel; only its index into the trig tables is
+    // ever used, so a byte holds it
+    whirl_table = new Uint8[screen_height * screen_width];
+    Uint8 *dst_buffer = whirl_table;
 
     for (int i = 0; i < screen_height; ++i) {
         for (int j = 0; j < screen_width; ++j, ++dst_buffer) {
             int x = j - CENTER_X, y = i - CENTER_Y;
             // actual x = x + 0.5, actual y = y + 0.5;
             // (x+0.5)^2 + (y+0.5)^2 = x^2 + x + 0.25 + y^2 + y + 0.25
-            *dst_buffer = (int)(sqrt((float)(x * x + x + y * y + y) + 0.5) * 4);
+            int r = (int)(sqrt((float)(x * x + x + y * y + y) + 0.5) * 4);
+            *dst_buffer = (Uint8)(r % TRIG_TABLE_SIZE);
         }
     }
 }
 
+// Row i of the whirl: each pixel is fetched from src rotated around the
+// center by the angle of its radius, looked up in rot_cos and rot_sin.
+// Plain loads on purpose: the compiler vectorizes the arithmetic, and
+// hardware gathers measured slower than scalar loads for the pixels.
+static void whirlRow(const Uint32 *src,
+                     Uint32 *dst,
+                     const Uint8 *whirl,
+                     const int *rot_cos,
+                     const int *rot_sin,
+                     int i,
+                     int width,
+                     int height) {
+    const int center_x = width / 2, center_y = height / 2;
+    // working on x+0.5, hence (2x+1)/2
+    const int y2 = 2 * (i - center_y) + 1;
+    for (int j = 0; j < width; ++j) {
+        const int x2 = 2 * (j - center_x) + 1;
+        const int c = rot_cos[whirl[j]], s = rot_sin[whirl[j]];
+        int jj = ((x2 * c - y2 * s) / TRIG_FACTOR - 1) / 2 + center_x;
+        int ii = ((x2 * s + y2 * c) / TRIG_FACTOR - 1) / 2 + center_y;
+        // jj = (int) (x * cos_theta - y * sin_theta + CENTER_X);
+        // ii = (int) (x * sin_theta + y * cos_theta + CENTER_Y);
+        if (jj < 0) jj = 0;
+        if (jj >= width) jj = width - 1;
+        if (ii < 0) ii = 0;
+        if (ii >= height) ii = height - 1;
+
+        dst[j] = src[width * ii + jj];
+    }
+}
+
 void ONScripter::effectWhirl(char *params, int duration) {
     // #define OMEGA (M_PI / 64)
 
@@ -158,54 +226,53 @@ void ONScripter::effectWhirl(char *params, int duration) {
                NULL,
                effect_tmp_surface);
 
-    SDL_LockSurface(effect_tmp_surface);
-    SDL_LockSurface(accumulation_surface);
-    ONSBuf *src_buffer = (ONSBuf *)effect_tmp_surface->pixels;
-    ONSBuf *dst_buffer = (ONSBuf *)accumulation_surface->pixels;
-    int *whirl_buffer = whirl_table;
+    // the angle a pixel turns by only depends on its radius index, so the
+    // rotation of each index is worked out once per frame
+    int rot_cos[TRIG_TABLE_SIZE], rot_sin[TRIG_TABLE_SIZE];
+    for (int k = 0; k < TRIG_TABLE_SIZE; k++) {
+        int theta =
+            ((rad_amp * sin_table[k] / TRIG_FACTOR) + rad_base) * direction;
+        // float theta = direction * (rad_base + rad_amp *
+        //                            sin(sqrt(x * x + y * y) * OMEGA));
+        // & wraps negative angles the same as adding TRIG_TABLE_SIZE
+        theta &= TRIG_TABLE_SIZE - 1;
+        rot_cos[k] = cos_table[theta];
+        rot_sin[k] = sin_table[theta];
+    }
 
-    for (int i = 0; i < screen_height; ++i) {
-        for (int j = 0; j < screen_width; ++j, ++dst_buffer, ++whirl_buffer) {
-            int ii = i, jj = j;
-            // actual x = x + 0.5, actual y = y + 0.5
-            int x = j - CENTER_X, y = i - CENTER_Y;
-            // whirl factor
-            int theta = *whirl_buffer;
-            while (theta < 0) theta += TRIG_TABLE_SIZE;
-            theta %= TRIG_TABLE_SIZE;
-            theta = ((rad_amp * sin_table[theta] / TRIG_FACTOR) + rad_base) *
-                    direction;
-            // float theta = direction * (rad_base + rad_amp *
-            //                            sin(sqrt(x * x + y * y) * OMEGA));
-
-            // perform rotation
-            while (theta < 0) theta += TRIG_TABLE_SIZE;
-            theta %= TRIG_TABLE_SIZE;
-            // working on x+0.5, hence (2x+1)/2
-            jj = (((x + x + 1) * cos_table[theta] -
-                   (y + y + 1) * sin_table[theta]) /
-                      TRIG_FACTOR -
-                  1) /
-                     2 +
-                 CENTER_X;
-            ii = (((x + x + 1) * sin_table[theta] +
-                   (y + y + 1) * cos_table[theta]) /
-                      TRIG_FACTOR -
-                  1) /
-                     2 +
-                 CENTER_Y;
-            // jj = (int) (x * cos_theta - y * sin_theta + CENTER_X);
-            // ii = (int) (x * sin_theta + y * cos_theta + CENTER_Y);
-            if (jj < 0) jj = 0;
-            if (jj >= screen_width) jj = screen_width - 1;
-            if (ii < 0) ii = 0;
-            if (ii >= screen_height) ii = screen_height - 1;
-
-            // change pixel value!
-            *dst_buffer = *(src_buffer + screen_width * ii + jj);
+    struct Whirler {
+        const ONSBuf *src_buffer;
+        ONSBuf *dst_buffer;
+        const Uint8 *whirl_table;
+        const int *rot_cos, *rot_sin;
+        int width, height;
+
+        void operator()(const int i) const {
+            whirlRow(src_buffer,
+                     dst_buffer + width * i,
+                     whirl_table + width * i,
+                     rot_cos,
+                     rot_sin,
+                     i,
+                     width,
+                     height);
         }
-    }
+    };
 
+    SDL_LockSurface(effect_tmp_surface);
+    SDL_LockSurface(accumulation_surface);
+    Whirler whirler = {(ONSBuf *)effect_tmp_surface->pixels,
+                       (ONSBuf *)accumulation_surface->pixels,
+                       whirl_table,
+                       rot_cos,
+                       rot_sin,
+                       screen_width,
+                       screen_height};
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+    parallel::For(0, screen_height, 1, whirler, screen_width * screen_height);
+#else
+    for (int i = 0; i < screen_height; i++) whirler(i);
+#endif
     SDL_UnlockSurface(accumulation_surface);
     SDL_UnlockSurface(effect_tmp_surface);
 }
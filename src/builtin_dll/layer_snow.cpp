@@ -289,6 +289,19 @@ char *FuruLayer::message(const char *message, int &ret_int) {
             }
         }
         SDL_FreeSurface(ref_surface);
+        // update() keeps x within the new width and cell within the new
+        // cells by a single wrap
+        if (initialized) {
+            const int virt_w = width + max_sp_w;
+            for (int j = 0; j < N_FURU_ELEMENTS; j++) {
+                Element *cur = &elements[j];
+                const int end = cur->first + cur->count;
+                for (int i = cur->first; i < end; i++) {
+                    cur->x[i] %= virt_w;
+                    cur->cell[i] %= cur->sprite->num_of_cells;
+                }
+            }
+        }
         // Set Parameters
     } else if (sscanf(message,
                       "s|%d,%d,%d,%d,%d",
@@ -320,16 +333,11 @@ char *FuruLayer::message(const char *message, int &ret_int) {
                 Element *cur = &elements[j];
                 int y = 0;
                 while (y < height) {
-                    const int tmp = (cur->pend + 1) % FURU_ELEMENT_BUFSIZE;
-                    if (tmp != cur->pstart) {
+                    if (!cur->full()) {
                         // add a point for each element
-                        OscPt *item = &cur->points[cur->pend];
-                        item->pt.x = rand() % (width + max_sp_w);
-                        item->pt.y = y;
-                        item->pt.type = j;
-                        item->pt.cell = rand() % cur->sprite->num_of_cells;
-                        item->base_angle = rand() % FURU_AMP_TABLE_SIZE;
-                        cur->pend = tmp;
+                        const int x = rand() % (width + max_sp_w);
+                        const int cell = rand() % cur->sprite->num_of_cells;
+                        cur->add(x, y, cell, rand() % FURU_AMP_TABLE_SIZE);
                     }
                     y += interval * cur->fall_speed;
                 }
@@ -352,10 +360,7 @@ char *FuruLayer::message(const char *message, int &ret_int) {
         halted = true;
         // Get number of elements displayed
     } else if (!strcmp(message, "n")) {
-        for (int i = 0; i < N_FURU_ELEMENTS; i++)
-            ret_int +=
-                (elements[i].pend - elements[i].pstart + FURU_ELEMENT_BUFSIZE) %
-                FURU_ELEMENT_BUFSIZE;
+        for (int i = 0; i < N_FURU_ELEMENTS; i++) ret_int += elements[i].count;
         // Pause
     } else if (!strcmp(message, "p")) {
         paused = true;
@@ -376,34 +381,45 @@ void FuruLayer::update() {
             angle = (angle - freq + FURU_AMP_TABLE_SIZE) % FURU_AMP_TABLE_SIZE;
         for (int j = 0; j < N_FURU_ELEMENTS; ++j) {
             Element *cur = &elements[j];
-            int i = cur->pstart;
             const int virt_w = width + max_sp_w;
-            while (i != cur->pend) {
-                cur->points[i].pt.x =
-                    (cur->points[i].pt.x + wind + virt_w) % virt_w;
-                cur->points[i].pt.y += cur->fall_speed;
-                ++(cur->points[i].pt.cell) %= cur->sprite->num_of_cells;
-                ++i %= FURU_ELEMENT_BUFSIZE;
+            if (cur->count > 0) {
+                // x stays in [0, virt_w) and the wind is at most half the
+                // width, so one wrap either way does for the modulo; plain
+                // loops over the arrays, which the compiler vectorizes
+                int *x = cur->x + cur->first;
+                int *y = cur->y + cur->first;
+                int *cell = cur->cell + cur->first;
+                const int count = cur->count, fall_speed = cur->fall_speed;
+                const int num_of_cells = cur->sprite->num_of_cells;
+                for (int i = 0; i < count; ++i) {
+                    int px = x[i] + wind;
+                    px += px < 0 ? virt_w : 0;
+                    px -= px >= virt_w ? virt_w : 0;
+                    x[i] = px;
+                }
+                for (int i = 0; i < count; ++i) y[i] += fall_speed;
+                for (int i = 0; i < count; ++i) {
+                    int c = cell[i] + 1;
+                    cell[i] = c >= num_of_cells ? 0 : c;
+                }
             }
             if (!halted) {
                 if (--(cur->frame_cnt) <= 0) {
-                    const int tmp = (cur->pend + 1) % FURU_ELEMENT_BUFSIZE;
                     cur->frame_cnt += interval;
-                    if (tmp != cur->pstart) {
+                    if (!cur->full()) {
                         // add a point for this element
-                        OscPt *item = &cur->points[cur->pend];
-                        item->pt.x = rand() % virt_w;
-                        item->pt.y = -(cur->sprite->pos.h);
-                        item->pt.type = j;
-                        item->pt.cell = 0;
-                        item->base_angle = rand() % FURU_AMP_TABLE_SIZE;
-                        cur->pend = tmp;
+                        const int x = rand() % virt_w;
+                        cur->add(x,
+                                 -(cur->sprite->pos.h),
+                                 0,
+                                 rand() % FURU_AMP_TABLE_SIZE);
                     }
                 }
             }
-            while ((cur->pstart != cur->pend) &&
-                   (cur->points[cur->pstart].pt.y >= height))
-                ++(cur->pstart) %= FURU_ELEMENT_BUFSIZE;
+            while (cur->count > 0 && cur->y[cur->first] >= height) {
+                ++cur->first;
+                --cur->count;
+            }
         }
     }
 }
@@ -415,39 +431,34 @@ void FuruLayer::refresh(SDL_Surface *surface, SDL_Rect &clip) {
             Element *cur = &elements[j];
             if (cur->sprite) {
                 cur->sprite->visible = true;
-                const int n = (cur->pend - cur->pstart + FURU_ELEMENT_BUFSIZE) %
-                              FURU_ELEMENT_BUFSIZE;
-                int p = cur->pstart;
+                const int n = cur->count;
+                const int *x = cur->x + cur->first;
+                const int *base_angle = cur->base_angle + cur->first;
                 if (amplitude == 0) {
                     // no need to mess with angles if no displacement
-                    for (int i = n; i > 0; i--) {
-                        OscPt *curpt = &cur->points[p];
-                        ++p %= FURU_ELEMENT_BUFSIZE;
-                        cur->sprite->current_cell = curpt->pt.cell;
-                        cur->sprite->pos.x =
-                            ((curpt->pt.x + virt_w) % virt_w) - max_sp_w;
-                        cur->sprite->pos.y = curpt->pt.y;
-                        drawTaggedSurface(surface, cur->sprite, clip);
-                    }
+                    for (int i = 0; i < n; i++)
+                        cur->draw_x[i] = ((x[i] + virt_w) % virt_w) - max_sp_w;
                 } else {
-                    for (int i = n; i > 0; i--) {
-                        OscPt *curpt = &cur->points[p];
-                        ++p %= FURU_ELEMENT_BUFSIZE;
+                    for (int i = 0; i < n; i++) {
                         const int disp_angle =
-                            (angle + curpt->base_angle + FURU_AMP_TABLE_SIZE) %
+                            (angle + base_angle[i] + FURU_AMP_TABLE_SIZE) %
                             FURU_AMP_TABLE_SIZE;
-                        cur->sprite->current_cell = curpt->pt.cell;
-                        cur->sprite->pos.x =
-                            ((curpt->pt.x + cur->amp_table[disp_angle] +
-                              virt_w) %
+                        cur->draw_x[i] =
+                            ((x[i] + cur->amp_table[disp_angle] + virt_w) %
                              virt_w) -
                             max_sp_w;
-                        cur->sprite->pos.y = curpt->pt.y;
-                        drawTaggedSurface(surface, cur->sprite, clip);
                     }
                 }
+                // all the points of an element in one pass over the surface
+                cur->sprite->blendBatchOnSurface(surface,
+                                                 n,
+                                                 cur->draw_x,
+                                                 cur->y + cur->first,
+                                                 cur->cell + cur->first,
+                                                 clip,
+                                                 cur->sprite->trans);
             }
         }
     }
 }
-#endif
\ No newline at end of file
+#endif
@@ -97,7 +97,7 @@ class OldMovieLayer : public Layer {
 };
 
 static const int N_FURU_ELEMENTS = 3;
-static const int FURU_ELEMENT_BUFSIZE = 512;  // should be a power of 2
+static const int FURU_ELEMENT_BUFSIZE = 512;  // one more than the points held
 static const int FURU_AMP_TABLE_SIZE =
     256;  // should also be power of 2, it helps
 
@@ -121,23 +121,23 @@ class FuruLayer : public Layer {
     int angle;
     bool paused, halted;
 
-    struct OscPt {  // point plus base oscillation angle
-        int base_angle;
-        struct {
-            int x, y, type, cell;
-        } pt;
-    };
+    // the points of an element as parallel arrays, the live ones in
+    // [first, first + count), oldest first; at most
+    // FURU_ELEMENT_BUFSIZE - 1 live, in room for twice that so that the
+    // live points are only moved back to the front now and then
     struct Element {
         AnimationInfo *sprite;
         int *amp_table;
-        // rolling buffer
-        OscPt *points;
-        int pstart, pend, frame_cnt, fall_speed;
+        int *points;  // x, y, cell and base_angle, then draw_x
+        int *x, *y, *cell, *base_angle;
+        int *draw_x;  // x on screen, filled by refresh()
+        int first, count, frame_cnt, fall_speed;
         Element() {
             sprite = NULL;
             amp_table = NULL;
             points = NULL;
-            pstart = pend = frame_cnt = fall_speed = 0;
+            x = y = cell = base_angle = draw_x = NULL;
+            first = count = frame_cnt = fall_speed = 0;
         };
         ~Element() {
             if (sprite) delete sprite;
@@ -145,8 +145,16 @@ class FuruLayer : public Layer {
             if (points) delete[] points;
         };
         void init() {
-            if (!points) points = new OscPt[FURU_ELEMENT_BUFSIZE];
-            pstart = pend = frame_cnt = 0;
+            if (!points) {
+                const int room = FURU_ELEMENT_BUFSIZE * 2;
+                points = new int[room * 4 + FURU_ELEMENT_BUFSIZE];
+                x = points;
+                y = x + room;
+                cell = y + room;
+                base_angle = cell + room;
+                draw_x = base_angle + room;
+            }
+            first = count = frame_cnt = 0;
         };
         void clear() {
             if (sprite) delete sprite;
@@ -155,12 +163,28 @@ class FuruLayer : public Layer {
             amp_table = NULL;
             if (points) delete[] points;
             points = NULL;
-            pstart = pend = frame_cnt = 0;
+            x = y = cell = base_angle = draw_x = NULL;
+            first = count = frame_cnt = 0;
         };
         void setSprite(AnimationInfo *anim) {
             if (sprite) delete sprite;
             sprite = anim;
         };
+        bool full() const { return count >= FURU_ELEMENT_BUFSIZE - 1; }
+        void add(int px, int py, int pcell, int pangle) {
+            if (first + count == FURU_ELEMENT_BUFSIZE * 2) {
+                memmove(x, x + first, count * sizeof(int));
+                memmove(y, y + first, count * sizeof(int));
+                memmove(cell, cell + first, count * sizeof(int));
+                memmove(base_angle, base_angle + first, count * sizeof(int));
+                first = 0;
+            }
+            const int i = first + count++;
+            x[i] = px;
+            y[i] = py;
+            cell[i] = pcell;
+            base_angle[i] = pangle;
+        };
     } elements[N_FURU_ELEMENTS];
     int max_sp_w;
 
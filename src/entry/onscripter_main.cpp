@@ -84,6 +84,36 @@ void optionHelp() {
     utils::printInfo("      --enc:sjis|gbk\tuse sjis|gbk coding script\n");
     utils::printInfo("      --debug:1\t\tprint debug info\n");
     utils::printInfo("      --fontcache\tcache default font\n");
+    utils::printInfo(
+        "      --image-cache-size MB\tset the image file cache budget "
+        "(default 64)\n");
+    utils::printInfo(
+        "      --surface-cache-size MB\tset the decoded image cache budget "
+        "(default 64)\n");
+    utils::printInfo(
+        "      --glyph-cache-size MB\tset the rasterized glyph cache budget "
+        "(default 4)\n");
+    utils::printInfo(
+        "      --image-prefetch LINES\tload images used in the next LINES "
+        "lines in background, 0 to disable (default 32)\n");
+    utils::printInfo(
+        "      --texture-composite\tcomposite sprites with the renderer "
+        "instead of the CPU\n");
+    utils::printInfo(
+        "      --no-expression-cache\tre-parse integer expressions from "
+        "the script text every time\n");
+    utils::printInfo(
+        "      --headless\trun without a display or sound on a virtual clock "
+        "and print per-command and per-frame timings on exit\n");
+    utils::printInfo(
+        "      --replay file\trun headless, feeding the clicks, keys and "
+        "waits of an input trace\n");
+    utils::printInfo(
+        "      --fps n\t\tshow effect frames at n per second instead of the "
+        "display refresh rate\n");
+    utils::printInfo(
+        "      --frame-stats file\twrite a histogram of the effect frame "
+        "times to file on exit\n");
     utils::printInfo("  -h, --help\t\tshow this help and exit\n");
     utils::printInfo(
         "  -v, --version\t\tshow the version information and exit\n");
@@ -325,6 +355,46 @@ void parseOption(int argc, char *argv[]) {
                 ons.setDebugLevel(1);
             } else if (!strcmp(argv[0] + 1, "-fontcache")) {
                 ons.setFontCache();
+            } else if (!strcmp(argv[0] + 1, "-image-cache-size")) {
+                argc--;
+                argv++;
+                int cache_mb = atoi(argv[0]);
+                ons.setImageCacheSize(cache_mb > 0 ? (size_t)cache_mb << 20
+                                                   : 0);
+            } else if (!strcmp(argv[0] + 1, "-surface-cache-size")) {
+                argc--;
+                argv++;
+                int cache_mb = atoi(argv[0]);
+                ons.setSurfaceCacheSize(cache_mb > 0 ? (size_t)cache_mb << 20
+                                                     : 0);
+            } else if (!strcmp(argv[0] + 1, "-glyph-cache-size")) {
+                argc--;
+                argv++;
+                int cache_mb = atoi(argv[0]);
+                ons.setGlyphCacheSize(cache_mb > 0 ? (size_t)cache_mb << 20
+                                                   : 0);
+            } else if (!strcmp(argv[0] + 1, "-image-prefetch")) {
+                argc--;
+                argv++;
+                ons.setImagePrefetch(atoi(argv[0]));
+            } else if (!strcmp(argv[0] + 1, "-texture-composite")) {
+                ons.setTextureComposite();
+            } else if (!strcmp(argv[0] + 1, "-no-expression-cache")) {
+                ons.disableExpressionCache();
+            } else if (!strcmp(argv[0] + 1, "-headless")) {
+                ons.setHeadless();
+            } else if (!strcmp(argv[0] + 1, "-replay")) {
+                argc--;
+                argv++;
+                if (!ons.setReplayFile(argv[0])) exit(-1);
+            } else if (!strcmp(argv[0] + 1, "-fps")) {
+                argc--;
+                argv++;
+                ons.setFrameRate(atoi(argv[0]));
+            } else if (!strcmp(argv[0] + 1, "-frame-stats")) {
+                argc--;
+                argv++;
+                ons.setFrameStatsFile(argv[0]);
             } else if (!strcmp(argv[0] + 1, "-no-vsync")) {
                 ons.setVsyncOff();
             } else if (!strcmp(argv[0] + 1, "-scale-window")) {
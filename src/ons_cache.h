@@ -3,15 +3,179 @@
 #include <SDL.h>
 
 #include <config.hpp>
-#include <infra/cache.hpp>
-#include <infra/lru_cache_policy.hpp>
+#include <mutex>
+
+#define DEFAULT_IMAGE_CACHE_SIZE (64 * 1024 * 1024)
+#define DEFAULT_SURFACE_CACHE_SIZE (64 * 1024 * 1024)
+#define DEFAULT_GLYPH_CACHE_SIZE (4 * 1024 * 1024)
 
 namespace onscache {
-typedef caches::fixed_sized_cache<
-    onscripter::String,
-    onscripter::SharedPtr<onscripter::Vector<uint8_t>>,
-    caches::LRUCachePolicy>
+struct CacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t insertions = 0;
+    size_t evictions = 0;
+    size_t evicted_bytes = 0;
+    size_t bytes = 0;
+    size_t peak_bytes = 0;
+};
+
+// LRU cache whose capacity is a byte budget instead of an entry count.
+// SizeOf returns the resident size of a value; an entry larger than the
+// whole budget is not cached at all.
+template <typename Key, typename Value, typename SizeOf>
+class ByteBudgetCache {
+   public:
+    explicit ByteBudgetCache(size_t max_bytes) : max_bytes(max_bytes) {}
+
+    bool TryGet(const Key &key, Value &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            stats.misses++;
+            return false;
+        }
+        lru.splice(lru.begin(), lru, it->second);
+        value = it->second->value;
+        stats.hits++;
+        return true;
+    }
+
+    bool Cached(const Key &key) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.find(key) != index.end();
+    }
+
+    void Put(const Key &key, const Value &value) {
+        size_t size = SizeOf()(value);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) eraseEntry(it->second, false);
+        if (size > max_bytes) return;
+        lru.push_front(Entry{key, value, size});
+        index[key] = lru.begin();
+        stats.insertions++;
+        stats.bytes += size;
+        evictTo(max_bytes);
+        if (stats.bytes > stats.peak_bytes) stats.peak_bytes = stats.bytes;
+    }
+
+    bool Remove(const Key &key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end()) return false;
+        eraseEntry(it->second, false);
+        return true;
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru.clear();
+        index.clear();
+        stats.bytes = 0;
+    }
+
+    void SetCapacity(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        max_bytes = bytes;
+        evictTo(max_bytes);
+    }
+
+    size_t Capacity() const { return max_bytes; }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+
+    CacheStats Stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+   private:
+    struct Entry {
+        Key key;
+        Value value;
+        size_t size;
+    };
+    typedef typename onscripter::List<Entry>::iterator EntryIterator;
+
+    void eraseEntry(EntryIterator entry, bool evicted) {
+        stats.bytes -= entry->size;
+        if (evicted) {
+            stats.evictions++;
+            stats.evicted_bytes += entry->size;
+        }
+        index.erase(entry->key);
+        lru.erase(entry);
+    }
+
+    void evictTo(size_t bytes) {
+        while (stats.bytes > bytes && !lru.empty())
+            eraseEntry(std::prev(lru.end()), true);
+    }
+
+    onscripter::List<Entry> lru;
+    onscripter::UnorderedMap<Key, EntryIterator> index;
+    mutable std::mutex mutex;
+    size_t max_bytes;
+    CacheStats stats;
+};
+
+typedef onscripter::SharedPtr<onscripter::Vector<uint8_t>> ImageBuffer;
+
+struct ImageBufferSize {
+    size_t operator()(const ImageBuffer &buffer) const {
+        return buffer ? buffer->size() : 0;
+    }
+};
+
+typedef ByteBudgetCache<onscripter::String, ImageBuffer, ImageBufferSize>
     ImageBufferCache;
+
+// decoded, converted and alpha-processed image, ready to be blitted
+struct DecodedImage {
+    onscripter::SharedPtr<SDL_Surface> surface;
+    int orig_w, orig_h;  // AnimationInfo::orig_pos set by setupImageAlpha
+
+    DecodedImage() : orig_w(0), orig_h(0) {}
+    DecodedImage(SDL_Surface *surface, int orig_w, int orig_h)
+        : surface(surface, SDL_FreeSurface), orig_w(orig_w), orig_h(orig_h) {}
+};
+
+struct DecodedImageSize {
+    size_t operator()(const DecodedImage &image) const {
+        return image.surface ? (size_t)image.surface->pitch * image.surface->h
+                             : 0;
+    }
+};
+
+typedef ByteBudgetCache<onscripter::String, DecodedImage, DecodedImageSize>
+    SurfaceCache;
+
+// 8-bit coverage bitmap from TTF_RenderGlyph_Shaded, already shifted by half
+// a pixel for outlines, with the metrics drawGlyph places it by
+struct GlyphImage {
+    onscripter::SharedPtr<SDL_Surface> surface;
+    int minx, miny;
+
+    GlyphImage() : minx(0), miny(0) {}
+    GlyphImage(SDL_Surface *surface, int minx, int miny)
+        : surface(surface, SDL_FreeSurface), minx(minx), miny(miny) {}
+};
+
+struct GlyphImageSize {
+    size_t operator()(const GlyphImage &glyph) const {
+        return glyph.surface ? sizeof(SDL_Surface) +
+                                   (size_t)glyph.surface->pitch *
+                                       glyph.surface->h
+                             : 0;
+    }
+};
+
+// keyed by font id << 16 | UTF-16 code unit, see ONScripter::getGlyph
+typedef ByteBudgetCache<uint64_t, GlyphImage, GlyphImageSize> GlyphCache;
 }  // namespace onscache
 
 #endif
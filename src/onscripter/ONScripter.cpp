@@ -49,6 +49,22 @@ extern "C" void waveCallback(int channel);
 static void SDL_Quit_Wrapper() { SDL_Quit(); }
 #endif
 
+static void printCacheStats(const char *name,
+                            const onscache::CacheStats &stats,
+                            size_t capacity) {
+    utils::printInfo(
+        "%s: %zu hits, %zu misses, %zu evictions (%zu KiB), "
+        "%zu KiB resident, %zu KiB peak, %zu KiB budget\n",
+        name,
+        stats.hits,
+        stats.misses,
+        stats.evictions,
+        stats.evicted_bytes / 1024,
+        stats.bytes / 1024,
+        stats.peak_bytes / 1024,
+        capacity / 1024);
+}
+
 void ONScripter::calcRenderRect() {
     SDL_GetRendererOutputSize(renderer, &device_width, &device_height);
     int swdh = screen_width * device_height;
@@ -108,6 +124,12 @@ void ONScripter::initSDL() {
     /* ---------------------------------------- */
     /* Initialize SDL */
     //
+    if (headless_flag) {
+        SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+        SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+        vsync = false;
+        sharpness = NAN;
+    }
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_AUDIO) < 0) {
         utils::printError("Couldn't initialize SDL: %s\n", SDL_GetError());
         exit(-1);
@@ -120,6 +142,7 @@ void ONScripter::initSDL() {
 #else
     const char *firstAudioDriver = "";
 #endif
+    if (headless_flag) firstAudioDriver = "dummy";
     const char *defaultAudioDriver = NULL;
     const char *useAudioDriver = NULL;
     for (int i = 0; i < count; i++) {
@@ -242,6 +265,7 @@ void ONScripter::initSDL() {
 #else
     SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
 #endif
+    if (headless_flag) SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
     // }
     int window_flag = SDL_WINDOW_SHOWN;
 #if defined(ANDROID) || defined(IOS) || defined(WINRT)
@@ -274,6 +298,22 @@ void ONScripter::initSDL() {
     if (vsync) render_flag |= SDL_RENDERER_PRESENTVSYNC;
     renderer = SDL_CreateRenderer(window, -1, render_flag);
 
+    // effects are paced to the refresh of the display the window opens on
+    double frame_rate = fixed_frame_rate;
+    if (headless_flag) {
+        frame_rate = 1000.0 / HEADLESS_FRAME_TIME;
+    } else if (frame_rate <= 0) {
+        SDL_DisplayMode mode;
+        frame_rate = 60;
+        if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window),
+                                      &mode) == 0 &&
+            mode.refresh_rate > 0)
+            frame_rate = mode.refresh_rate;
+    }
+    frame_pacer.setRate(frame_rate,
+                        headless_flag || (vsync && fixed_frame_rate <= 0));
+    utils::printDebug("effect frames: %.2f Hz\n", frame_pacer.getRate());
+
     SDL_RenderSetLogicalSize(renderer, screen_width, screen_height);
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
 
@@ -324,6 +364,11 @@ void ONScripter::initSDL() {
 }
 
 void ONScripter::openAudio(int freq) {
+    // sound would only make headless runs depend on the audio thread
+    if (headless_flag) {
+        audio_open_flag = false;
+        return;
+    }
     Mix_CloseAudio();
     // const int count = SDL_GetNumAudioDevices(0);
     // for (int i = 0; i < count; ++i) {
@@ -368,8 +413,16 @@ void ONScripter::openAudio(int freq) {
 
 ONScripter::ONScripter() {
 #ifdef USE_IMAGE_CACHE
-    imageBufferCache = onscripter::MakeUnique<onscache::ImageBufferCache>(64);
+    imageBufferCache = onscripter::MakeUnique<onscache::ImageBufferCache>(
+        DEFAULT_IMAGE_CACHE_SIZE);
+    surfaceCache = onscripter::MakeUnique<onscache::SurfaceCache>(
+        DEFAULT_SURFACE_CACHE_SIZE);
 #endif
+    glyphCache =
+        onscripter::MakeUnique<onscache::GlyphCache>(DEFAULT_GLYPH_CACHE_SIZE);
+    image_prefetch_lines = DEFAULT_IMAGE_PREFETCH_LINES;
+    prefetch_scan_begin = prefetch_scan_end = NULL;
+    prefetch_lines_ahead = 0;
     is_script_read = false;
 
     cdrom_drive_number = 0;
@@ -389,9 +442,19 @@ ONScripter::ONScripter() {
     sprite_info = new AnimationInfo[MAX_SPRITE_NUM];
     sprite2_info = new AnimationInfo[MAX_SPRITE2_NUM];
     texture_info = new AnimationInfo[MAX_TEXTURE_NUM];
+    active_sprite_generation = AnimationInfo::surface_generation - 1;
+    texture_composite_flag = false;
+    num_stale_rects = 0;
+    stale_refresh_mode = REFRESH_NONE_MODE;
     smpeg_info = NULL;
     current_button_state.down_flag = false;
     vsync = true;
+    headless_flag = false;
+    virtual_ticks = 0;
+    virtual_timer_due = -1;
+    replay_input_time = 0;
+    fixed_frame_rate = 0;
+    frame_stats_file = NULL;
 
     int i;
     for (i = 0; i < MAX_SPRITE2_NUM; i++) sprite2_info[i].affine_flag = true;
@@ -466,10 +529,51 @@ void ONScripter::setSharpness(float sharpness) {
 
 void ONScripter::setVsyncOff() { vsync = false; }
 
+void ONScripter::setHeadless() {
+    headless_flag = true;
+    if (!replay_profile)
+        replay_profile = onscripter::MakeUnique<ReplayProfile>();
+}
+
+bool ONScripter::setReplayFile(const char *path) {
+    replay_trace = onscripter::MakeUnique<ReplayTrace>();
+    if (!replay_trace->open(path)) return false;
+    setHeadless();
+    return true;
+}
+
+void ONScripter::setFrameRate(int fps) { fixed_frame_rate = fps; }
+
+void ONScripter::setFrameStatsFile(const char *path) {
+    frame_stats_file = path;
+}
+
 void ONScripter::setScaleToWindow() { scaleToWindow = true; }
 
 void ONScripter::setFontCache() { cacheFont = true; }
 
+void ONScripter::setImageCacheSize(size_t bytes) {
+#ifdef USE_IMAGE_CACHE
+    imageBufferCache->SetCapacity(bytes);
+#endif
+}
+
+void ONScripter::setSurfaceCacheSize(size_t bytes) {
+#ifdef USE_IMAGE_CACHE
+    surfaceCache->SetCapacity(bytes);
+#endif
+}
+
+void ONScripter::setImagePrefetch(int lines) {
+    image_prefetch_lines = lines > 0 ? lines : 0;
+}
+
+void ONScripter::setTextureComposite() { texture_composite_flag = true; }
+
+void ONScripter::setGlyphCacheSize(size_t bytes) {
+    glyphCache->SetCapacity(bytes);
+}
+
 void ONScripter::enableButtonShortCut() { force_button_shortcut_flag = true; }
 
 void ONScripter::enableWheelDownAdvance() {
@@ -478,6 +582,10 @@ void ONScripter::enableWheelDownAdvance() {
 
 void ONScripter::disableRescale() { disable_rescale_flag = true; }
 
+void ONScripter::disableExpressionCache() {
+    script_h.setIntExpressionCache(false);
+}
+
 void ONScripter::enableEdit() { edit_flag = true; }
 
 void ONScripter::setKeyEXE(const char *filename) {
@@ -632,7 +740,7 @@ int ONScripter::init() {
     breakup_cells = NULL;
     breakup_mask = breakup_cellforms = NULL;
 
-    internal_timer = SDL_GetTicks();
+    internal_timer = getTicks();
 
     trap_dist = NULL;
     resize_buffer = new unsigned char[16];
@@ -689,6 +797,9 @@ generate_path_function ONScripter::generateFPath() {
 }
 
 void ONScripter::reset(bool isDestroy) {
+    // the define section may replace the archive reader
+    stopImagePrefetch();
+
     automode_flag = false;
     automode_time = DEFAULT_AUTOMODE_TIME;
     autoclick_time = 0;
@@ -849,7 +960,9 @@ void ONScripter::flush(int refresh_mode,
     } else {
         if (rect) dirty_rect.add(*rect);
 
-        if (dirty_rect.bounding_box.w * dirty_rect.bounding_box.h > 0)
+        if (dirty_rect.isFragmented())
+            flushDirect(dirty_rect.rects, dirty_rect.num_rects, refresh_mode);
+        else if (dirty_rect.bounding_box.w * dirty_rect.bounding_box.h > 0)
             flushDirect(dirty_rect.bounding_box, refresh_mode);
     }
 
@@ -857,42 +970,77 @@ void ONScripter::flush(int refresh_mode,
 }
 
 void ONScripter::flushDirect(SDL_Rect &rect, int refresh_mode) {
+    flushDirect(&rect, 1, refresh_mode);
+}
+
+// recomposite and upload each rectangle, then present the screen once
+void ONScripter::flushDirect(SDL_Rect *rects, int num_rects, int refresh_mode) {
     // utils::printInfo("flush %d: %d %d %d %d\n", refresh_mode, rect.x, rect.y,
     // rect.w, rect.h );
 
-    SDL_Rect dst_rect = rect;
-    --dst_rect.x;
-    --dst_rect.y;
-    dst_rect.w += 2;
-    dst_rect.h += 2;
-    if (AnimationInfo::doClipping(&dst_rect, &screen_rect) ||
-        (dst_rect.w == 2 && dst_rect.h == 2))
+    std::chrono::steady_clock::time_point frame_start, upload_start;
+    float upload_time = 0;
+    if (replay_profile) frame_start = utils::now();
+
+    if (compositeTextures(rects, num_rects, refresh_mode)) {
+        if (replay_profile)
+            replay_profile->addFrame(utils::duration(frame_start), 0);
         return;
-    refreshSurface(accumulation_surface, &rect, refresh_mode);
-    SDL_LockSurface(accumulation_surface);
-    SDL_UpdateTexture(texture,
-                      &rect,
-                      (unsigned char *)accumulation_surface->pixels +
-                          accumulation_surface->pitch * rect.y +
-                          rect.x * sizeof(ONSBuf),
-                      accumulation_surface->pitch);
-    SDL_UnlockSurface(accumulation_surface);
+    }
+    syncAccumulationSurface();
+
+    SDL_Rect dst_rects[MAX_DIRTY_RECTS];
+    int num_dst_rects = 0;
+    for (int i = 0; i < num_rects && num_dst_rects < MAX_DIRTY_RECTS; i++) {
+        SDL_Rect &rect = rects[i];
+        SDL_Rect dst_rect = rect;
+        --dst_rect.x;
+        --dst_rect.y;
+        dst_rect.w += 2;
+        dst_rect.h += 2;
+        if (AnimationInfo::doClipping(&dst_rect, &screen_rect) ||
+            (dst_rect.w == 2 && dst_rect.h == 2))
+            continue;
+        refreshSurface(accumulation_surface, &rect, refresh_mode);
+        if (replay_profile) upload_start = utils::now();
+        SDL_LockSurface(accumulation_surface);
+        SDL_UpdateTexture(texture,
+                          &rect,
+                          (unsigned char *)accumulation_surface->pixels +
+                              accumulation_surface->pitch * rect.y +
+                              rect.x * sizeof(ONSBuf),
+                          accumulation_surface->pitch);
+        SDL_UnlockSurface(accumulation_surface);
+        if (replay_profile) upload_time += utils::duration(upload_start);
+        dst_rects[num_dst_rects++] = dst_rect;
+    }
+    if (num_dst_rects == 0) return;
+    if (replay_profile) upload_start = utils::now();
 
     screen_dirty_flag = false;
+    if (isnan(sharpness)) {
 #if defined(ANDROID) || \
     defined(RENDER_COPY_RECT_FULL)  // See sdl2 DOCS/README-android.md for more
                                     // information on this
-    SDL_RenderClear(renderer);
-    SDL_Rect *rect_ptr = nullptr;
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
 #else
-    SDL_Rect *rect_ptr = &dst_rect;
+        for (int i = 0; i < num_dst_rects; i++)
+            SDL_RenderCopy(renderer, texture, &dst_rects[i], &dst_rects[i]);
 #endif
-    if (isnan(sharpness)) {
-        SDL_RenderCopy(renderer, texture, rect_ptr, rect_ptr);
     } else {
+#if defined(ANDROID) || defined(RENDER_COPY_RECT_FULL)
+        SDL_RenderClear(renderer);
+#endif
         gles_renderer->copy(render_view_rect.x, render_view_rect.y);
     }
     SDL_RenderPresent(renderer);
+
+    if (replay_profile) {
+        upload_time += utils::duration(upload_start);
+        replay_profile->addFrame(utils::duration(frame_start) - upload_time,
+                                 upload_time);
+    }
 }
 
 #ifdef USE_SMPEG
@@ -1086,6 +1234,7 @@ executeLabelTop:
         if (ret & (RET_SKIP_LINE | RET_EOL)) {
             if (ret & RET_SKIP_LINE) script_h.skipLine();
             if (++current_line >= current_label_info.num_of_lines) break;
+            prefetchImages();
         }
 
         if (!(ret & RET_NO_READ)) readToken();
@@ -1125,53 +1274,76 @@ int ONScripter::parseLine() {
     if (script_h.isText()) {
         if (current_mode == DEFINE_MODE)
             errorAndExit("text cannot be displayed in define section.");
-        return textCommand();
+        if (!replay_profile) return textCommand();
+        auto now = utils::now();
+        auto ret = textCommand();
+        replay_profile->addCommand("(text)", utils::duration(now));
+        return ret;
+    }
+
+    bool user_func_flag = true;
+    if (cmd[0] == '_') {
+        user_func_flag = false;
+        cmd++;
+    }
+
+    // the same address always names the same command, unless a defsub
+    // has shadowed it since
+    UserFuncLUT *uf = NULL;
+    FuncLUT *func = NULL;
+    char *address = script_h.getCurrent();
+    bool cache_flag = script_h.isScriptAddress(address);
+    auto cache = cache_flag ? command_cache.find(address) : command_cache.end();
+    if (cache != command_cache.end() &&
+        cache->second.user_func_generation == user_func_generation &&
+        !strcmp(cache->second.command, cmd)) {
+        uf = cache->second.user_func;
+        func = cache->second.func;
+    } else {
+        if (user_func_flag) uf = findUserFunc(cmd);
+        if (!uf) func = findCommand(cmd);
+        if (cache_flag && (uf || func))
+            command_cache[address] = {uf ? uf->command : func->command,
+                                      uf,
+                                      func,
+                                      user_func_generation};
     }
 
-    if (cmd[0] != '_') {
-        if (cmd[0] >= 'a' && cmd[0] <= 'z') {
-            UserFuncHash &ufh = user_func_hash[cmd[0] - 'a'];
-            UserFuncLUT *uf = ufh.root.next;
-            while (uf) {
-                if (!strcmp(uf->command, cmd)) {
-                    if (uf->lua_flag) {
+    if (uf) {
+        if (uf->lua_flag) {
 #ifdef USE_LUA
-                        if (lua_handler.callFunction(false, cmd))
-                            errorAndExit(lua_handler.error_str);
+            if (lua_handler.callFunction(false, cmd))
+                errorAndExit(lua_handler.error_str);
 #endif
-                    } else {
-                        // 仅在调用方法时尝试跳过参数
-                        gosubReal(cmd, script_h.getNext(), false, true);
-                    }
-                    return RET_CONTINUE;
-                }
-                uf = uf->next;
-            }
+        } else {
+            // 仅在调用方法时尝试跳过参数
+            gosubReal(cmd, script_h.getNext(), false, true);
         }
-    } else {
-        cmd++;
+        return RET_CONTINUE;
     }
 
-    if (cmd[0] >= 'a' && cmd[0] <= 'z') {
-        FuncHash &fh = func_hash[cmd[0] - 'a'];
-        for (int i = 0; i < fh.num; i++) {
-            if (!strcmp(fh.func[i].command, cmd)) {
-#ifndef NDEBUG
-                auto now = utils::now();
+    if (func) {
+#ifdef NDEBUG
+        const bool timed_flag = replay_profile != nullptr;
+#else
+        const bool timed_flag = true;
 #endif
-                // if (saveon_flag) saveSaveFile(false);
-                auto ret = (this->*fh.func[i].method)();
+        std::chrono::steady_clock::time_point now;
+        if (timed_flag) now = utils::now();
+        // if (saveon_flag) saveSaveFile(false);
+        auto ret = (this->*func->method)();
+        if (timed_flag) {
+            auto duration = utils::duration(now);
+            if (replay_profile)
+                replay_profile->addCommand(func->command, duration);
 #ifndef NDEBUG
-                auto duration = utils::duration(now);
-                if (duration > 50 && strcmp(fh.func[i].command, "btnwait")) {
-                    utils::printDebug("command %s exec %.3fms\n",
-                                      fh.func[i].command,
-                                      duration);
-                }
-#endif
-                return ret;
+            if (duration > 50 && strcmp(func->command, "btnwait")) {
+                utils::printDebug(
+                    "command %s exec %.3fms\n", func->command, duration);
             }
+#endif
         }
+        return ret;
     }
 
     if (cmd[0] == '\n')
@@ -1546,6 +1718,23 @@ int ONScripter::refreshMode() {
 void ONScripter::quit() {
     saveAll();
 
+#ifdef USE_IMAGE_CACHE
+    if (debug_level > 0) {
+        printCacheStats("image cache",
+                        imageBufferCache->Stats(),
+                        imageBufferCache->Capacity());
+        printCacheStats(
+            "surface cache", surfaceCache->Stats(), surfaceCache->Capacity());
+    }
+#endif
+    if (debug_level > 0)
+        printCacheStats(
+            "glyph cache", glyphCache->Stats(), glyphCache->Capacity());
+    if (replay_profile) replay_profile->print(virtual_ticks);
+    if (frame_stats_file) frame_pacer.writeHistogram(frame_stats_file);
+    stopImagePrefetch();
+    clearTextureCache();
+
 #ifdef USE_CDROM
     if (cdrom_info) {
         SDL_CDStop(cdrom_info);
@@ -32,6 +32,9 @@
 
 #include "ButtonLink.h"
 #include "DirtyRect.h"
+#include "FramePacer.h"
+#include "ImagePrefetcher.h"
+#include "Replay.h"
 #include "ScriptParser.h"
 #include "ons_cache.h"
 #include "renderer/gles_renderer.h"
@@ -51,6 +54,13 @@
 #define MAX_PARAM_NUM 100
 #define MAX_EFFECT_NUM 256
 
+#define DEFAULT_IMAGE_PREFETCH_LINES 32
+#define IMAGE_PREFETCH_WORKERS 2
+#define IMAGE_PREFETCH_QUEUE 8
+
+// a headless frame yields for as long as a 60 Hz display would
+#define HEADLESS_FRAME_TIME (1000 / 60)
+
 #define DEFAULT_VOLUME 100
 #define ONS_MIX_CHANNELS 50
 #define ONS_MIX_EXTRA_CHANNELS 4
@@ -68,6 +78,9 @@ typedef onscripter::Function<int(const char *, char *, bool)>
     generate_path_function;
 
 class ONScripter : public ScriptParser {
+    // bench/ drives the pixel kernels and effects without a window
+    friend class ONScripterBench;
+
    public:
     typedef AnimationInfo::ONSBuf ONSBuf;
 
@@ -96,16 +109,26 @@ class ONScripter : public ScriptParser {
     void setVsyncOff();
     void setScaleToWindow();
     void setFontCache();
+    void setImageCacheSize(size_t bytes);
+    void setSurfaceCacheSize(size_t bytes);
+    void setImagePrefetch(int lines);
+    void setTextureComposite();
+    void setGlyphCacheSize(size_t bytes);
     void setDebugLevel(int debug);
     void enableButtonShortCut();
     void enableWheelDownAdvance();
     void disableRescale();
+    void disableExpressionCache();
     void enableEdit();
     void setKeyEXE(const char *path);
     const char *getArchivePath() { return archive_path; }
     void setWindowWidth(int width);
     void setWindowHeight(int height);
     void setSharpness(float sharpness);
+    void setHeadless();
+    bool setReplayFile(const char *path);
+    void setFrameRate(int fps);
+    void setFrameStatsFile(const char *path);
     int getWidth() { return screen_width; };
     int getHeight() { return screen_height; };
     ButtonState &getCurrentButtonState() { return current_button_state; };
@@ -113,6 +136,17 @@ class ONScripter : public ScriptParser {
         return automode_flag ? 2 : ((skip_mode & SKIP_NORMAL) ? 1 : 0);
     };
     AnimationInfo *getSMPEGInfo() { return smpeg_info; };
+    // milliseconds since start, virtual in headless runs
+    Uint32 getTicks() {
+        return headless_flag ? virtual_ticks : SDL_GetTicks();
+    }
+    // the same clock with the precision of the performance counter
+    double getPreciseTicks() {
+        if (headless_flag) return virtual_ticks;
+        return SDL_GetPerformanceCounter() * 1000.0 /
+               SDL_GetPerformanceFrequency();
+    }
+    void waitPreciseTicks(double until);
 
     int openScript();
     int init();
@@ -124,12 +158,20 @@ class ONScripter : public ScriptParser {
         char command[30];
         FuncList method;
     };
-    struct FuncHash {
+    // func_lut sorted by name, equal names kept in table order
+    onscripter::Vector<FuncLUT *> sorted_func_lut;
+    // command resolved at an address in script_buffer, valid while
+    // user_func_generation is unchanged
+    struct CommandCache {
+        const char *command;
+        UserFuncLUT *user_func;
         FuncLUT *func;
-        int num;
-    } func_hash['z' - 'a' + 1];
+        unsigned int user_func_generation;
+    };
+    onscripter::UnorderedMap<const char *, CommandCache> command_cache;
 
     void makeFuncLUT();
+    FuncLUT *findCommand(const char *cmd);
 
     int yesnoboxCommand();
     int wavestopCommand();
@@ -384,9 +426,29 @@ class ONScripter : public ScriptParser {
     bool cacheFont;
     bool screen_dirty_flag;
 
+    // headless runs use the dummy drivers and a virtual clock that jumps
+    // straight to the next timer or traced input
+    bool headless_flag;
+    Uint32 virtual_ticks;
+    int virtual_timer_due;  // -1 while no timer is pending
+    Uint32 replay_input_time;
+    onscripter::UniquePtr<ReplayTrace> replay_trace;
+    onscripter::UniquePtr<ReplayProfile> replay_profile;
+
 #ifdef USE_IMAGE_CACHE
     onscripter::UniquePtr<onscache::ImageBufferCache> imageBufferCache;
+    onscripter::UniquePtr<onscache::SurfaceCache> surfaceCache;
+    onscripter::String surfaceCacheKey(AnimationInfo *anim,
+                                       const char *file_name);
 #endif
+    // images named by the next lines of the script are loaded in background
+    onscripter::UniquePtr<ImagePrefetcher> image_prefetcher;
+    int image_prefetch_lines;
+    char *prefetch_scan_begin, *prefetch_scan_end;
+    int prefetch_lines_ahead;
+    onscripter::Vector<onscripter::String> prefetch_names;
+    void prefetchImages();
+    void stopImagePrefetch();
     // variables relevant to button
     ButtonState current_button_state, last_mouse_state;
 
@@ -455,6 +517,7 @@ class ONScripter : public ScriptParser {
                bool clear_dirty_flag = true,
                bool direct_flag = false);
     void flushDirect(SDL_Rect &rect, int refresh_mode);
+    void flushDirect(SDL_Rect *rects, int num_rects, int refresh_mode);
 #ifdef USE_SMPEG
     void flushDirectYUV(SDL_Overlay *overlay);
 #endif
@@ -506,6 +569,9 @@ class ONScripter : public ScriptParser {
     AnimationInfo btndef_info, bg_info, cursor_info[2];
     AnimationInfo tachi_info[3];  // 0 ... left, 1 ... center, 2 ... right
     AnimationInfo *sprite_info, *sprite2_info;
+    // indices of sprites holding an image, in descending order
+    onscripter::Vector<int> active_sprites, active_sprites2;
+    unsigned int active_sprite_generation;
     AnimationInfo *texture_info;
     AnimationInfo *bar_info[MAX_PARAM_NUM], *prnum_info[MAX_PARAM_NUM];
     AnimationInfo lookback_info[4];
@@ -534,8 +600,9 @@ class ONScripter : public ScriptParser {
     DirtyRect dirty_rect;                 // only this region is updated
     int effect_counter, effect_duration;  // counter in each effect
     int effect_timer_resolution;
-    int effect_start_time;
-    int effect_start_time_old;
+    FramePacer frame_pacer;
+    int fixed_frame_rate;  // 0 to follow the display
+    const char *frame_stats_file;
     volatile bool update_effect_dst;
 
     void generateEffectDst(int effect_no);
@@ -553,7 +620,8 @@ class ONScripter : public ScriptParser {
         int radius;
         BreakupCell() : cell_x(0), cell_y(0), dir(0), state(0), radius(0) {}
     } *breakup_cells;
-    bool *breakup_cellforms, *breakup_mask;
+    // a word of bits per cell row, see ONScripter_effect_breakup.cpp
+    Uint32 *breakup_cellforms, *breakup_mask;
     void buildBreakupCellforms();
     void buildBreakupMask();
     void initBreakup(char *params);
@@ -569,7 +637,7 @@ class ONScripter : public ScriptParser {
     void buildSinTable();
     void buildCosTable();
     void effectTrvswave(char *params, int duration);
-    int *whirl_table;
+    Uint8 *whirl_table;
     void buildWhirlTable();
     void effectWhirl(char *params, int duration);
 #endif
@@ -618,6 +686,8 @@ class ONScripter : public ScriptParser {
     void keyUpEvent(SDL_KeyboardEvent *event);
     bool keyPressEvent(SDL_KeyboardEvent *event);
     void timerEvent(bool init_flag);
+    void startTimer(Uint32 duration);
+    bool waitHeadlessEvent(SDL_Event &event);
 #if (defined(IOS) || defined(ANDROID) || defined(WINRT))
     bool convTouchKey(SDL_TouchFingerEvent &finger);
 #endif
@@ -702,6 +772,11 @@ class ONScripter : public ScriptParser {
                                        bool *has_alpha,
                                        int *location,
                                        const SDL_Point *load_size = NULL);
+    SDL_Surface *readImageFile(const char *filename,
+                               bool *has_alpha,
+                               int *location,
+                               const SDL_Point *load_size,
+                               bool quiet);
 
     int resizeSurface(SDL_Surface *src, SDL_Surface *dst);
     void alphaBlend(SDL_Surface *mask_surface,
@@ -722,6 +797,9 @@ class ONScripter : public ScriptParser {
     void refreshSurface(SDL_Surface *surface,
                         SDL_Rect *clip_src,
                         int refresh_mode = REFRESH_NORMAL_MODE);
+    void updateActiveSprites();
+    bool isOccluding(AnimationInfo *anim, SDL_Rect &clip);
+    int findOccluder(int lower, int upper, SDL_Rect &clip);
     void refreshSprite(int sprite_no,
                        bool active_flag,
                        int cell_no,
@@ -729,6 +807,32 @@ class ONScripter : public ScriptParser {
                        SDL_Rect *check_dst_rect);
     void createBackground();
 
+    // ----------------------------------------
+    // variables and methods relevant to texture
+    struct CachedTexture {
+        SDL_Texture *texture = NULL;
+        unsigned int version = 0;  // AnimationInfo::image_version uploaded
+        bool used = false;         // drawn since the last pruning
+    };
+    bool texture_composite_flag;
+    onscripter::UnorderedMap<AnimationInfo *, CachedTexture> texture_cache;
+    // areas shown by compositeTextures() but not yet rendered into
+    // accumulation_surface and texture, all with stale_refresh_mode
+    SDL_Rect stale_rects[MAX_DIRTY_RECTS];
+    int num_stale_rects;
+    int stale_refresh_mode;
+
+    bool canCompositeTextures(int refresh_mode);
+    bool compositeTextures(SDL_Rect *rects, int num_rects, int refresh_mode);
+    bool compositeScene(int refresh_mode);
+    bool drawTaggedTexture(AnimationInfo *anim);
+    bool drawTexture(AnimationInfo *anim, int x, int y);
+    bool shadowTextTexture();
+    SDL_Texture *getAnimationTexture(AnimationInfo *anim);
+    void pruneTextureCache();
+    void clearTextureCache();
+    void syncAccumulationSurface();
+
     // ----------------------------------------
     // variables and methods relevant to rmenu
     bool system_menu_enter_flag;
@@ -891,6 +995,13 @@ class ONScripter : public ScriptParser {
 
     void shiftHalfPixelX(SDL_Surface *surface);
     void shiftHalfPixelY(SDL_Surface *surface);
+    // rasterized glyphs survive page turns, backlog and restoreTextBuffer
+    onscripter::UniquePtr<onscache::GlyphCache> glyphCache;
+    onscripter::UnorderedMap<void *, uint64_t> glyph_font_ids;
+    bool getGlyph(void *font,
+                  unsigned short unicode,
+                  SDL_Surface *base,
+                  onscache::GlyphImage &glyph);
     void drawGlyph(SDL_Surface *dst_surface,
                    _FontInfo *info,
                    SDL_Color &color,
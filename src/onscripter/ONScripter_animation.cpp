@@ -130,8 +130,52 @@ void ONScripter::proceedAnimation(int current_time) {
     }
 }
 
+#ifdef USE_IMAGE_CACHE
+onscripter::String ONScripter::surfaceCacheKey(AnimationInfo *anim,
+                                               const char *file_name) {
+    // everything setupImageAlpha() and loadImage() depend on
+    char buf[64];
+    snprintf(buf,
+             sizeof(buf),
+             "|%d|%d|%02x%02x%02x|%d|%d|%08x|",
+             anim->trans_mode,
+             anim->num_of_cells,
+             anim->direct_color[0],
+             anim->direct_color[1],
+             anim->direct_color[2],
+             anim->load_size ? anim->load_size->x : 0,
+             anim->load_size ? anim->load_size->y : 0,
+             (unsigned int)image_surface->format->format);
+    onscripter::String key = file_name;
+    key += buf;
+    if (anim->trans_mode == AnimationInfo::TRANS_MASK && anim->mask_file_name)
+        key += anim->mask_file_name;
+    return key;
+}
+#endif
+
 SDL_Surface *ONScripter::inlineLoadImage(AnimationInfo *anim,
                                          const char *file_name) {
+#ifdef USE_IMAGE_CACHE
+    // rectangles ('>') are cheaper to build than to copy
+    bool cacheable = file_name && file_name[0] != '>' && file_name[0] != '\0';
+    onscripter::String key;
+    if (cacheable) {
+        key = surfaceCacheKey(anim, file_name);
+        onscache::DecodedImage cached;
+        if (surfaceCache->TryGet(key, cached)) {
+            if (filelog_flag)
+                script_h.findAndAddLog(
+                    script_h.log_info[ScriptHandler::FILE_LOG],
+                    file_name,
+                    true);
+            anim->orig_pos.w = cached.orig_w;
+            anim->orig_pos.h = cached.orig_h;
+            // AnimationInfo draws into its image in place, so hand out a copy
+            return SDL_DuplicateSurface(cached.surface.get());
+        }
+    }
+#endif
     bool has_alpha;
     int location;
     SDL_Surface *_surface1 = nullptr;
@@ -143,6 +187,16 @@ SDL_Surface *ONScripter::inlineLoadImage(AnimationInfo *anim,
     SDL_Surface *alpha_surface =
         anim->setupImageAlpha(_surface1, _surface2, has_alpha);
     if (_surface2) SDL_FreeSurface(_surface2);
+#ifdef USE_IMAGE_CACHE
+    if (cacheable && alpha_surface) {
+        SDL_Surface *copy = SDL_DuplicateSurface(alpha_surface);
+        if (copy)
+            surfaceCache->Put(
+                key,
+                onscache::DecodedImage(
+                    copy, anim->orig_pos.w, anim->orig_pos.h));
+    }
+#endif
     return alpha_surface;
 }
 
@@ -549,7 +603,7 @@ void ONScripter::parseTaggedString(AnimationInfo *anim) {
             tmp->handler->setSpriteInfo(sprite_info, anim);
             anim->duration_list = new int[1];
             anim->duration_list[0] = tmp->interval;
-            anim->next_time = SDL_GetTicks() + tmp->interval;
+            anim->next_time = getTicks() + tmp->interval;
             anim->is_animatable = true;
             utils::printInfo("setup a sprite for layer %d\n", anim->layer_no);
         } else
@@ -585,7 +639,7 @@ void ONScripter::parseTaggedString(AnimationInfo *anim) {
                 for (i = 1; i < anim->num_of_cells; i++)
                     anim->duration_list[i] = anim->duration_list[0];
             }
-            anim->next_time = SDL_GetTicks() + anim->duration_list[0];
+            anim->next_time = getTicks() + anim->duration_list[0];
 
             buffer++;
             anim->loop_mode = *buffer++ - '0';  // 3...no animation
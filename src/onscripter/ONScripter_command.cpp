@@ -127,7 +127,7 @@ int ONScripter::waveCommand() {
 }
 
 int ONScripter::waittimerCommand() {
-    int count = script_h.readInt() + internal_timer - SDL_GetTicks();
+    int count = script_h.readInt() + internal_timer - getTicks();
     if (count < 0) count = 0;
 
     event_mode = WAIT_TIMER_MODE;
@@ -517,6 +517,7 @@ int ONScripter::sp_rgb_gradationCommand() {
     }
 
     SDL_UnlockSurface(surface);
+    ai->imageChanged();
 
     if (ai->visible) dirty_rect.add(ai->pos);
 
@@ -1070,7 +1071,7 @@ int ONScripter::rmodeCommand() {
 }
 
 int ONScripter::resettimerCommand() {
-    internal_timer = SDL_GetTicks();
+    internal_timer = getTicks();
 
     return RET_CONTINUE;
 }
@@ -1120,6 +1121,7 @@ int ONScripter::quakeCommand() {
     tmp_effect.effect = MAX_EFFECT_NUM + quake_type;
 
     dirty_rect.fill(screen_width, screen_height);
+    syncAccumulationSurface();
     SDL_BlitSurface(accumulation_surface, NULL, effect_dst_surface, NULL);
 
     if (setEffect(&tmp_effect)) return RET_CONTINUE;
@@ -1255,6 +1257,7 @@ int ONScripter::playCommand() {
 }
 
 int ONScripter::ofscopyCommand() {
+    syncAccumulationSurface();
     SDL_Surface *tmp_surface = AnimationInfo::alloc32bitSurface(
         render_view_rect.w, render_view_rect.h, texture_format);
     SDL_LockSurface(tmp_surface);
@@ -1368,7 +1371,7 @@ int ONScripter::mp3stopCommand() {
         // do a bgm fadeout
         Mix_HookMusicFinished(NULL);
         mp3fadeout_duration_internal = mp3fadeout_duration;
-        mp3fade_start = SDL_GetTicks();
+        mp3fade_start = getTicks();
         timer_bgmfade_id = SDL_AddTimer(20, bgmfadeCallback, 0);
         setStr(&fadeout_music_file_name, music_file_name);
 
@@ -1462,7 +1465,7 @@ int ONScripter::mp3Command() {
         if (mp3fadein_duration > 0) {
             // do a bgm fadein
             mp3fadein_duration_internal = mp3fadein_duration;
-            mp3fade_start = SDL_GetTicks();
+            mp3fade_start = getTicks();
             timer_bgmfade_id =
                 SDL_AddTimer(20, bgmfadeCallback, (void *)&timer_bgmfade_id);
 
@@ -2085,7 +2088,7 @@ int ONScripter::gettimerCommand() {
 
     if (gettimer_flag) {
         script_h.setInt(&script_h.current_variable,
-                        SDL_GetTicks() - internal_timer);
+                        getTicks() - internal_timer);
     } else {
         script_h.setInt(&script_h.current_variable, btnwait_time);
     }
@@ -2280,6 +2283,7 @@ int ONScripter::getscreenshotCommand() {
                              screenshot_surface->pitch);
         SDL_UnlockSurface(screenshot_surface);
     } else {
+        syncAccumulationSurface();
         SDL_BlitSurface(
             accumulation_surface, nullptr, screenshot_surface, nullptr);
     }
@@ -2635,6 +2639,7 @@ int ONScripter::flushoutCommand() {
     tmp_effect.effect = MAX_EFFECT_NUM + 3;
 
     dirty_rect.fill(screen_width, screen_height);
+    syncAccumulationSurface();
 
     if (setEffect(&tmp_effect)) return RET_CONTINUE;
 
@@ -2867,6 +2872,7 @@ int ONScripter::dvCommand() {
 }
 
 int ONScripter::drawtextCommand() {
+    syncAccumulationSurface();
     SDL_Rect clip;
     clip.x = clip.y = 0;
     clip.w = accumulation_surface->w;
@@ -2877,6 +2883,7 @@ int ONScripter::drawtextCommand() {
 }
 
 int ONScripter::drawsp3Command() {
+    syncAccumulationSurface();
     int sprite_no = script_h.readInt();
     int cell_no = script_h.readInt();
     int alpha = script_h.readInt();
@@ -2908,6 +2915,7 @@ int ONScripter::drawsp3Command() {
 }
 
 int ONScripter::drawsp2Command() {
+    syncAccumulationSurface();
     int sprite_no = script_h.readInt();
     int cell_no = script_h.readInt();
     int alpha = script_h.readInt();
@@ -2929,6 +2937,7 @@ int ONScripter::drawsp2Command() {
 }
 
 int ONScripter::drawspCommand() {
+    syncAccumulationSurface();
     int sprite_no = script_h.readInt();
     int cell_no = script_h.readInt();
     int alpha = script_h.readInt();
@@ -2949,6 +2958,7 @@ int ONScripter::drawspCommand() {
 }
 
 int ONScripter::drawfillCommand() {
+    syncAccumulationSurface();
     int r = script_h.readInt();
     int g = script_h.readInt();
     int b = script_h.readInt();
@@ -2961,6 +2971,7 @@ int ONScripter::drawfillCommand() {
 }
 
 int ONScripter::drawclearCommand() {
+    syncAccumulationSurface();
     SDL_FillRect(accumulation_surface,
                  NULL,
                  SDL_MapRGBA(accumulation_surface->format, 0, 0, 0, 0xff));
@@ -2969,6 +2980,7 @@ int ONScripter::drawclearCommand() {
 }
 
 int ONScripter::drawbgCommand() {
+    syncAccumulationSurface();
     SDL_Rect clip;
     clip.x = clip.y = 0;
     clip.w = accumulation_surface->w;
@@ -2980,6 +2992,7 @@ int ONScripter::drawbgCommand() {
 }
 
 int ONScripter::drawbg2Command() {
+    syncAccumulationSurface();
     AnimationInfo bi = bg_info;
     bi.orig_pos.x = calcUserRatio(script_h.readInt());
     bi.orig_pos.y = calcUserRatio(script_h.readInt());
@@ -3379,7 +3392,7 @@ int ONScripter::btnwaitCommand() {
             // if ( usewheel_flag ) current_button_state.button = -5;
             // else                 current_button_state.button = -2;
         }
-        internal_button_timer = SDL_GetTicks();
+        internal_button_timer = getTicks();
 
         if (textbtn_flag) {
             event_mode |= WAIT_INPUT_MODE;
@@ -3405,7 +3418,7 @@ int ONScripter::btnwaitCommand() {
         skip_mode &= ~SKIP_TO_EOL;
     }
 
-    btnwait_time = SDL_GetTicks() - internal_button_timer;
+    btnwait_time = getTicks() - internal_button_timer;
     num_chars_in_sentence = 0;
 
     if (bexec_flag) {
@@ -4038,6 +4051,7 @@ void ONScripter::NSDPresentRectCommand(int x1, int y1, int x2, int y2) {
     clip.h = accumulation_surface->h;
     if (AnimationInfo::doClipping(&clip, &clip_src)) return;
 
+    syncAccumulationSurface();
     for (int i = MAX_TEXTURE_NUM - 1; i > 0; i--)
         if (texture_info[i].image_surface && texture_info[i].visible)
             drawTaggedSurface(accumulation_surface, &texture_info[i], clip);
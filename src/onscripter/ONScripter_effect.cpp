@@ -51,6 +51,7 @@ bool ONScripter::setEffect(EffectLink *effect) {
     if (effect_cut_flag && (skip_mode & SKIP_NORMAL || ctrl_pressed_status))
         effect_no = 1;
 
+    syncAccumulationSurface();
     SDL_BlitSurface(accumulation_surface, NULL, effect_src_surface, NULL);
 
     generateEffectDst(effect_no);
@@ -107,12 +108,13 @@ bool ONScripter::setEffect(EffectLink *effect) {
 }
 
 bool ONScripter::doEffect(EffectLink *effect, bool clear_dirty_region) {
-    effect_start_time = SDL_GetTicks();
-    if (effect_counter == 0) effect_start_time_old = effect_start_time - 1;
-    // utils::printInfo("effect_counter %d timer between %d
-    // %d\n",effect_counter,effect_start_time,effect_start_time_old);
-    effect_timer_resolution = effect_start_time - effect_start_time_old;
-    effect_start_time_old = effect_start_time;
+    // each frame moves the effect on to the refresh slot it is shown in
+    if (effect_counter == 0) {
+        frame_pacer.start(getPreciseTicks());
+        effect_timer_resolution = 1;
+    } else {
+        effect_timer_resolution = frame_pacer.advance(getPreciseTicks());
+    }
 
     int effect_no = effect->effect;
     if (effect_cut_flag && (skip_mode & SKIP_NORMAL || ctrl_pressed_status))
@@ -507,8 +509,10 @@ bool ONScripter::doEffect(EffectLink *effect, bool clear_dirty_region) {
 
     effect_counter += effect_timer_resolution;
 
+    double show_time = frame_pacer.composed(getPreciseTicks());
     event_mode = WAIT_INPUT_MODE;
     waitEvent(0);
+    waitPreciseTicks(show_time);
     if (!((automode_flag || autoclick_time > 0) ||
           (usewheel_flag && current_button_state.button == -5) ||
           (!usewheel_flag && current_button_state.button == -2))) {
@@ -516,7 +520,10 @@ bool ONScripter::doEffect(EffectLink *effect, bool clear_dirty_region) {
     }
 
     if (effect_counter < effect_duration && effect_no != 1) {
-        if (effect_no != 0) flush(REFRESH_NONE_MODE, NULL, false);
+        if (effect_no != 0) {
+            flush(REFRESH_NONE_MODE, NULL, false);
+            frame_pacer.presented(getPreciseTicks());
+        }
 
         return true;
     } else {
@@ -525,7 +532,10 @@ bool ONScripter::doEffect(EffectLink *effect, bool clear_dirty_region) {
                         accumulation_surface,
                         &dirty_rect.bounding_box);
 
-        if (effect_no != 0) flush(REFRESH_NONE_MODE, NULL, clear_dirty_region);
+        if (effect_no != 0) {
+            flush(REFRESH_NONE_MODE, NULL, clear_dirty_region);
+            frame_pacer.presented(getPreciseTicks());
+        }
         if (effect_no == 1) effect_counter = 0;
         skip_mode &= ~SKIP_TO_EOL;
 
@@ -536,6 +546,16 @@ bool ONScripter::doEffect(EffectLink *effect, bool clear_dirty_region) {
     }
 }
 
+// SDL timers keep to the ms, so sleep while a few ms are left and spin on
+// the performance counter for the rest
+void ONScripter::waitPreciseTicks(double until) {
+    if (headless_flag) return;
+    double left;
+    while ((left = until - getPreciseTicks()) > 2) SDL_Delay((Uint32)left - 1);
+    while (getPreciseTicks() < until)
+        ;
+}
+
 void ONScripter::drawEffect(SDL_Rect *dst_rect,
                             SDL_Rect *src_rect,
                             SDL_Surface *surface) {
@@ -26,7 +26,10 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <algorithm>
+
 #include "ONScripter.h"
+#include "Parallel.h"
 
 #define BREAKUP_CELLWIDTH 24
 #define BREAKUP_CELLFORMS 16
@@ -39,6 +42,12 @@
 #define BREAKUP_MOVE_FRAMES 40
 #define BREAKUP_STILL_STATE (BREAKUP_CELLFORMS - BREAKUP_CELLWIDTH / 2)
 
+// a row of a cell as bits, bit j standing for column j
+#define BREAKUP_CELL_BITS ((Uint32)((1 << BREAKUP_CELLWIDTH) - 1))
+// the cellform after the last radius covers the whole cell
+#define BREAKUP_FULL_FORM BREAKUP_CELLFORMS
+#define BREAKUP_NO_FORM 0xff
+
 #define BREAKUP_MODE_LOWER 1
 #define BREAKUP_MODE_LEFT 2
 #define BREAKUP_MODE_PILEUP 4
@@ -50,93 +59,160 @@ int n_cells, tot_frames, last_frame;
 int breakup_mode;
 SDL_Rect breakup_window;  // window of _cells_, not pixels
 
+// bits of the columns from j0 up to j1 of a cell row
+static Uint32 breakupSpan(int j0, int j1) {
+    if (j0 < 0) j0 = 0;
+    if (j1 > BREAKUP_CELLWIDTH) j1 = BREAKUP_CELLWIDTH;
+    if (j0 >= j1) return 0;
+    return ((1u << j1) - 1) & ~((1u << j0) - 1);
+}
+
+// copies the pixels of a cell row whose bits are set, a run of set bits
+// at a time; the row starts at src_x in src and lands at dst_x in dst
+static void copyBreakupSpans(const ONScripter::ONSBuf *src,
+                             int src_x,
+                             ONScripter::ONSBuf *dst,
+                             int dst_x,
+                             Uint32 bits) {
+    if (bits == BREAKUP_CELL_BITS) {
+        memcpy(dst + dst_x,
+               src + src_x,
+               BREAKUP_CELLWIDTH * sizeof(ONScripter::ONSBuf));
+        return;
+    }
+    for (int j = 0; bits >> j;) {
+        if (!((bits >> j) & 1)) {
+            j++;
+            continue;
+        }
+        int k = j + 1;
+        while ((bits >> k) & 1) k++;
+        memcpy(dst + dst_x + j,
+               src + src_x + j,
+               (k - j) * sizeof(ONScripter::ONSBuf));
+        j = k;
+    }
+}
+
 void ONScripter::buildBreakupCellforms() {
-    // build the 32x32 mask for each cellform
+    // build the 24x24 mask for each cellform, a word of bits per row
     if (breakup_cellforms) return;
 
-    int w = BREAKUP_CELLWIDTH * BREAKUP_CELLFORMS;
-    int h = BREAKUP_CELLWIDTH;
-    breakup_cellforms = new bool[w * h];
+    breakup_cellforms =
+        new Uint32[(BREAKUP_CELLFORMS + 1) * BREAKUP_CELLWIDTH];
+    Uint32 *form = breakup_cellforms;
 
     for (int n = 0, rad2 = 1; n < BREAKUP_CELLFORMS;
          n++, rad2 = (n + 1) * (n + 1)) {
-        for (int x = 0, xd = -BREAKUP_CELLWIDTH / 2; x < BREAKUP_CELLWIDTH;
-             x++, xd++) {
-            for (int y = 0, yd = -BREAKUP_CELLWIDTH / 2; y < BREAKUP_CELLWIDTH;
-                 y++, yd++) {
+        for (int y = 0, yd = -BREAKUP_CELLWIDTH / 2; y < BREAKUP_CELLWIDTH;
+             y++, yd++, form++) {
+            *form = 0;
+            for (int x = 0, xd = -BREAKUP_CELLWIDTH / 2;
+                 x < BREAKUP_CELLWIDTH;
+                 x++, xd++) {
                 if (((xd * xd + xd + yd * yd + yd) * 2 + 1) < 2 * rad2)
-                    breakup_cellforms[y * w + n * BREAKUP_CELLWIDTH + x] = true;
-                else
-                    breakup_cellforms[y * w + n * BREAKUP_CELLWIDTH + x] =
-                        false;
+                    *form |= 1u << x;
             }
         }
     }
+    for (int y = 0; y < BREAKUP_CELLWIDTH; y++, form++)
+        *form = BREAKUP_CELL_BITS;
 }
 
 void ONScripter::buildBreakupMask() {
-    // build the cell area mask for the breakup effect
-    int w = BREAKUP_CELLWIDTH * BREAKUP_MAX_CELL_X;
+    // build the cell area mask for the breakup effect, a word of bits per
+    // row of each cell
+    int n_cell_x = BREAKUP_MAX_CELL_X;
+    int w = BREAKUP_CELLWIDTH * n_cell_x;
     int h = BREAKUP_CELLWIDTH * BREAKUP_MAX_CELL_Y;
     if (!breakup_mask) {
-        breakup_mask = new bool[w * h];
+        breakup_mask = new Uint32[n_cell_x * h];
     }
 
+    // a pixel is in the mask when a channel differs by more than 8
+    struct Masker {
+        const ONSBuf *buffer1, *buffer2;
+        Uint32 *mask;
+        const SDL_PixelFormat *fmt;
+        int surf_w, surf_h, n_cell_x;
+
+        static bool differs(ONSBuf pix1,
+                            ONSBuf pix2,
+                            Uint32 cmask,
+                            Uint8 shift,
+                            Uint8 loss) {
+            int pix1c = ((pix1 & cmask) >> shift) << loss;
+            int pix2c = ((pix2 & cmask) >> shift) << loss;
+            return abs(pix1c - pix2c) > 8;
+        }
+
+        void operator()(const int i) const {
+            Uint32 *mask_row = mask + i * n_cell_x;
+            if (i >= surf_h) {
+                memset(mask_row, 0, n_cell_x * sizeof(Uint32));
+                return;
+            }
+            const ONSBuf *row1 = buffer1 + i * surf_w;
+            const ONSBuf *row2 = buffer2 + i * surf_w;
+            for (int cx = 0; cx < n_cell_x; cx++) {
+                Uint32 bits = 0;
+                for (int j = 0, x = cx * BREAKUP_CELLWIDTH;
+                     j < BREAKUP_CELLWIDTH && x < surf_w;
+                     j++, x++) {
+                    ONSBuf pix1 = row1[x], pix2 = row2[x];
+                    if (differs(
+                            pix1, pix2, fmt->Bmask, fmt->Bshift, fmt->Bloss) ||
+                        differs(
+                            pix1, pix2, fmt->Gmask, fmt->Gshift, fmt->Gloss) ||
+                        differs(
+                            pix1, pix2, fmt->Rmask, fmt->Rshift, fmt->Rloss) ||
+                        differs(
+                            pix1, pix2, fmt->Amask, fmt->Ashift, fmt->Aloss))
+                        bits |= 1u << j;
+                }
+                mask_row[cx] = bits;
+            }
+        }
+    };
+
     SDL_LockSurface(effect_src_surface);
     SDL_LockSurface(effect_dst_surface);
-    ONSBuf *buffer1 = (ONSBuf *)effect_src_surface->pixels;
-    ONSBuf *buffer2 = (ONSBuf *)effect_dst_surface->pixels;
-    SDL_PixelFormat *fmt = effect_dst_surface->format;
     int surf_w = effect_src_surface->w;
     int surf_h = effect_src_surface->h;
+    Masker masker = {(ONSBuf *)effect_src_surface->pixels,
+                     (ONSBuf *)effect_dst_surface->pixels,
+                     breakup_mask,
+                     effect_dst_surface->format,
+                     surf_w,
+                     surf_h,
+                     n_cell_x};
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+    parallel::For(0, h, 1, masker, w * h);
+#else
+    for (int i = 0; i < h; i++) masker(i);
+#endif
+    SDL_UnlockSurface(effect_dst_surface);
+    SDL_UnlockSurface(effect_src_surface);
+
+    // bounds of the changed pixels, from the first and last bits of a row
     int x1 = w, y1 = -1, x2 = 0, y2 = 0;
     for (int i = 0; i < h; ++i) {
-        for (int j = 0; j < w; ++j) {
-            if ((j >= surf_w) || (i >= surf_h)) {
-                breakup_mask[i * w + j] = false;
-                continue;
-            }
-            ONSBuf pix1 = buffer1[i * surf_w + j];
-            ONSBuf pix2 = buffer2[i * surf_w + j];
-            int pix1c = ((pix1 & fmt->Bmask) >> fmt->Bshift) << fmt->Bloss;
-            int pix2c = ((pix2 & fmt->Bmask) >> fmt->Bshift) << fmt->Bloss;
-            breakup_mask[i * w + j] = true;
-            if (abs(pix1c - pix2c) > 8) {
-                if (y1 < 0) y1 = i;
-                if (j < x1) x1 = j;
-                if (j > x2) x2 = j;
-                y2 = i;
-                continue;
-            }
-            pix1c = ((pix1 & fmt->Gmask) >> fmt->Gshift) << fmt->Gloss;
-            pix2c = ((pix2 & fmt->Gmask) >> fmt->Gshift) << fmt->Gloss;
-            if (abs(pix1c - pix2c) > 8) {
-                if (y1 < 0) y1 = i;
-                if (j < x1) x1 = j;
-                if (j > x2) x2 = j;
-                y2 = i;
-                continue;
-            }
-            pix1c = ((pix1 & fmt->Rmask) >> fmt->Rshift) << fmt->Rloss;
-            pix2c = ((pix2 & fmt->Rmask) >> fmt->Rshift) << fmt->Rloss;
-            if (abs(pix1c - pix2c) > 8) {
-                if (y1 < 0) y1 = i;
-                if (j < x1) x1 = j;
-                if (j > x2) x2 = j;
-                y2 = i;
-                continue;
-            }
-            pix1c = ((pix1 & fmt->Amask) >> fmt->Ashift) << fmt->Aloss;
-            pix2c = ((pix2 & fmt->Amask) >> fmt->Ashift) << fmt->Aloss;
-            if (abs(pix1c - pix2c) > 8) {
-                if (y1 < 0) y1 = i;
-                if (j < x1) x1 = j;
-                if (j > x2) x2 = j;
-                y2 = i;
-                continue;
-            }
-            breakup_mask[i * w + j] = false;
-        }
+        const Uint32 *mask_row = breakup_mask + i * n_cell_x;
+        int first = 0, last = n_cell_x - 1;
+        while (first < n_cell_x && !mask_row[first]) first++;
+        if (first == n_cell_x) continue;
+        while (!mask_row[last]) last--;
+
+        int j = 0;
+        while (!((mask_row[first] >> j) & 1)) j++;
+        if (first * BREAKUP_CELLWIDTH + j < x1)
+            x1 = first * BREAKUP_CELLWIDTH + j;
+        j = BREAKUP_CELLWIDTH - 1;
+        while (!((mask_row[last] >> j) & 1)) j--;
+        if (last * BREAKUP_CELLWIDTH + j > x2)
+            x2 = last * BREAKUP_CELLWIDTH + j;
+        if (y1 < 0) y1 = i;
+        y2 = i;
     }
     if (breakup_mode & BREAKUP_MODE_LEFT)
         x1 = 0;
@@ -150,9 +226,6 @@ void ONScripter::buildBreakupMask() {
     breakup_window.y = y1 / BREAKUP_CELLWIDTH;
     breakup_window.w = x2 / BREAKUP_CELLWIDTH - breakup_window.x + 1;
     breakup_window.h = y2 / BREAKUP_CELLWIDTH - breakup_window.y + 1;
-
-    SDL_UnlockSurface(effect_dst_surface);
-    SDL_UnlockSurface(effect_src_surface);
 }
 
 void ONScripter::initBreakup(char *params) {
@@ -257,82 +330,131 @@ void ONScripter::effectBreakup(char *params, int duration) {
         y_dir = -y_dir;
     }
 
+    // the cells still in place are drawn by rows of cells, each cell row
+    // clipped to both surfaces once
+    struct Settler {
+        const ONSBuf *chr_buf;
+        ONSBuf *buffer;
+        const Uint32 *cellforms, *mask;
+        const Uint8 *forms;
+        SDL_Rect window;
+        int n_cell_x, chr_w, dst_w, clip_w, clip_h;
+
+        void operator()(const int k) const {
+            const Uint8 *form_row = forms + k * window.w;
+            int y0 = (window.y + k) * BREAKUP_CELLWIDTH;
+            for (int i = 0; i < BREAKUP_CELLWIDTH && y0 + i < clip_h; ++i) {
+                int y = y0 + i;
+                const Uint32 *mask_row = mask + y * n_cell_x;
+                for (int l = 0; l < window.w; ++l) {
+                    if (form_row[l] == BREAKUP_NO_FORM) continue;
+                    int cell_x = window.x + l;
+                    int x = cell_x * BREAKUP_CELLWIDTH;
+                    const Uint32 *form =
+                        cellforms + form_row[l] * BREAKUP_CELLWIDTH;
+                    Uint32 bits = form[i] & mask_row[cell_x] &
+                                  breakupSpan(0, clip_w - x);
+                    if (bits)
+                        copyBreakupSpans(chr_buf + y * chr_w,
+                                         x,
+                                         buffer + y * dst_w,
+                                         x,
+                                         bits);
+                }
+            }
+        }
+    };
+
     SDL_LockSurface(chr);
     SDL_LockSurface(dst);
     ONSBuf *chr_buf = (ONSBuf *)chr->pixels;
     ONSBuf *buffer = (ONSBuf *)dst->pixels;
-    bool *msk_buf = breakup_cellforms;
+    int n_cell_x = BREAKUP_MAX_CELL_X;
 
+    // the form of each cell in the window this frame; moving cells are
+    // left out, they are drawn over the others afterwards
+    onscripter::Vector<Uint8> forms(breakup_window.w * breakup_window.h,
+                                    BREAKUP_NO_FORM);
     for (int n = 0; n < n_cells; ++n) {
-        SDL_Rect rect;
-        rect.x = breakup_cells[n].cell_x * BREAKUP_CELLWIDTH;
-        rect.y = breakup_cells[n].cell_y * BREAKUP_CELLWIDTH;
-        rect.w = BREAKUP_CELLWIDTH;
-        rect.h = BREAKUP_CELLWIDTH;
-        breakup_cells[n].state += frame_diff;
-        if (breakup_cells[n].state >=
-            (BREAKUP_MOVE_FRAMES + BREAKUP_STILL_STATE)) {
-            for (int i = 0; i < BREAKUP_CELLWIDTH; ++i) {
-                for (int j = 0; j < BREAKUP_CELLWIDTH; ++j) {
-                    int x = rect.x + j;
-                    int y = rect.y + i;
-                    if ((x < 0) || (x >= dst->w) || (x >= chr->w) || (y < 0) ||
-                        (y >= dst->h) || (y >= chr->h))
-                        continue;
-                    if (breakup_mask[y * BREAKUP_CELLWIDTH *
-                                         BREAKUP_MAX_CELL_X +
-                                     x])
-                        buffer[y * dst->w + x] = chr_buf[y * chr->w + x];
-                }
-            }
-        } else if (breakup_cells[n].state >= BREAKUP_MOVE_FRAMES) {
-            breakup_cells[n].radius =
-                breakup_cells[n].state - (BREAKUP_MOVE_FRAMES * 3 / 4) + 1;
-            for (int i = 0; i < BREAKUP_CELLWIDTH; i++) {
-                for (int j = 0; j < BREAKUP_CELLWIDTH; j++) {
-                    int x = rect.x + j;
-                    int y = rect.y + i;
-                    if ((x < 0) || (x >= dst->w) || (x >= chr->w) || (y < 0) ||
-                        (y >= dst->h) || (y >= chr->h))
-                        continue;
-                    int msk_off = BREAKUP_CELLWIDTH * breakup_cells[n].radius;
-                    if (msk_buf[BREAKUP_CELLWIDTH * BREAKUP_CELLFORMS * i +
-                                msk_off + j] &&
-                        breakup_mask[y * BREAKUP_CELLWIDTH *
-                                         BREAKUP_MAX_CELL_X +
-                                     x])
-                        buffer[y * dst->w + x] = chr_buf[y * chr->w + x];
-                }
-            }
-        } else if (breakup_cells[n].state >= 0) {
-            int state = breakup_cells[n].state;
-            int disp_x = x_dir * breakup_disp_x[breakup_cells[n].dir] *
-                         (state - BREAKUP_MOVE_FRAMES);
-            int disp_y = y_dir * breakup_disp_y[breakup_cells[n].dir] *
-                         (BREAKUP_MOVE_FRAMES - state);
+        BreakupCell &cell = breakup_cells[n];
+        Uint8 form = BREAKUP_NO_FORM;
+        cell.state += frame_diff;
+        if (cell.state >= (BREAKUP_MOVE_FRAMES + BREAKUP_STILL_STATE)) {
+            form = BREAKUP_FULL_FORM;
+        } else if (cell.state >= BREAKUP_MOVE_FRAMES) {
+            cell.radius = cell.state - (BREAKUP_MOVE_FRAMES * 3 / 4) + 1;
+            form = cell.radius;
+        } else if (cell.state >= 0) {
+            cell.radius = 0;
+            if (cell.state >= (BREAKUP_MOVE_FRAMES / 2))
+                cell.radius =
+                    (cell.state / 2) - (BREAKUP_MOVE_FRAMES / 4) + 1;
+        }
+        forms[(cell.cell_y - breakup_window.y) * breakup_window.w +
+              cell.cell_x - breakup_window.x] = form;
+    }
 
-            breakup_cells[n].radius = 0;
-            if (breakup_cells[n].state >= (BREAKUP_MOVE_FRAMES / 2))
-                breakup_cells[n].radius = (breakup_cells[n].state / 2) -
-                                          (BREAKUP_MOVE_FRAMES / 4) + 1;
-            for (int i = 0; i < BREAKUP_CELLWIDTH; i++) {
-                for (int j = 0; j < BREAKUP_CELLWIDTH; j++) {
-                    int x = disp_x + rect.x + j;
-                    int y = disp_y + rect.y + i;
-                    if ((x < 0) || (x >= dst->w) || (y < 0) || (y >= dst->h))
-                        continue;
-                    if (((rect.x + j) < 0) || ((rect.x + j) >= chr->w) ||
-                        ((rect.y + i) < 0) || ((rect.y + i) >= chr->h))
-                        continue;
-                    int msk_off = BREAKUP_CELLWIDTH * breakup_cells[n].radius;
-                    if (msk_buf[BREAKUP_CELLWIDTH * BREAKUP_CELLFORMS * i +
-                                msk_off + j] &&
-                        breakup_mask[(rect.y + i) * BREAKUP_CELLWIDTH *
-                                         BREAKUP_MAX_CELL_X +
-                                     rect.x + j])
-                        buffer[y * dst->w + x] =
-                            chr_buf[(rect.y + i) * chr->w + rect.x + j];
-                }
+    Settler settler = {chr_buf,
+                       buffer,
+                       breakup_cellforms,
+                       breakup_mask,
+                       forms.data(),
+                       breakup_window,
+                       n_cell_x,
+                       chr->w,
+                       dst->w,
+                       std::min(dst->w, chr->w),
+                       std::min(dst->h, chr->h)};
+
+    // Moving cells fly over the others, so they are drawn one by one in
+    // cell order. The states fall along the cell order (rise when piling
+    // up), so all moving cells come before the ones in place (after them
+    // when piling up), and this draws the same as a single pass would.
+    bool pileup = breakup_mode & BREAKUP_MODE_PILEUP;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == (pileup ? 0 : 1)) {
+#if defined(USE_PARALLEL) || defined(USE_OMP_PARALLEL)
+            parallel::For(0,
+                          breakup_window.h,
+                          1,
+                          settler,
+                          n_cells * BREAKUP_CELLWIDTH * BREAKUP_CELLWIDTH);
+#else
+            for (int k = 0; k < breakup_window.h; k++) settler(k);
+#endif
+            continue;
+        }
+
+        for (int n = 0; n < n_cells; ++n) {
+            const BreakupCell &cell = breakup_cells[n];
+            if (cell.state < 0 || cell.state >= BREAKUP_MOVE_FRAMES) continue;
+            int disp_x = x_dir * breakup_disp_x[cell.dir] *
+                         (cell.state - BREAKUP_MOVE_FRAMES);
+            int disp_y = y_dir * breakup_disp_y[cell.dir] *
+                         (BREAKUP_MOVE_FRAMES - cell.state);
+            int x = cell.cell_x * BREAKUP_CELLWIDTH;
+            int y = cell.cell_y * BREAKUP_CELLWIDTH;
+
+            // clip once: taken from inside chr, put inside dst
+            Uint32 span = breakupSpan(-x, chr->w - x) &
+                          breakupSpan(-x - disp_x, dst->w - x - disp_x);
+            int i0 = std::max(0, -y - disp_y);
+            int i1 = std::min(chr->h - y, dst->h - y - disp_y);
+            if (i1 > BREAKUP_CELLWIDTH) i1 = BREAKUP_CELLWIDTH;
+            if (!span) continue;
+
+            const Uint32 *form =
+                breakup_cellforms + cell.radius * BREAKUP_CELLWIDTH;
+            for (int i = i0; i < i1; i++) {
+                Uint32 bits =
+                    form[i] & breakup_mask[(y + i) * n_cell_x + cell.cell_x] &
+                    span;
+                if (bits)
+                    copyBreakupSpans(chr_buf + (y + i) * chr->w,
+                                     x,
+                                     buffer + (y + i + disp_y) * dst->w,
+                                     x + disp_x,
+                                     bits);
             }
         }
     }
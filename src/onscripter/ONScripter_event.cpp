@@ -283,7 +283,7 @@ void ONScripter::flushEventSub(SDL_Event &event) {
             cur_fade_duration = 0;
             Mix_VolumeMusic(0);
         }
-        Uint32 tmp = SDL_GetTicks() - mp3fade_start;
+        Uint32 tmp = getTicks() - mp3fade_start;
         if (tmp < cur_fade_duration) {
             tmp = cur_fade_duration - tmp;
             tmp *= music_volume;
@@ -311,7 +311,7 @@ void ONScripter::flushEventSub(SDL_Event &event) {
             cur_fade_duration = 0;
             Mix_VolumeMusic(music_volume * MIX_MAX_VOLUME / 100);
         }
-        Uint32 tmp = SDL_GetTicks() - mp3fade_start;
+        Uint32 tmp = getTicks() - mp3fade_start;
         if (tmp < cur_fade_duration) {
             tmp *= music_volume;
             tmp /= cur_fade_duration;
@@ -385,7 +385,10 @@ void ONScripter::waitEventSub(int count) {
 }
 
 bool ONScripter::waitEvent(int count) {
-    if (count > 0) count += SDL_GetTicks();
+    if (count > 0)
+        count += getTicks();
+    else if (count == 0 && headless_flag)
+        virtual_ticks += HEADLESS_FRAME_TIME;
 
     while (1) {
         waitEventSub(count);
@@ -1179,7 +1182,7 @@ bool ONScripter::keyPressEvent(SDL_KeyboardEvent *event) {
 }
 
 void ONScripter::timerEvent(bool init_flag) {
-    int current_time = SDL_GetTicks();
+    int current_time = getTicks();
     int remaining_time = next_time;
     if (next_time > 0) {
         remaining_time -= current_time;
@@ -1213,14 +1216,51 @@ void ONScripter::timerEvent(bool init_flag) {
         if (duration > remaining_time && remaining_time > 0)
             duration = remaining_time;
 
-        if (timer_id) SDL_RemoveTimer(timer_id);
-        timer_id = SDL_AddTimer(duration, timerCallback, NULL);
+        startTimer(duration);
     } else if (remaining_time > 0) {
-        if (timer_id) SDL_RemoveTimer(timer_id);
-        timer_id = SDL_AddTimer(remaining_time, timerCallback, NULL);
+        startTimer(remaining_time);
     }
 }
 
+void ONScripter::startTimer(Uint32 duration) {
+    if (headless_flag) {
+        virtual_timer_due = virtual_ticks + duration;
+        return;
+    }
+    if (timer_id) SDL_RemoveTimer(timer_id);
+    timer_id = SDL_AddTimer(duration, timerCallback, NULL);
+}
+
+// Nothing in a headless run waits for real time: when the queue is empty
+// the virtual clock jumps to the pending timer or to the next traced input,
+// whichever comes first. A run that waits for input the trace does not
+// have is over.
+bool ONScripter::waitHeadlessEvent(SDL_Event &event) {
+    if (SDL_PollEvent(&event)) return true;
+
+    bool input_flag = replay_trace && !replay_trace->empty();
+    Uint32 input_time =
+        input_flag ? replay_input_time + replay_trace->nextDelay() : 0;
+    if (virtual_timer_due >= 0 &&
+        (!input_flag || (Uint32)virtual_timer_due <= input_time)) {
+        if (virtual_ticks < (Uint32)virtual_timer_due)
+            virtual_ticks = virtual_timer_due;
+        virtual_timer_due = -1;
+        event.type = ONS_TIMER_EVENT;
+        return true;
+    }
+
+    if (input_flag) {
+        if (virtual_ticks < input_time) virtual_ticks = input_time;
+        replay_input_time = virtual_ticks;
+        event = replay_trace->pop();
+    } else {
+        utils::printInfo("replay: no more input at %u ms\n", virtual_ticks);
+        event.type = SDL_QUIT;
+    }
+    return true;
+}
+
 #if (defined(IOS) || defined(ANDROID) || defined(WINRT))
 // TODO: �������Ҽ�ģ��
 SDL_MouseWheelEvent transTouchKey(SDL_TouchFingerEvent &finger) {
@@ -1260,7 +1300,7 @@ bool ONScripter::convTouchKey(SDL_TouchFingerEvent &finger) {
 void ONScripter::runEventLoop() {
     SDL_Event event, tmp_event;
 
-    while (SDL_WaitEvent(&event)) {
+    while (headless_flag ? waitHeadlessEvent(event) : SDL_WaitEvent(&event)) {
 #if defined(USE_SMPEG)
         // required to repeat the movie
         if (layer_smpeg_sample) SMPEG_status(layer_smpeg_sample);
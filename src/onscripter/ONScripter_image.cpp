@@ -156,26 +156,49 @@ SDL_Surface *ONScripter::createRectangleSurface(const char *filename,
     return tmp;
 }
 
-SDL_Surface *ONScripter::createSurfaceFromFile(const char *_filename,
+SDL_Surface *ONScripter::createSurfaceFromFile(const char *filename,
                                                bool *has_alpha,
                                                int *location,
                                                const SDL_Point *load_size) {
+    SDL_Surface *tmp = NULL;
+    ImagePrefetcher::Image image;
+    if (!load_size && image_prefetcher &&
+        image_prefetcher->take(filename, image)) {
+        tmp = image.surface;
+        if (has_alpha) *has_alpha = image.has_alpha;
+        if (location) *location = image.location;
+    } else {
+        tmp = readImageFile(filename, has_alpha, location, load_size, false);
+    }
+
+    if (tmp && filelog_flag)
+        script_h.findAndAddLog(
+            script_h.log_info[ScriptHandler::FILE_LOG], filename, true);
+    return tmp;
+}
+
+// does not touch the script state, so it is also run by the prefetch workers
+SDL_Surface *ONScripter::readImageFile(const char *_filename,
+                                       bool *has_alpha,
+                                       int *location,
+                                       const SDL_Point *load_size,
+                                       bool quiet) {
     onscripter::String filename = _filename;
     onscripter::SharedPtr<onscripter::Vector<uint8_t>> buffer = nullptr;
+    BaseReader::FileView view;
 #ifdef USE_IMAGE_CACHE
-    if (!load_size && imageBufferCache->Cached(filename)) {
-        buffer = imageBufferCache->Get(filename);
-    }
+    if (!load_size) imageBufferCache->TryGet(filename, buffer);
 #endif
-    if (buffer == nullptr) {
+    if (buffer == nullptr &&
+        script_h.cBR->getFileView(filename.c_str(), view, location)) {
+        // uncompressed archive entry, decode straight from the mapping
+    } else if (buffer == nullptr) {
         unsigned long length = script_h.cBR->getFileLength(filename.c_str());
         if (length == 0) {
-            utils::printError(" *** can't find file [%s] ***\n", _filename);
+            if (!quiet)
+                utils::printError(" *** can't find file [%s] ***\n", _filename);
             return NULL;
         }
-        if (filelog_flag)
-            script_h.findAndAddLog(
-                script_h.log_info[ScriptHandler::FILE_LOG], _filename, true);
         buffer = onscripter::MakeShared<onscripter::Vector<uint8_t>>();
         buffer->resize(length);
         script_h.cBR->getFile(filename.c_str(), buffer->data(), location);
@@ -185,7 +208,9 @@ SDL_Surface *ONScripter::createSurfaceFromFile(const char *_filename,
         }
 #endif
     }
-    SDL_RWops *src = SDL_RWFromMem(buffer->data(), buffer->size());
+    SDL_RWops *src =
+        buffer ? SDL_RWFromConstMem(buffer->data(), buffer->size())
+               : SDL_RWFromConstMem(view.data, view.length);
     int is_svg = IMG_isSVG(src);
     int is_png = IMG_isPNG(src);
     int is_jpeg = IMG_isJPG(src);
@@ -199,7 +224,9 @@ SDL_Surface *ONScripter::createSurfaceFromFile(const char *_filename,
         tmp = IMG_Load_RW(src, 0);
     }
     if (!tmp && is_jpeg) {
-        utils::printError(" *** force-loading a JPG image [%s]\n", _filename);
+        if (!quiet)
+            utils::printError(" *** force-loading a JPG image [%s]\n",
+                              _filename);
         tmp = IMG_LoadJPG_RW(src);
     }
 
@@ -209,12 +236,80 @@ SDL_Surface *ONScripter::createSurfaceFromFile(const char *_filename,
 
     SDL_RWclose(src);
 
-    if (!tmp)
+    if (!tmp && !quiet)
         utils::printError(
             " *** can't load file [%s] %s ***\n", _filename, IMG_GetError());
     return tmp;
 }
 
+void ONScripter::prefetchImages() {
+    if (image_prefetch_lines == 0 || current_mode != NORMAL_MODE) return;
+
+    if (!image_prefetcher) {
+        Uint32 format = image_surface->format->format;
+        image_prefetcher = onscripter::MakeUnique<ImagePrefetcher>(
+            [this, format](const char *file_name,
+                           ImagePrefetcher::Image &image) {
+                SDL_Surface *tmp = readImageFile(file_name,
+                                                 &image.has_alpha,
+                                                 &image.location,
+                                                 NULL,
+                                                 true);
+                if (!tmp) return false;
+                // convert here so that loadImage() can take it as it is
+                image.surface = SDL_ConvertSurfaceFormat(tmp, format, 0);
+                SDL_FreeSurface(tmp);
+                return image.surface != NULL;
+            },
+            IMAGE_PREFETCH_WORKERS,
+            IMAGE_PREFETCH_QUEUE);
+        prefetch_scan_begin = prefetch_scan_end = NULL;
+    }
+
+    char *current = script_h.getNext();
+    if (current < prefetch_scan_begin || current > prefetch_scan_end) {
+        // jumped away from the scanned lines, what is queued is stale
+        image_prefetcher->cancel();
+        prefetch_scan_end = current;
+        prefetch_lines_ahead = 0;
+    } else {
+        for (char *buf = prefetch_scan_begin; buf < current; buf++)
+            if (*buf == '\n') prefetch_lines_ahead--;
+    }
+    prefetch_scan_begin = current;
+
+    size_t pending = image_prefetcher->pending();
+    if (prefetch_lines_ahead >= image_prefetch_lines ||
+        pending >= image_prefetcher->capacity())
+        return;
+
+    prefetch_names.clear();
+    prefetch_lines_ahead +=
+        script_h.scanImageNames(prefetch_scan_end,
+                                image_prefetch_lines - prefetch_lines_ahead,
+                                image_prefetcher->capacity() - pending,
+                                prefetch_names);
+    for (auto &name : prefetch_names) image_prefetcher->request(name.c_str());
+}
+
+void ONScripter::stopImagePrefetch() {
+    if (!image_prefetcher) return;
+
+    if (debug_level > 0) {
+        ImagePrefetcher::Stats stats = image_prefetcher->getStats();
+        utils::printInfo(
+            "image prefetch: %zu requested, %zu loaded, %zu used, "
+            "%zu failed, %zu cancelled, %zu dropped\n",
+            stats.requested,
+            stats.loaded,
+            stats.taken,
+            stats.failed,
+            stats.cancelled,
+            stats.dropped);
+    }
+    image_prefetcher.reset();
+}
+
 // resize 32bit surface to 32bit surface
 int ONScripter::resizeSurface(SDL_Surface *src, SDL_Surface *dst) {
 #if ONS_RESIZE_SURFACE_IMPLEMENT == 1
@@ -858,6 +953,52 @@ void ONScripter::makeMonochromeSurface(SDL_Surface *surface, SDL_Rect &clip) {
     SDL_UnlockSurface(surface);
 }
 
+void ONScripter::updateActiveSprites() {
+    if (active_sprite_generation == AnimationInfo::surface_generation) return;
+    active_sprite_generation = AnimationInfo::surface_generation;
+
+    active_sprites.clear();
+    for (int i = MAX_SPRITE_NUM - 1; i >= 0; i--)
+        if (sprite_info[i].image_surface) active_sprites.push_back(i);
+    active_sprites2.clear();
+    for (int i = MAX_SPRITE2_NUM - 1; i >= 0; i--)
+        if (sprite2_info[i].image_surface) active_sprites2.push_back(i);
+}
+
+// true if anim is drawn as a plain copy of opaque pixels over the whole clip,
+// so that nothing below it can show through
+bool ONScripter::isOccluding(AnimationInfo *anim, SDL_Rect &clip) {
+    if (!anim->image_surface || !anim->visible || anim->affine_flag ||
+        anim->blending_mode != AnimationInfo::BLEND_NORMAL ||
+        anim->trans_mode == AnimationInfo::TRANS_LAYER ||
+        (anim->trans & 0xff) != 0xff)
+        return false;
+
+    SDL_Rect rect = anim->pos;
+    if (!anim->abs_flag) {
+        rect.x += screen_scale->Scale(sentence_font.x());
+        rect.y += screen_scale->Scale(sentence_font.y());
+    }
+
+    // the pixels are scanned last, and only once per image
+    return rect.x <= clip.x && rect.y <= clip.y &&
+           rect.x + rect.w >= clip.x + clip.w &&
+           rect.y + rect.h >= clip.y + clip.h && anim->isOpaque();
+}
+
+// the frontmost sprite in [lower, upper] that covers clip, or -1
+int ONScripter::findOccluder(int lower, int upper, SDL_Rect &clip) {
+    // only the SIMD blend copies a pixel of full alpha; the scalar one keeps a
+    // trace of the pixel below, so nothing may be skipped there
+#ifdef USE_SIMD
+    for (auto it = active_sprites.rbegin(); it != active_sprites.rend(); ++it) {
+        if (*it > upper) break;
+        if (*it >= lower && isOccluding(&sprite_info[*it], clip)) return *it;
+    }
+#endif
+    return -1;
+}
+
 void ONScripter::refreshSurface(SDL_Surface *surface,
                                 SDL_Rect *clip_src,
                                 int refresh_mode) {
@@ -870,21 +1011,39 @@ void ONScripter::refreshSurface(SDL_Surface *surface,
     if (clip_src)
         if (AnimationInfo::doClipping(&clip, clip_src)) return;
 
-    int i, top;
-    SDL_BlitSurface(bg_info.image_surface, &clip, surface, &clip);
+    int i, top, top2;
+    if (z_order < 10 && refresh_mode & REFRESH_SAYA_MODE)
+        top = 9;
+    else
+        top = z_order;
+    if (refresh_mode & REFRESH_SAYA_MODE)
+        top2 = 10;
+    else
+        top2 = 0;
 
+    // everything drawn before an opaque sprite covering the clip is hidden
+    // by it, so start from that sprite instead of the background
+    updateActiveSprites();
+    int lower_occluder = -1, upper_occluder = -1;
     if (!all_sprite_hide_flag) {
-        if (z_order < 10 && refresh_mode & REFRESH_SAYA_MODE)
-            top = 9;
-        else
-            top = z_order;
-        for (i = MAX_SPRITE_NUM - 1; i > top; i--) {
-            if (sprite_info[i].image_surface && sprite_info[i].visible)
-                drawTaggedSurface(surface, &sprite_info[i], clip);
+        lower_occluder = findOccluder(top2, z_order, clip);
+        if (lower_occluder < 0)
+            upper_occluder = findOccluder(top + 1, MAX_SPRITE_NUM - 1, clip);
+    }
+
+    if (lower_occluder < 0 && upper_occluder < 0)
+        SDL_BlitSurface(bg_info.image_surface, &clip, surface, &clip);
+
+    if (!all_sprite_hide_flag && lower_occluder < 0) {
+        for (auto no : active_sprites) {
+            if (no <= top) break;
+            if (upper_occluder >= 0 && no > upper_occluder) continue;
+            if (sprite_info[no].visible)
+                drawTaggedSurface(surface, &sprite_info[no], clip);
         }
     }
 
-    if (!all_sprite_hide_flag) {
+    if (!all_sprite_hide_flag && lower_occluder < 0) {
         for (i = 0; i < 3; i++) {
             if (human_order[2 - i] >= 0 &&
                 tachi_info[human_order[2 - i]].image_surface)
@@ -893,15 +1052,15 @@ void ONScripter::refreshSurface(SDL_Surface *surface,
         }
     }
 
-    if (windowback_flag) {
+    if (windowback_flag && lower_occluder < 0) {
         if (nega_mode == 1) makeNegaSurface(surface, clip);
         if (monocro_flag) makeMonochromeSurface(surface, clip);
         if (nega_mode == 2) makeNegaSurface(surface, clip);
 
         if (!all_sprite2_hide_flag) {
-            for (i = MAX_SPRITE2_NUM - 1; i >= 0; i--) {
-                if (sprite2_info[i].image_surface && sprite2_info[i].visible)
-                    drawTaggedSurface(surface, &sprite2_info[i], clip);
+            for (auto no : active_sprites2) {
+                if (sprite2_info[no].visible)
+                    drawTaggedSurface(surface, &sprite2_info[no], clip);
             }
         }
 
@@ -912,21 +1071,20 @@ void ONScripter::refreshSurface(SDL_Surface *surface,
     }
 
     if (!all_sprite_hide_flag) {
-        if (refresh_mode & REFRESH_SAYA_MODE)
-            top = 10;
-        else
-            top = 0;
-        for (i = z_order; i >= top; i--) {
-            if (sprite_info[i].image_surface && sprite_info[i].visible)
-                drawTaggedSurface(surface, &sprite_info[i], clip);
+        for (auto no : active_sprites) {
+            if (no > z_order) continue;
+            if (no < top2) break;
+            if (lower_occluder >= 0 && no > lower_occluder) continue;
+            if (sprite_info[no].visible)
+                drawTaggedSurface(surface, &sprite_info[no], clip);
         }
     }
 
     if (!windowback_flag) {
         if (!all_sprite2_hide_flag) {
-            for (i = MAX_SPRITE2_NUM - 1; i >= 0; i--) {
-                if (sprite2_info[i].image_surface && sprite2_info[i].visible)
-                    drawTaggedSurface(surface, &sprite2_info[i], clip);
+            for (auto no : active_sprites2) {
+                if (sprite2_info[no].visible)
+                    drawTaggedSurface(surface, &sprite2_info[no], clip);
             }
         }
 
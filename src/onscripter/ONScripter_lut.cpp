@@ -24,6 +24,8 @@
 
 #include "ONScripter.h"
 
+#include <algorithm>
+
 static ONScripter::FuncLUT func_lut[] = {
     {"zenkakko", &ONScripter::zenkakkoCommand},
 
@@ -416,13 +418,23 @@ static ONScripter::FuncLUT func_lut[] = {
 };
 
 void ONScripter::makeFuncLUT() {
-    for (int i = 'z' - 'a'; i >= 0; i--) func_hash[i].func = NULL;
-
-    int idx = 0;
-    while (func_lut[idx].method) {
-        int j = func_lut[idx].command[0] - 'a';
-        if (func_hash[j].func == NULL) func_hash[j].func = func_lut + idx;
-        func_hash[j].num = func_lut + idx - func_hash[j].func + 1;
-        idx++;
-    }
+    sorted_func_lut.clear();
+    for (int idx = 0; func_lut[idx].method; idx++)
+        sorted_func_lut.push_back(func_lut + idx);
+    std::stable_sort(sorted_func_lut.begin(),
+                     sorted_func_lut.end(),
+                     [](const FuncLUT *a, const FuncLUT *b) {
+                         return strcmp(a->command, b->command) < 0;
+                     });
+}
+
+ONScripter::FuncLUT *ONScripter::findCommand(const char *cmd) {
+    auto it = std::lower_bound(sorted_func_lut.begin(),
+                               sorted_func_lut.end(),
+                               cmd,
+                               [](const FuncLUT *func, const char *cmd) {
+                                   return strcmp(func->command, cmd) < 0;
+                               });
+    if (it == sorted_func_lut.end() || strcmp((*it)->command, cmd)) return NULL;
+    return *it;
 }
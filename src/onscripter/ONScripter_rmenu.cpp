@@ -106,6 +106,7 @@ void ONScripter::leaveSystemCall(bool restore_flag) {
     if (restore_flag) {
         current_page = cached_page;
         SDL_BlitSurface(backup_surface, NULL, text_info.image_surface, NULL);
+        text_info.imageChanged();
         root_button_link.next = shelter_button_link;
         root_select_link.next = shelter_select_link;
 
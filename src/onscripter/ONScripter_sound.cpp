@@ -67,6 +67,75 @@ extern "C" Uint32 SDLCALL bgmfadeCallback(Uint32 interval, void *param);
 
 #define TMP_MUSIC_FILE "tmp.mus"
 
+// SDL_RWops reading a BaseReader::FileStream, so that music is decoded
+// straight from the archive instead of a copy of the whole file
+static Sint64 SDLCALL streamSize(SDL_RWops *context) {
+    return ((BaseReader::FileStream *)context->hidden.unknown.data1)
+        ->getLength();
+}
+
+static Sint64 SDLCALL streamSeek(SDL_RWops *context,
+                                 Sint64 offset,
+                                 int whence) {
+    BaseReader::FileStream *stream =
+        (BaseReader::FileStream *)context->hidden.unknown.data1;
+    if (whence == RW_SEEK_CUR)
+        offset += stream->tell();
+    else if (whence == RW_SEEK_END)
+        offset += stream->getLength();
+    if (offset < 0 || !stream->seek((size_t)offset))
+        return SDL_SetError("streamSeek: invalid offset");
+    return offset;
+}
+
+static size_t SDLCALL streamRead(SDL_RWops *context,
+                                 void *ptr,
+                                 size_t size,
+                                 size_t maxnum) {
+    if (size == 0) return 0;
+    BaseReader::FileStream *stream =
+        (BaseReader::FileStream *)context->hidden.unknown.data1;
+    size_t pos = stream->tell();
+    size_t ret = stream->read(ptr, size * maxnum);
+    if (ret % size) {
+        // SDL expects whole objects only
+        stream->seek(pos + ret / size * size);
+    }
+    return ret / size;
+}
+
+static size_t SDLCALL streamWrite(SDL_RWops *context,
+                                  const void *ptr,
+                                  size_t size,
+                                  size_t num) {
+    SDL_SetError("streamWrite: read-only stream");
+    return 0;
+}
+
+static int SDLCALL streamClose(SDL_RWops *context) {
+    if (context) {
+        delete (BaseReader::FileStream *)context->hidden.unknown.data1;
+        SDL_FreeRW(context);
+    }
+    return 0;
+}
+
+static SDL_RWops *rwFromFileStream(BaseReader::FileStream *stream) {
+    SDL_RWops *rw = SDL_AllocRW();
+    if (rw == NULL) {
+        delete stream;
+        return NULL;
+    }
+    rw->size = streamSize;
+    rw->seek = streamSeek;
+    rw->read = streamRead;
+    rw->write = streamWrite;
+    rw->close = streamClose;
+    rw->type = SDL_RWOPS_UNKNOWN;
+    rw->hidden.unknown.data1 = stream;
+    return rw;
+}
+
 int ONScripter::playSound(const char *filename,
                           int format,
                           bool loop_flag,
@@ -85,6 +154,29 @@ int ONScripter::playSound(const char *filename,
         return SOUND_NONE;
     }
 
+#if SDL_MIXER_MAJOR_VERSION >= 2
+    if (format & SOUND_MUSIC) {
+        // music stored as is does not need to be loaded before it starts
+        BaseReader::FileStream *stream =
+            script_h.cBR->openFileStream(filename);
+        if (stream) {
+            music_info = Mix_LoadMUS_RW(rwFromFileStream(stream), 1);
+            if (music_info) {
+                Mix_VolumeMusic(music_volume);
+                if (Mix_FadeInMusic(music_info,
+                                    (music_play_loop_flag &&
+                                     music_loopback_offset == 0.0)
+                                        ? -1
+                                        : 0,
+                                    fadetime) == 0)
+                    return SOUND_MUSIC;
+                Mix_FreeMusic(music_info);
+                music_info = NULL;
+            }
+        }
+    }
+#endif
+
     unsigned char *buffer;
 
     if (format & SOUND_MUSIC && length == music_buffer_length && music_buffer) {
@@ -366,6 +458,9 @@ int ONScripter::playMPEG(const char *filename,
     oi.overlay.pixels = pixels;
     oi.mutex = SDL_CreateMutex();
 
+    // texture is rebuilt from accumulation_surface after playback, so bring
+    // it up to date while texture is still the screen one
+    syncAccumulationSurface();
     texture = SDL_CreateTexture(renderer,
                                 SDL_PIXELFORMAT_YV12,
                                 SDL_TEXTUREACCESS_TARGET,
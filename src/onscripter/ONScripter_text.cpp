@@ -76,6 +76,41 @@ void ONScripter::shiftHalfPixelY(SDL_Surface *surface) {
     }
     SDL_UnlockSurface(surface);
 }
+
+bool ONScripter::getGlyph(void *font,
+                          unsigned short unicode,
+                          SDL_Surface *base,
+                          onscache::GlyphImage &glyph) {
+    // TTF_Font objects live until exit and each has a fixed file, size and
+    // outline, so the pointer identifies them
+    auto it = glyph_font_ids.find(font);
+    if (it == glyph_font_ids.end())
+        it = glyph_font_ids.emplace(font, glyph_font_ids.size()).first;
+    uint64_t key = it->second << 16 | unicode;
+    if (glyphCache->TryGet(key, glyph)) return true;
+
+    int minx, maxx, miny, maxy, advanced;
+    TTF_GlyphMetrics(
+        (TTF_Font *)font, unicode, &minx, &maxx, &miny, &maxy, &advanced);
+
+    static SDL_Color fcol = {0xff, 0xff, 0xff}, bcol = {0, 0, 0};
+    SDL_Surface *surface =
+        TTF_RenderGlyph_Shaded((TTF_Font *)font, unicode, fcol, bcol);
+    if (!surface) {
+        glyph = onscache::GlyphImage();
+        return false;
+    }
+    // an outline is centred on the glyph it surrounds
+    if (base) {
+        if ((surface->w - base->w) & 1) shiftHalfPixelX(surface);
+        if ((surface->h - base->h) & 1) shiftHalfPixelY(surface);
+    }
+
+    glyph = onscache::GlyphImage(surface, minx, miny);
+    glyphCache->Put(key, glyph);
+    return true;
+}
+
 void ONScripter::drawGlyph(SDL_Surface *dst_surface,
                            _FontInfo *info,
                            SDL_Color &color,
@@ -85,6 +120,8 @@ void ONScripter::drawGlyph(SDL_Surface *dst_surface,
                            SDL_Rect *clip,
                            SDL_Rect &dst_rect,
                            const ons_font::FontConfig *fontConfig) {
+    if (dst_surface == accumulation_surface) syncAccumulationSurface();
+
     unsigned short unicode;
     if (IS_TWO_BYTE(text[0])) {
         unsigned index = ((unsigned char *)text)[0];
@@ -97,25 +134,11 @@ void ONScripter::drawGlyph(SDL_Surface *dst_surface,
             unicode = text[0];
     }
 
-    int minx, maxx, miny, maxy, advanced;
-#if 0
-    if (TTF_GetFontStyle( (TTF_Font*)info->ttf_font[0] ) !=
-        (info->is_bold?TTF_STYLE_BOLD:TTF_STYLE_NORMAL) )
-        TTF_SetFontStyle( (TTF_Font*)info->ttf_font[0], (info->is_bold?TTF_STYLE_BOLD:TTF_STYLE_NORMAL));
-#endif
-    TTF_GlyphMetrics((TTF_Font *)info->ttf_font[0],
-                     unicode,
-                     &minx,
-                     &maxx,
-                     &miny,
-                     &maxy,
-                     &advanced);
-    // utils::printInfo("min %d %d %d %d %d %d\n", minx, maxx, miny, maxy,
-    // advanced,TTF_FontAscent((TTF_Font*)info->ttf_font[0])  );
+    onscache::GlyphImage glyph, glyph_s;
+    getGlyph(info->ttf_font[0], unicode, NULL, glyph);
+    SDL_Surface *tmp_surface = glyph.surface.get();
+    int minx = glyph.minx, miny = glyph.miny;
 
-    static SDL_Color fcol = {0xff, 0xff, 0xff}, bcol = {0, 0, 0};
-    SDL_Surface *tmp_surface = TTF_RenderGlyph_Shaded(
-        (TTF_Font *)info->ttf_font[0], unicode, fcol, bcol);
     const ons_font::FontConfig *cfg = getFontConfig(info->types);
     SDL_Color scolor = {
         cfg->outline_color.rgba[0],
@@ -125,14 +148,8 @@ void ONScripter::drawGlyph(SDL_Surface *dst_surface,
     };
     SDL_Surface *tmp_surface_s = tmp_surface;
     if (info->is_shadow && fontConfig->render_outline) {
-        tmp_surface_s = TTF_RenderGlyph_Shaded(
-            (TTF_Font *)info->ttf_font[1], unicode, fcol, bcol);
-        if (tmp_surface && tmp_surface_s) {
-            if ((tmp_surface_s->w - tmp_surface->w) & 1)
-                shiftHalfPixelX(tmp_surface_s);
-            if ((tmp_surface_s->h - tmp_surface->h) & 1)
-                shiftHalfPixelY(tmp_surface_s);
-        }
+        getGlyph(info->ttf_font[1], unicode, tmp_surface, glyph_s);
+        tmp_surface_s = glyph_s.surface.get();
     }
 
     bool rotate_flag = false;
@@ -207,10 +224,6 @@ void ONScripter::drawGlyph(SDL_Surface *dst_surface,
             alphaBlendText(
                 dst_surface, dst_rect, tmp_surface, color, clip, rotate_flag);
     }
-
-    if (tmp_surface_s && tmp_surface_s != tmp_surface)
-        SDL_FreeSurface(tmp_surface_s);
-    if (tmp_surface) SDL_FreeSurface(tmp_surface);
 }
 
 int ONScripter::drawChar(char *text,
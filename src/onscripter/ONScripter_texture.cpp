@@ -0,0 +1,386 @@
+/* -*- C++ -*-
+ *
+ *  ONScripter_texture.cpp - Compositing the screen with SDL_Renderer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+// Instead of blending every layer into accumulation_surface and uploading
+// the result, each AnimationInfo keeps its image in a texture and the
+// renderer composites them in the same order as refreshSurface(). Only the
+// dirty rectangles are redrawn, relying on the back buffer being kept
+// between frames just like flushDirect() does. accumulation_surface is
+// brought up to date lazily by syncAccumulationSurface() before anything
+// reads or draws into it.
+
+#include <cmath>
+
+#include "ONScripter.h"
+#include "private/utils.h"
+
+// effects the renderer can not reproduce are left to refreshSurface()
+bool ONScripter::canCompositeTextures(int refresh_mode) {
+#if defined(ANDROID) || defined(RENDER_COPY_RECT_FULL)
+    return false;
+#else
+    if (!texture_composite_flag || !isnan(sharpness)) return false;
+    if (refresh_mode == REFRESH_NONE_MODE) return false;
+    if (nega_mode || monocro_flag) return false;
+
+    auto check = [this](AnimationInfo *anim) {
+        if (!anim->image_surface || !anim->visible) return true;
+        if (anim->trans_mode == AnimationInfo::TRANS_LAYER ||
+            anim->blending_mode == AnimationInfo::BLEND_SUB)
+            return false;
+        if (max_texture_width > 0 &&
+            (anim->image_surface->w > max_texture_width ||
+             anim->image_surface->h > max_texture_height))
+            return false;
+        return true;
+    };
+
+    updateActiveSprites();
+    if (!all_sprite_hide_flag) {
+        for (auto no : active_sprites)
+            if (!check(&sprite_info[no])) return false;
+        for (int i = 0; i < 3; i++)
+            if (!check(&tachi_info[i])) return false;
+    }
+    if (!all_sprite2_hide_flag) {
+        for (auto no : active_sprites2)
+            if (!check(&sprite2_info[no])) return false;
+    }
+
+    return true;
+#endif
+}
+
+// draw the dirty rectangles and present them, false to fall back to the
+// software path for this frame
+bool ONScripter::compositeTextures(SDL_Rect *rects,
+                                   int num_rects,
+                                   int refresh_mode) {
+    if (!canCompositeTextures(refresh_mode)) return false;
+
+    // stale areas of another refresh mode can not be merged
+    if (num_stale_rects > 0 && stale_refresh_mode != refresh_mode)
+        syncAccumulationSurface();
+
+    SDL_Rect dst_rects[MAX_DIRTY_RECTS];
+    int num_dst_rects = 0;
+    for (int i = 0; i < num_rects && num_dst_rects < MAX_DIRTY_RECTS; i++) {
+        SDL_Rect dst_rect = rects[i];
+        --dst_rect.x;
+        --dst_rect.y;
+        dst_rect.w += 2;
+        dst_rect.h += 2;
+        if (AnimationInfo::doClipping(&dst_rect, &screen_rect) ||
+            (dst_rect.w == 2 && dst_rect.h == 2))
+            continue;
+        dst_rects[num_dst_rects++] = dst_rect;
+    }
+    if (num_dst_rects == 0) return true;
+
+    // redraw a larger area rather than refreshing accumulation_surface
+    if (num_stale_rects + num_dst_rects > MAX_DIRTY_RECTS) {
+        SDL_Rect box = dst_rects[0];
+        for (int i = 1; i < num_dst_rects; i++)
+            SDL_UnionRect(&box, &dst_rects[i], &box);
+        for (int i = 0; i < num_stale_rects; i++)
+            SDL_UnionRect(&box, &stale_rects[i], &box);
+        dst_rects[0] = box;
+        num_dst_rects = 1;
+        num_stale_rects = 0;
+    }
+
+    bool ret = true;
+    for (int i = 0; i < num_dst_rects && ret; i++) {
+        SDL_RenderSetClipRect(renderer, &dst_rects[i]);
+        ret = compositeScene(refresh_mode);
+    }
+    SDL_RenderSetClipRect(renderer, NULL);
+    if (!ret) {
+        utils::printError(
+            "compositeTextures: %s, falling back to software compositing\n",
+            SDL_GetError());
+        texture_composite_flag = false;
+        clearTextureCache();
+        return false;
+    }
+
+    for (int i = 0; i < num_dst_rects; i++)
+        stale_rects[num_stale_rects++] = dst_rects[i];
+    stale_refresh_mode = refresh_mode;
+    pruneTextureCache();
+
+    screen_dirty_flag = false;
+    SDL_RenderPresent(renderer);
+    return true;
+}
+
+// same order as refreshSurface()
+bool ONScripter::compositeScene(int refresh_mode) {
+    bool ret = true;
+    int i, top;
+
+    if (bg_info.image_surface) {
+        SDL_Texture *bg_texture = getAnimationTexture(&bg_info);
+        if (bg_texture) {
+            SDL_SetTextureBlendMode(bg_texture, SDL_BLENDMODE_NONE);
+            SDL_SetTextureAlphaMod(bg_texture, 0xff);
+            SDL_RenderCopy(renderer, bg_texture, &screen_rect, &screen_rect);
+        } else {
+            ret = false;
+        }
+    }
+
+    if (!all_sprite_hide_flag) {
+        if (z_order < 10 && refresh_mode & REFRESH_SAYA_MODE)
+            top = 9;
+        else
+            top = z_order;
+        for (auto no : active_sprites) {
+            if (no <= top) break;
+            if (sprite_info[no].visible)
+                ret &= drawTaggedTexture(&sprite_info[no]);
+        }
+    }
+
+    if (!all_sprite_hide_flag) {
+        for (i = 0; i < 3; i++) {
+            if (human_order[2 - i] >= 0 &&
+                tachi_info[human_order[2 - i]].image_surface)
+                ret &= drawTaggedTexture(&tachi_info[human_order[2 - i]]);
+        }
+    }
+
+    if (windowback_flag) {
+        if (!all_sprite2_hide_flag) {
+            for (auto no : active_sprites2) {
+                if (sprite2_info[no].visible)
+                    ret &= drawTaggedTexture(&sprite2_info[no]);
+            }
+        }
+
+        if (refresh_mode & REFRESH_SHADOW_MODE) ret &= shadowTextTexture();
+        if (refresh_mode & REFRESH_TEXT_MODE)
+            ret &= drawTexture(&text_info, 0, 0);
+    }
+
+    if (!all_sprite_hide_flag) {
+        if (refresh_mode & REFRESH_SAYA_MODE)
+            top = 10;
+        else
+            top = 0;
+        for (auto no : active_sprites) {
+            if (no > z_order) continue;
+            if (no < top) break;
+            if (sprite_info[no].visible)
+                ret &= drawTaggedTexture(&sprite_info[no]);
+        }
+    }
+
+    if (!windowback_flag) {
+        if (!all_sprite2_hide_flag) {
+            for (auto no : active_sprites2) {
+                if (sprite2_info[no].visible)
+                    ret &= drawTaggedTexture(&sprite2_info[no]);
+            }
+        }
+    }
+
+    if (!(refresh_mode & REFRESH_SAYA_MODE)) {
+        for (i = 0; i < MAX_PARAM_NUM; i++) {
+            if (bar_info[i]) ret &= drawTaggedTexture(bar_info[i]);
+        }
+        for (i = 0; i < MAX_PARAM_NUM; i++) {
+            if (prnum_info[i]) ret &= drawTaggedTexture(prnum_info[i]);
+        }
+    }
+
+    if (!windowback_flag) {
+        if (refresh_mode & REFRESH_SHADOW_MODE) ret &= shadowTextTexture();
+        if (refresh_mode & REFRESH_TEXT_MODE)
+            ret &= drawTexture(&text_info, 0, 0);
+    }
+
+    if (refresh_mode & REFRESH_CURSOR_MODE && !textgosub_label) {
+        if (clickstr_state == CLICK_WAIT)
+            ret &= drawTaggedTexture(&cursor_info[0]);
+        else if (clickstr_state == CLICK_NEWPAGE)
+            ret &= drawTaggedTexture(&cursor_info[1]);
+    }
+
+    if (show_dialog_flag) ret &= drawTaggedTexture(&dialog_info);
+
+    ButtonLink *bl = root_button_link.next;
+    while (bl) {
+        if (bl->show_flag > 0)
+            ret &= drawTaggedTexture(bl->anim[bl->show_flag - 1]);
+        bl = bl->next;
+    }
+
+    return ret;
+}
+
+bool ONScripter::drawTaggedTexture(AnimationInfo *anim) {
+    SDL_Rect poly_rect = anim->pos;
+    if (!anim->abs_flag) {
+        poly_rect.x += screen_scale->Scale(sentence_font.x());
+        poly_rect.y += screen_scale->Scale(sentence_font.y());
+    }
+
+    return drawTexture(anim, poly_rect.x, poly_rect.y);
+}
+
+// counterpart of AnimationInfo::blendOnSurface() and blendOnSurface2()
+bool ONScripter::drawTexture(AnimationInfo *anim, int x, int y) {
+    if (anim->image_surface == NULL || anim->trans == 0) return true;
+    if (anim->affine_flag && (anim->scale_x == 0 || anim->scale_y == 0))
+        return true;
+
+    SDL_Texture *anim_texture = getAnimationTexture(anim);
+    if (anim_texture == NULL) return false;
+
+    SDL_SetTextureBlendMode(anim_texture,
+                            anim->blending_mode == AnimationInfo::BLEND_ADD
+                                ? SDL_BLENDMODE_ADD
+                                : SDL_BLENDMODE_BLEND);
+    SDL_SetTextureAlphaMod(anim_texture, anim->trans & 0xff);
+
+    int cell_x =
+        anim->image_surface->w * anim->current_cell / anim->num_of_cells;
+    if (!anim->affine_flag) {
+        SDL_Rect src_rect = {cell_x, 0, anim->pos.w, anim->pos.h};
+        SDL_Rect dst_rect = {x, y, anim->pos.w, anim->pos.h};
+        return SDL_RenderCopy(renderer, anim_texture, &src_rect, &dst_rect) ==
+               0;
+    }
+
+    // pos.x and pos.y are the center of the transformed image
+    SDL_Rect src_rect = {cell_x + anim->affine_pos.x,
+                         anim->affine_pos.y,
+                         anim->affine_pos.w,
+                         anim->affine_pos.h};
+    int w = anim->affine_pos.w * abs(anim->scale_x) / 100;
+    int h = anim->affine_pos.h * abs(anim->scale_y) / 100;
+    SDL_Rect dst_rect = {anim->pos.x - w / 2, anim->pos.y - h / 2, w, h};
+    int flip = SDL_FLIP_NONE;
+    if (anim->scale_x < 0) flip |= SDL_FLIP_HORIZONTAL;
+    if (anim->scale_y < 0) flip |= SDL_FLIP_VERTICAL;
+
+    // rot is counterclockwise while SDL rotates clockwise
+    return SDL_RenderCopyEx(renderer,
+                            anim_texture,
+                            &src_rect,
+                            &dst_rect,
+                            -anim->rot,
+                            NULL,
+                            (SDL_RendererFlip)flip) == 0;
+}
+
+// counterpart of shadowTextDisplay(), the window color multiplies the screen
+bool ONScripter::shadowTextTexture() {
+    if (current_font->is_transparent) {
+        SDL_Rect rect = screen_rect;
+        if (current_font == &sentence_font) rect = sentence_font_info.pos;
+
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_MOD);
+        SDL_SetRenderDrawColor(renderer,
+                               current_font->window_color[0],
+                               current_font->window_color[1],
+                               current_font->window_color[2],
+                               0xff);
+        SDL_RenderFillRect(renderer, &rect);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0xff);
+    } else if (sentence_font_info.image_surface) {
+        return drawTaggedTexture(&sentence_font_info);
+    }
+
+    return true;
+}
+
+// the texture of anim, uploaded again only when its pixels have changed
+SDL_Texture *ONScripter::getAnimationTexture(AnimationInfo *anim) {
+    SDL_Surface *surface = anim->image_surface;
+    CachedTexture &cache = texture_cache[anim];
+    cache.used = true;
+    if (cache.texture && cache.version == anim->image_version)
+        return cache.texture;
+
+    if (cache.texture) {
+        int w, h;
+        SDL_QueryTexture(cache.texture, NULL, NULL, &w, &h);
+        if (w != surface->w || h != surface->h) {
+            SDL_DestroyTexture(cache.texture);
+            cache.texture = NULL;
+        }
+    }
+    if (cache.texture == NULL) {
+        cache.texture = SDL_CreateTexture(renderer,
+                                          surface->format->format,
+                                          SDL_TEXTUREACCESS_STATIC,
+                                          surface->w,
+                                          surface->h);
+        if (cache.texture == NULL) return NULL;
+    }
+
+    SDL_mutexP(anim->mutex);
+    SDL_LockSurface(surface);
+    SDL_UpdateTexture(cache.texture, NULL, surface->pixels, surface->pitch);
+    SDL_UnlockSurface(surface);
+    SDL_mutexV(anim->mutex);
+    cache.version = anim->image_version;
+
+    return cache.texture;
+}
+
+// release the textures of images that were not drawn in the last frame
+void ONScripter::pruneTextureCache() {
+    for (auto it = texture_cache.begin(); it != texture_cache.end();) {
+        if (it->second.used) {
+            it->second.used = false;
+            ++it;
+        } else {
+            if (it->second.texture) SDL_DestroyTexture(it->second.texture);
+            it = texture_cache.erase(it);
+        }
+    }
+}
+
+void ONScripter::clearTextureCache() {
+    for (auto &it : texture_cache)
+        if (it.second.texture) SDL_DestroyTexture(it.second.texture);
+    texture_cache.clear();
+}
+
+// render what compositeTextures() has shown into accumulation_surface and
+// texture, to be called before they are read or drawn into
+void ONScripter::syncAccumulationSurface() {
+    for (int i = 0; i < num_stale_rects; i++) {
+        SDL_Rect &rect = stale_rects[i];
+        refreshSurface(accumulation_surface, &rect, stale_refresh_mode);
+        SDL_LockSurface(accumulation_surface);
+        SDL_UpdateTexture(texture,
+                          &rect,
+                          (unsigned char *)accumulation_surface->pixels +
+                              accumulation_surface->pitch * rect.y +
+                              rect.x * sizeof(ONSBuf),
+                          accumulation_surface->pitch);
+        SDL_UnlockSurface(accumulation_surface);
+    }
+    num_stale_rects = 0;
+}
@@ -0,0 +1,228 @@
+/* -*- C++ -*-
+ *
+ *  ArchiveDecoder.cpp - Decoders for compressed archive entries
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "ArchiveDecoder.h"
+
+#include <bzlib.h>
+
+#include <config.hpp>
+
+#define EI 8
+#define EJ 4
+#define P 1               /* If match length <= P then output one character */
+#define N (1 << EI)       /* buffer size */
+#define F ((1 << EJ) + P) /* lookahead buffer size */
+
+namespace {
+// big endian fields of the entry header; missing bytes read as zero
+unsigned long readBE(const unsigned char *src,
+                     size_t src_length,
+                     int bytes,
+                     const unsigned char *key_table) {
+    unsigned long ret = 0;
+    for (int i = 0; i < bytes; i++) {
+        unsigned char ch = (size_t)i < src_length ? src[i] : 0;
+        ret = ret << 8 | (key_table ? key_table[ch] : ch);
+    }
+    return ret;
+}
+}  // namespace
+
+namespace ons_decoder {
+size_t decodeLZSS(const unsigned char *src,
+                  size_t src_length,
+                  unsigned char *dst,
+                  size_t original_length,
+                  const unsigned char *key_table) {
+    BitReader bits(src, src_length, key_table);
+    // the last F bytes are only read before being written by corrupt
+    // data; clear them too so the output never depends on stack garbage
+    unsigned char ring[N];
+    size_t count = 0;
+    int i, j, k, r, c;
+
+    memset(ring, 0, N);
+    r = N - F;
+
+    while (count < original_length) {
+        if (bits.get(1)) {
+            if ((c = bits.get(8)) == EOF) break;
+            dst[count++] = c;
+            ring[r++] = c;
+            r &= (N - 1);
+        } else {
+            if ((i = bits.get(EI)) == EOF) break;
+            if ((j = bits.get(EJ)) == EOF) break;
+            // a match may overrun original_length by up to F bytes in
+            // corrupt data; the old decoder wrote them, this one stops
+            for (k = 0; k <= j + 1 && count < original_length; k++) {
+                c = ring[(i + k) & (N - 1)];
+                dst[count++] = c;
+                ring[r++] = c;
+                r &= (N - 1);
+            }
+        }
+    }
+
+    return count;
+}
+
+size_t getSPBLength(const unsigned char *src,
+                    size_t src_length,
+                    const unsigned char *key_table) {
+    size_t width = readBE(src, src_length, 2, key_table);
+    size_t height = readBE(src + 2, src_length < 2 ? 0 : src_length - 2, 2,
+                           key_table);
+    size_t width_pad = (4 - width * 3 % 4) % 4;
+
+    return (width * 3 + width_pad) * height + 54;
+}
+
+size_t decodeSPB(const unsigned char *src,
+                 size_t src_length,
+                 unsigned char *dst,
+                 const unsigned char *key_table) {
+    size_t width = readBE(src, src_length, 2, key_table);
+    size_t height = readBE(src + 2, src_length < 2 ? 0 : src_length - 2, 2,
+                           key_table);
+    size_t width_pad = (4 - width * 3 % 4) % 4;
+    size_t total_size = (width * 3 + width_pad) * height + 54;
+
+    /* ---------------------------------------- */
+    /* Write header */
+    memset(dst, 0, 54);
+    dst[0] = 'B';
+    dst[1] = 'M';
+    dst[2] = total_size & 0xff;
+    dst[3] = (total_size >> 8) & 0xff;
+    dst[4] = (total_size >> 16) & 0xff;
+    dst[5] = (total_size >> 24) & 0xff;
+    dst[10] = 54;  // offset to the body
+    dst[14] = 40;  // header size
+    dst[18] = width & 0xff;
+    dst[19] = (width >> 8) & 0xff;
+    dst[22] = height & 0xff;
+    dst[23] = (height >> 8) & 0xff;
+    dst[26] = 1;                // the number of the plane
+    dst[28] = 24;               // bpp
+    dst[34] = total_size - 54;  // size of the body
+
+    if (width == 0 || height == 0) return total_size;
+    dst += 54;
+
+    BitReader bits(src + 4, src_length < 4 ? 0 : src_length - 4, key_table);
+    // runs of four may overshoot the last pixel by three bytes
+    onscripter::Vector<unsigned char> channel(width * height + 4);
+    unsigned char *pbuf, *psbuf;
+    size_t i, j, k, count;
+    int c, n, m;
+
+    for (i = 0; i < 3; i++) {
+        count = 0;
+        channel[count++] = c = bits.get(8);
+        while (count < width * height) {
+            n = bits.get(3);
+            if (n == 0) {
+                channel[count++] = c;
+                channel[count++] = c;
+                channel[count++] = c;
+                channel[count++] = c;
+                continue;
+            } else if (n == 7) {
+                m = bits.get(1) + 1;
+            } else {
+                m = n + 2;
+            }
+
+            for (j = 0; j < 4; j++) {
+                if (m == 8) {
+                    c = bits.get(8);
+                } else {
+                    k = bits.get(m);
+                    if (k & 1)
+                        c += (k >> 1) + 1;
+                    else
+                        c -= (k >> 1);
+                }
+                channel[count++] = c;
+            }
+        }
+
+        pbuf = dst + (width * 3 + width_pad) * (height - 1) + i;
+        psbuf = channel.data();
+
+        for (j = 0; j < height; j++) {
+            if (j & 1) {
+                for (k = 0; k < width; k++, pbuf -= 3) *pbuf = *psbuf++;
+                pbuf -= width * 3 + width_pad - 3;
+            } else {
+                for (k = 0; k < width; k++, pbuf += 3) *pbuf = *psbuf++;
+                pbuf -= width * 3 + width_pad + 3;
+            }
+        }
+    }
+
+    return total_size;
+}
+
+size_t getNBZLength(const unsigned char *src,
+                    size_t src_length,
+                    const unsigned char *key_table) {
+    return readBE(src, src_length, 4, key_table);
+}
+
+size_t decodeNBZ(const unsigned char *src,
+                 size_t src_length,
+                 unsigned char *dst,
+                 const unsigned char *key_table) {
+    size_t original_length = getNBZLength(src, src_length, key_table);
+    if (src_length < 4) return 0;
+
+    bz_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (BZ2_bzDecompressInit(&strm, 0, 0) != BZ_OK) return 0;
+
+    // bz_stream counts in unsigned int, so feed large entries in pieces
+    const unsigned int chunk = 1u << 30;
+    const unsigned char *in = src + 4, *in_end = src + src_length;
+    unsigned char *out = dst;
+    size_t count = original_length;
+    int err = BZ_OK;
+    while (err == BZ_OK && count > 0) {
+        if (strm.avail_in == 0 && in < in_end) {
+            size_t n = in_end - in < chunk ? in_end - in : chunk;
+            strm.next_in = (char *)in;
+            strm.avail_in = n;
+            in += n;
+        }
+        size_t n = count < chunk ? count : chunk;
+        strm.next_out = (char *)out;
+        strm.avail_out = n;
+        bool starved = strm.avail_in == 0;
+        err = BZ2_bzDecompress(&strm);
+        size_t produced = n - strm.avail_out;
+        out += produced;
+        count -= produced;
+        if (starved && produced == 0) break;  // truncated stream
+    }
+    BZ2_bzDecompressEnd(&strm);
+
+    return original_length - count;
+}
+}  // namespace ons_decoder
@@ -0,0 +1,109 @@
+/* -*- C++ -*-
+ *
+ *  ArchiveDecoder.h - Decoders for compressed archive entries
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ARCHIVE_DECODER_H__
+#define __ARCHIVE_DECODER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Reads MSB-first bit fields from memory, a 64-bit word at a time. Bytes
+// pass through key_table when one is given.
+class BitReader {
+   public:
+    BitReader(const unsigned char *data,
+              size_t length,
+              const unsigned char *key_table = NULL)
+        : p(data), end(data + length), key_table(key_table), bits(0),
+          num_bits(0) {}
+
+    // the next n (at most 32) bits, or EOF once the data runs out; like
+    // the old per-bit reader, the bits left over at EOF are dropped
+    inline int get(int n) {
+        if (n == 0) return 0;
+        if (num_bits < n) {
+            refill();
+            if (num_bits < n) {
+                num_bits = 0;
+                return EOF;
+            }
+        }
+        int x = (int)(bits >> (64 - n));
+        bits <<= n;
+        num_bits -= n;
+        return x;
+    }
+
+   private:
+    void refill() {
+        if (!key_table && end - p >= 8) {
+            // the partial byte below num_bits is refilled with the same bits
+            uint64_t word = 0;
+            for (int i = 0; i < 8; i++) word = word << 8 | p[i];
+            bits |= word >> num_bits;
+            int bytes = (63 - num_bits) >> 3;
+            p += bytes;
+            num_bits += bytes * 8;
+            return;
+        }
+        while (num_bits <= 56 && p < end) {
+            unsigned char ch = key_table ? key_table[*p] : *p;
+            bits |= (uint64_t)ch << (56 - num_bits);
+            p++;
+            num_bits += 8;
+        }
+    }
+
+    const unsigned char *p, *end;
+    const unsigned char *key_table;
+    uint64_t bits;  // the next num_bits bits, left aligned
+    int num_bits;
+};
+
+// Each call decodes one whole entry from src and keeps its state on the
+// stack, so entries can be decoded on several threads at once. Offsets
+// are relative to the start of the entry and lengths never run past src.
+namespace ons_decoder {
+// returns the number of bytes written, at most original_length
+size_t decodeLZSS(const unsigned char *src,
+                  size_t src_length,
+                  unsigned char *dst,
+                  size_t original_length,
+                  const unsigned char *key_table = NULL);
+// dst must hold getSPBLength() bytes; returns that length
+size_t decodeSPB(const unsigned char *src,
+                 size_t src_length,
+                 unsigned char *dst,
+                 const unsigned char *key_table = NULL);
+size_t getSPBLength(const unsigned char *src,
+                    size_t src_length,
+                    const unsigned char *key_table = NULL);
+// the 4-byte length goes through key_table, the bzip2 stream does not
+size_t decodeNBZ(const unsigned char *src,
+                 size_t src_length,
+                 unsigned char *dst,
+                 const unsigned char *key_table = NULL);
+size_t getNBZLength(const unsigned char *src,
+                    size_t src_length,
+                    const unsigned char *key_table = NULL);
+}  // namespace ons_decoder
+
+#endif  // __ARCHIVE_DECODER_H__
@@ -25,12 +25,19 @@
 #include "DirectReader.h"
 
 #include <bzlib.h>
+#include <errno.h>
 
+#include "ArchiveDecoder.h"
 #include "coding2utf16.h"
 #include "private/utils.h"
 #if !defined(WIN32) && !defined(_WIN32) && !defined(MACOS9) && \
     !defined(PSP) && !defined(__OS2__)
 #include <dirent.h>
+#include <unistd.h>
+#define USE_PREAD
+#elif defined(WIN32) || defined(_WIN32)
+#include <io.h>
+#include <windows.h>
 #endif
 
 #define IS_TWO_BYTE(x)                             \
@@ -46,12 +53,6 @@ extern Coding2UTF16 *coding2utf16;
 #define READ_LENGTH 4096
 #define WRITE_LENGTH 5000
 
-#define EI 8
-#define EJ 4
-#define P 1               /* If match length <= P then output one character */
-#define N (1 << EI)       /* buffer size */
-#define F ((1 << EJ) + P) /* lookahead buffer size */
-
 DirectReader::DirectReader(const char *path, const unsigned char *key_table) {
     file_full_path = NULL;
     file_sub_path = NULL;
@@ -77,10 +78,6 @@ DirectReader::DirectReader(const char *path, const unsigned char *key_table) {
         for (i = 0; i < 256; i++) this->key_table[i] = i;
     }
 
-    read_buf = new unsigned char[READ_LENGTH];
-    decomp_buffer = new unsigned char[N * 2];
-    decomp_buffer_len = N * 2;
-
     last_registered_compression_type = &root_registered_compression_type;
     registerCompressionType("NBZ", NBZ_COMPRESSION);
     registerCompressionType("SPB", SPB_COMPRESSION);
@@ -94,8 +91,6 @@ DirectReader::~DirectReader() {
 
     delete[] capital_name;
     delete[] capital_name_tmp;
-    delete[] read_buf;
-    delete[] decomp_buffer;
     delete[] archive_path;
 
     last_registered_compression_type = root_registered_compression_type.next;
@@ -310,6 +305,7 @@ const char *DirectReader::getArchiveName() const { return "direct"; }
 int DirectReader::getNumFiles() { return 0; }
 
 void DirectReader::registerCompressionType(const char *ext, int type) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
     last_registered_compression_type->next =
         new RegisteredCompressionType(ext, type);
     last_registered_compression_type = last_registered_compression_type->next;
@@ -384,6 +380,7 @@ FILE *DirectReader::getFileHandle(const char *file_name,
 }
 
 size_t DirectReader::getFileLength(const char *file_name) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
     int compression_type;
     size_t len;
     FILE *fp = getFileHandle(file_name, compression_type, &len);
@@ -398,14 +395,24 @@ size_t DirectReader::getFile(const char *file_name,
                              int *location) {
     int compression_type;
     size_t len, c, total = 0;
-    FILE *fp = getFileHandle(file_name, compression_type, &len);
+    FILE *fp;
+    {
+        std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+        fp = getFileHandle(file_name, compression_type, &len);
+    }
 
     if (fp) {
         defer([&fp]{fclose(fp);});
-        if (compression_type & NBZ_COMPRESSION)
-            return decodeNBZ(fp, 0, buffer);
-        else if (compression_type & SPB_COMPRESSION)
-            return decodeSPB(fp, 0, buffer);
+        if (compression_type & (NBZ_COMPRESSION | SPB_COMPRESSION)) {
+            ons_fseek64(fp, 0, SEEK_END);
+            size_t src_length = ons_ftell64(fp);
+            ons_fseek64(fp, 0, SEEK_SET);
+            onscripter::Vector<unsigned char> src(src_length);
+            src_length = fread(src.data(), 1, src_length, fp);
+            if (compression_type & NBZ_COMPRESSION)
+                return decodeNBZ(src.data(), src_length, buffer);
+            return decodeSPB(src.data(), src_length, buffer);
+        }
 
         ons_fseek64(fp, 0, SEEK_SET);
         total = len;
@@ -424,6 +431,22 @@ size_t DirectReader::getFile(const char *file_name,
     return total;
 }
 
+BaseReader::FileStream *DirectReader::openFileStream(const char *file_name,
+                                                    int *location) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    int compression_type;
+    size_t len;
+    FILE *fp = getFileHandle(file_name, compression_type, &len);
+    if (fp == NULL) return NULL;
+    if (compression_type != NO_COMPRESSION || len == 0) {
+        fclose(fp);
+        return NULL;
+    }
+    if (location) *location = ARCHIVE_TYPE_NONE;
+
+    return new FileStream(fp, 0, len);
+}
+
 void DirectReader::convertCodingToEUC(char *buf) {
     int i = 0;
     while (buf[i]) {
@@ -484,34 +507,14 @@ void DirectReader::convertFromUTF8ToCoding(char *dst_buf, const char *src_buf) {
     *dst_buf++ = 0;
 }
 
-size_t DirectReader::decodeNBZ(FILE *fp, size_t offset, unsigned char *buf) {
+size_t DirectReader::decodeNBZ(const unsigned char *src,
+                               size_t length,
+                               unsigned char *buf) {
     if (key_table_flag)
         utils::printError("may not decode NBZ with key_table enabled.\n");
 
-    unsigned int original_length, count;
-    BZFILE *bfp;
-    void *unused;
-    int err, len, nunused;
-
-    ons_fseek64(fp, offset, SEEK_SET);
-    original_length = count = readLongBE(fp);
-
-    bfp = BZ2_bzReadOpen(&err, fp, 0, 0, NULL, 0);
-    if (bfp == NULL || err != BZ_OK) return 0;
-
-    while (err == BZ_OK && count > 0) {
-        if (count >= READ_LENGTH)
-            len = BZ2_bzRead(&err, bfp, buf, READ_LENGTH);
-        else
-            len = BZ2_bzRead(&err, bfp, buf, count);
-        count -= len;
-        buf += len;
-    }
-
-    BZ2_bzReadGetUnused(&err, bfp, &unused, &nunused);
-    BZ2_bzReadClose(&err, bfp);
-
-    return original_length - count;
+    return ons_decoder::decodeNBZ(
+        src, length, buf, key_table_flag ? key_table : NULL);
 }
 
 size_t DirectReader::encodeNBZ(FILE *fp, size_t length, unsigned char *buf) {
@@ -537,169 +540,66 @@ size_t DirectReader::encodeNBZ(FILE *fp, size_t length, unsigned char *buf) {
     return bytes_out;
 }
 
-int DirectReader::getbit(FILE *fp, int n) {
-    int i, x = 0;
-    static int getbit_buf;
-
-    for (i = 0; i < n; i++) {
-        if (getbit_mask == 0) {
-            if (getbit_len == getbit_count) {
-                getbit_len = fread(read_buf, 1, READ_LENGTH, fp);
-                if (getbit_len == 0) return EOF;
-                getbit_count = 0;
-            }
-
-            getbit_buf = key_table[read_buf[getbit_count++]];
-            getbit_mask = 128;
-        }
-        x <<= 1;
-        if (getbit_buf & getbit_mask) x++;
-        getbit_mask >>= 1;
-    }
-    return x;
+size_t DirectReader::decodeSPB(const unsigned char *src,
+                               size_t length,
+                               unsigned char *buf) {
+    return ons_decoder::decodeSPB(
+        src, length, buf, key_table_flag ? key_table : NULL);
 }
 
-size_t DirectReader::decodeSPB(FILE *fp, size_t offset, unsigned char *buf) {
-    unsigned int count;
-    unsigned char *pbuf, *psbuf;
-    size_t i, j, k;
-    int c, n, m;
-
-    getbit_mask = 0;
-    getbit_len = getbit_count = 0;
-
-    ons_fseek64(fp, offset, SEEK_SET);
-    size_t width = readShortBE(fp);
-    size_t height = readShortBE(fp);
-
-    size_t width_pad = (4 - width * 3 % 4) % 4;
-
-    size_t total_size = (width * 3 + width_pad) * height + 54;
-
-    /* ---------------------------------------- */
-    /* Write header */
-    memset(buf, 0, 54);
-    buf[0] = 'B';
-    buf[1] = 'M';
-    buf[2] = total_size & 0xff;
-    buf[3] = (total_size >> 8) & 0xff;
-    buf[4] = (total_size >> 16) & 0xff;
-    buf[5] = (total_size >> 24) & 0xff;
-    buf[10] = 54;  // offset to the body
-    buf[14] = 40;  // header size
-    buf[18] = width & 0xff;
-    buf[19] = (width >> 8) & 0xff;
-    buf[22] = height & 0xff;
-    buf[23] = (height >> 8) & 0xff;
-    buf[26] = 1;                // the number of the plane
-    buf[28] = 24;               // bpp
-    buf[34] = total_size - 54;  // size of the body
-
-    buf += 54;
-
-    if (decomp_buffer_len < width * height + 4) {
-        if (decomp_buffer) delete[] decomp_buffer;
-        decomp_buffer_len = width * height + 4;
-        decomp_buffer = new unsigned char[decomp_buffer_len];
-    }
-
-    for (i = 0; i < 3; i++) {
-        count = 0;
-        decomp_buffer[count++] = c = getbit(fp, 8);
-        while (count < (unsigned)(width * height)) {
-            n = getbit(fp, 3);
-            if (n == 0) {
-                decomp_buffer[count++] = c;
-                decomp_buffer[count++] = c;
-                decomp_buffer[count++] = c;
-                decomp_buffer[count++] = c;
-                continue;
-            } else if (n == 7) {
-                m = getbit(fp, 1) + 1;
-            } else {
-                m = n + 2;
-            }
-
-            for (j = 0; j < 4; j++) {
-                if (m == 8) {
-                    c = getbit(fp, 8);
-                } else {
-                    k = getbit(fp, m);
-                    if (k & 1)
-                        c += (k >> 1) + 1;
-                    else
-                        c -= (k >> 1);
-                }
-                decomp_buffer[count++] = c;
-            }
-        }
-
-        pbuf = buf + (width * 3 + width_pad) * (height - 1) + i;
-        psbuf = decomp_buffer;
-
-        for (j = 0; j < height; j++) {
-            if (j & 1) {
-                for (k = 0; k < width; k++, pbuf -= 3) *pbuf = *psbuf++;
-                pbuf -= width * 3 + width_pad - 3;
-            } else {
-                for (k = 0; k < width; k++, pbuf += 3) *pbuf = *psbuf++;
-                pbuf -= width * 3 + width_pad + 3;
-            }
-        }
-    }
-
-    return total_size;
-}
-
-size_t DirectReader::decodeLZSS(struct ArchiveInfo *ai,
-                                int no,
+size_t DirectReader::decodeLZSS(const unsigned char *src,
+                                size_t length,
+                                size_t original_length,
                                 unsigned char *buf) {
-    unsigned int count = 0;
-    int i, j, k, r, c;
-
-    getbit_mask = 0;
-    getbit_len = getbit_count = 0;
-
-    ons_fseek64(ai->file_handle, ai->fi_list[no].offset, SEEK_SET);
-    memset(decomp_buffer, 0, N - F);
-    r = N - F;
-
-    while (count < ai->fi_list[no].original_length) {
-        if (getbit(ai->file_handle, 1)) {
-            if ((c = getbit(ai->file_handle, 8)) == EOF) break;
-            buf[count++] = c;
-            decomp_buffer[r++] = c;
-            r &= (N - 1);
-        } else {
-            if ((i = getbit(ai->file_handle, EI)) == EOF) break;
-            if ((j = getbit(ai->file_handle, EJ)) == EOF) break;
-            for (k = 0; k <= j + 1; k++) {
-                c = decomp_buffer[(i + k) & (N - 1)];
-                buf[count++] = c;
-                decomp_buffer[r++] = c;
-                r &= (N - 1);
-            }
-        }
-    }
-
-    return count;
+    return ons_decoder::decodeLZSS(
+        src, length, buf, original_length, key_table_flag ? key_table : NULL);
 }
 
 size_t DirectReader::getDecompressedFileLength(int type,
                                                FILE *fp,
                                                size_t offset) {
-    size_t length = 0;
-    ons_fseek64(fp, offset, SEEK_SET);
+    unsigned char header[4];
+    size_t len = readAt(fp, offset, header, 4);
+    const unsigned char *table = key_table_flag ? key_table : NULL;
 
-    if (type == NBZ_COMPRESSION) {
-        length = readLongBE(fp);
-    } else if (type == SPB_COMPRESSION) {
-        size_t width = readShortBE(fp);
-        size_t height = readShortBE(fp);
-        size_t width_pad = (4 - width * 3 % 4) % 4;
+    if (type == NBZ_COMPRESSION)
+        return ons_decoder::getNBZLength(header, len, table);
+    else if (type == SPB_COMPRESSION)
+        return ons_decoder::getSPBLength(header, len, table);
 
-        length = (width * 3 + width_pad) * height + 54;
-    }
+    return 0;
+}
 
-    return length;
+size_t DirectReader::readAt(FILE *fp,
+                            size_t offset,
+                            void *buf,
+                            size_t length) {
+    unsigned char *p = (unsigned char *)buf;
+    size_t total = 0;
+#if defined(USE_PREAD)
+    int fd = fileno(fp);
+    while (total < length) {
+        ssize_t ret = pread(fd, p + total, length - total, offset + total);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        total += ret;
+    }
+#elif defined(WIN32) || defined(_WIN32)
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(fp));
+    while (total < length) {
+        unsigned long long pos = offset + total;
+        OVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        ov.Offset = (DWORD)pos;
+        ov.OffsetHigh = (DWORD)(pos >> 32);
+        DWORD n = length - total > 0x40000000 ? 0x40000000 : length - total;
+        DWORD ret = 0;
+        if (!ReadFile(handle, p + total, n, &ret, &ov) || ret == 0) break;
+        total += ret;
+    }
+#else
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    if (ons_fseek64(fp, offset, SEEK_SET) == 0) total = fread(p, 1, length, fp);
+#endif
+    return total;
 }
@@ -27,6 +27,8 @@
 
 #include <string.h>
 
+#include <mutex>
+
 #include "BaseReader.h"
 
 #define MAX_FILE_NAME_LENGTH 256
@@ -49,12 +51,18 @@ class DirectReader : public BaseReader {
     size_t getFile(const char *file_name,
                    unsigned char *buffer,
                    int *location = NULL);
+    FileStream *openFileStream(const char *file_name, int *location = NULL);
 
     static void convertCodingToEUC(char *buf);
     static void convertCodingToUTF8(char *dst_buf, const char *src_buf);
     static void convertFromUTF8ToCoding(char *dst_buf, const char *src_buf);
 
    protected:
+    // file lookups share the scratch buffers below and fill in entry
+    // lengths lazily, so they are serialized for readers used from more
+    // than one thread; the entry data itself is read outside the lock
+    std::recursive_mutex reader_mutex;
+
     char *file_full_path;
     char *file_sub_path;
     size_t file_path_len;
@@ -64,11 +72,6 @@ class DirectReader : public BaseReader {
     char *archive_path;
     unsigned char key_table[256];
     bool key_table_flag;
-    int getbit_mask;
-    size_t getbit_len, getbit_count;
-    unsigned char *read_buf;
-    unsigned char *decomp_buffer;
-    size_t decomp_buffer_len;
 
     struct RegisteredCompressionType {
         RegisteredCompressionType *next;
@@ -106,13 +109,23 @@ class DirectReader : public BaseReader {
     void writeLongBE(FILE *fp, unsigned long ch);
     static unsigned short swapShort(unsigned short ch);
     static unsigned long swapLong(unsigned long ch);
-    size_t decodeNBZ(FILE *fp, size_t offset, unsigned char *buf);
+    // the decoders take the whole compressed entry, see ArchiveDecoder.h
+    size_t decodeNBZ(const unsigned char *src,
+                     size_t length,
+                     unsigned char *buf);
     size_t encodeNBZ(FILE *fp, size_t length, unsigned char *buf);
-    int getbit(FILE *fp, int n);
-    size_t decodeSPB(FILE *fp, size_t offset, unsigned char *buf);
-    size_t decodeLZSS(struct ArchiveInfo *ai, int no, unsigned char *buf);
+    size_t decodeSPB(const unsigned char *src,
+                     size_t length,
+                     unsigned char *buf);
+    size_t decodeLZSS(const unsigned char *src,
+                      size_t length,
+                      size_t original_length,
+                      unsigned char *buf);
     int getRegisteredCompressionType(const char *file_name);
     size_t getDecompressedFileLength(int type, FILE *fp, size_t offset);
+    // reads at offset without moving or depending on the position of fp,
+    // so a shared archive handle can be read from several threads
+    size_t readAt(FILE *fp, size_t offset, void *buf, size_t length);
 
    private:
     FILE *getFileHandle(const char *file_name,
@@ -80,6 +80,7 @@ int NsaReader::open(const char *nsa_path) {
                    archive_name,
                    strlen(archive_name) + 1);
             readArchive(&archive_info_ns2[i], ARCHIVE_TYPE_NS2, nsa_offset);
+            indexArchive(&archive_info_ns2[i], ARCHIVE_TYPE_NS2);
             num_of_ns2_archives = i + 1;
         }
     }
@@ -113,6 +114,7 @@ int NsaReader::open(const char *nsa_path) {
             ai->file_name = new char[strlen(archive_name) + 1]{0};
             memcpy(ai->file_name, archive_name, strlen(archive_name) + 1);
             readArchive(ai, ARCHIVE_TYPE_NSA, nsa_offset);
+            indexArchive(ai, ARCHIVE_TYPE_NSA);
             num_of_nsa_archives = i + 1;
         }
     }
@@ -132,6 +134,7 @@ int NsaReader::openForConvert(char *nsa_name,
     }
 
     readArchive(&archive_info, archive_type, nsa_offset);
+    indexArchive(&archive_info, archive_type);
 
     return 0;
 }
@@ -202,44 +205,20 @@ size_t NsaReader::getFileLengthSubByIndex(ArchiveInfo *ai, unsigned int i) {
     return ai->fi_list[i].original_length;
 }
 
-size_t NsaReader::getFileLengthSub(ArchiveInfo *ai, const char *file_name) {
-    unsigned int i = getIndexFromFile(ai, file_name);
-
-    if (i == ai->num_of_files) return 0;
-
-    if (ai->fi_list[i].original_length != 0)
-        return ai->fi_list[i].original_length;
-
-    int type = ai->fi_list[i].compression_type;
-    if (type == NO_COMPRESSION) type = getRegisteredCompressionType(file_name);
-    if (type == NBZ_COMPRESSION || type == SPB_COMPRESSION) {
-        ai->fi_list[i].original_length = getDecompressedFileLength(
-            type, ai->file_handle, ai->fi_list[i].offset);
-    }
-
-    return ai->fi_list[i].original_length;
-}
-
 size_t NsaReader::getFileLength(const char *file_name) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
     if (sar_flag) return SarReader::getFileLength(file_name);
 
     size_t ret;
-    int i;
-
-    if ((ret = DirectReader::getFileLength(file_name))) return ret;
-
-    for (i = 0; i < num_of_ns2_archives; i++) {
-        if ((ret = getFileLengthSub(&archive_info_ns2[i], file_name)))
-            return ret;
+    if (!isLooseFileAbsent(file_name)) {
+        if ((ret = DirectReader::getFileLength(file_name))) return ret;
+        setLooseFileAbsent(file_name);
     }
 
-    if ((ret = getFileLengthSub(&archive_info, file_name))) return ret;
-
-    for (i = 0; i < num_of_nsa_archives; i++) {
-        if ((ret = getFileLengthSub(&archive_info2[i], file_name))) return ret;
-    }
+    const FileIndex *index = findIndex(file_name);
+    if (!index) return 0;
 
-    return 0;
+    return getFileLengthSubByIndex(index->ai, index->no);
 }
 
 size_t NsaReader::getFile(const char *file_name,
@@ -249,28 +228,24 @@ size_t NsaReader::getFile(const char *file_name,
 
     if (sar_flag) return SarReader::getFile(file_name, buffer, location);
 
-    if ((ret = DirectReader::getFile(file_name, buffer, location))) return ret;
-
-    for (int i = 0; i < num_of_ns2_archives; i++) {
-        if ((ret = getFileSub(&archive_info_ns2[i], file_name, buffer))) {
-            if (location) *location = ARCHIVE_TYPE_NS2;
+    if (!isLooseFileAbsent(file_name)) {
+        if ((ret = DirectReader::getFile(file_name, buffer, location)))
             return ret;
-        }
+        setLooseFileAbsent(file_name);
     }
 
-    if ((ret = getFileSub(&archive_info, file_name, buffer))) {
-        if (location) *location = ARCHIVE_TYPE_NSA;
-        return ret;
+    FileIndex index;
+    {
+        std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+        const FileIndex *found = findIndex(file_name);
+        if (!found) return 0;
+        index = *found;
     }
 
-    for (int i = 0; i < num_of_nsa_archives; i++) {
-        if ((ret = getFileSub(&archive_info2[i], file_name, buffer))) {
-            if (location) *location = ARCHIVE_TYPE_NSA;
-            return ret;
-        }
+    if ((ret = getFileSubByIndex(index.ai, index.no, buffer))) {
+        if (location) *location = index.archive_type;
     }
-
-    return 0;
+    return ret;
 }
 
 BaseReader::ArchiveInfo *NsaReader::getArchiveInfoByIndex(unsigned int index) {
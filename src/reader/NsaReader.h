@@ -76,8 +76,6 @@ class NsaReader : public SarReader {
     const char *ns2_archive_ext;
     ArchiveInfo archive_info2[MAX_EXTRA_ARCHIVE];
     ArchiveInfo archive_info_ns2[MAX_NS2_ARCHIVE];
-
-    size_t getFileLengthSub(ArchiveInfo *ai, const char *file_name);
 };
 
 #endif  // __NSA_READER_H__
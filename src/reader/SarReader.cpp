@@ -40,11 +40,26 @@ extern int psp_power_resume_number;
 #include <strings.h>
 #endif
 
+#ifdef USE_ARCHIVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+struct ArchiveMapping {
+    void *addr;
+    size_t length;
+    ArchiveMapping(void *addr, size_t length) : addr(addr), length(length) {}
+    ~ArchiveMapping() { munmap(addr, length); }
+};
+}  // namespace
+#endif
+
 extern Coding2UTF16 *coding2utf16;
 SarReader::SarReader(const char *path, const unsigned char *key_table)
     : DirectReader(path, key_table) {
     root_archive_info = last_archive_info = &archive_info;
     num_of_sar_archives = 0;
+    num_of_lookups = num_of_lookup_hits = 0;
 }
 
 SarReader::~SarReader() { close(); }
@@ -61,6 +76,7 @@ int SarReader::open(const char *name) {
     memcpy(info->file_name, name, strlen(name) + 1);
 
     readArchive(info);
+    indexArchive(info);
 
     last_archive_info->next = info;
     last_archive_info = last_archive_info->next;
@@ -404,6 +420,13 @@ size_t SarReader::addFile(ArchiveInfo *ai,
 int SarReader::close() {
     ArchiveInfo *info = archive_info.next;
 
+    if (num_of_lookups > 0)
+        utils::printDebug("archive index: %zu lookups, %zu hits, %zu names\n",
+                          num_of_lookups,
+                          num_of_lookup_hits,
+                          file_index.size());
+    file_index.clear();
+
     for (int i = 0; i < num_of_sar_archives; i++) {
         last_archive_info = info;
         info = info->next;
@@ -426,6 +449,58 @@ int SarReader::getNumFiles() {
     return num;
 }
 
+void SarReader::makeIndexKey(onscripter::String &key, const char *file_name) {
+    size_t len = strlen(file_name);
+    if (len > MAX_FILE_NAME_LENGTH) len = MAX_FILE_NAME_LENGTH;
+    key.assign(file_name, len);
+    // same folding as strcasecmp in the C locale, so multi-byte names keep
+    // matching the way the linear scan did
+    for (size_t i = 0; i < len; i++) {
+        char ch = key[i];
+        if (ch == REPLACE_DELIMITER)
+            key[i] = DEFAULT_DELIMITER;
+        else if (ch >= 'A' && ch <= 'Z')
+            key[i] = ch - 'A' + 'a';
+    }
+}
+
+void SarReader::indexArchive(ArchiveInfo *ai, int archive_type) {
+    file_index.reserve(file_index.size() + ai->num_of_files * 2);
+    for (unsigned int i = 0; i < ai->num_of_files; i++) {
+        // emplace keeps an existing key, so earlier archives win
+        makeIndexKey(index_key, ai->fi_list[i].name);
+        file_index.emplace(index_key, FileIndex{ai, i, archive_type, false});
+        makeIndexKey(index_key, ai->fi_list[i].unicode_name);
+        file_index.emplace(index_key, FileIndex{ai, i, archive_type, false});
+    }
+}
+
+const SarReader::FileIndex *SarReader::findIndex(const char *file_name) {
+    num_of_lookups++;
+    makeIndexKey(index_key, file_name);
+    auto it = file_index.find(index_key);
+    if (it == file_index.end()) return NULL;
+    num_of_lookup_hits++;
+    return &it->second;
+}
+
+// the loose file probe fopens the path and may scan directories for its
+// case, so it is made once per archived entry; names no archive holds are
+// always probed
+bool SarReader::isLooseFileAbsent(const char *file_name) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    makeIndexKey(index_key, file_name);
+    auto it = file_index.find(index_key);
+    return it != file_index.end() && it->second.loose_absent;
+}
+
+void SarReader::setLooseFileAbsent(const char *file_name) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    makeIndexKey(index_key, file_name);
+    auto it = file_index.find(index_key);
+    if (it != file_index.end()) it->second.loose_absent = true;
+}
+
 int SarReader::getIndexFromFile(ArchiveInfo *ai, const char *file_name) {
     unsigned int i, len;
 
@@ -447,17 +522,17 @@ int SarReader::getIndexFromFile(ArchiveInfo *ai, const char *file_name) {
 }
 
 size_t SarReader::getFileLength(const char *file_name) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
     size_t ret;
-    if ((ret = DirectReader::getFileLength(file_name))) return ret;
-
-    ArchiveInfo *info = archive_info.next;
-    unsigned int j = 0;
-    for (int i = 0; i < num_of_sar_archives; i++) {
-        j = getIndexFromFile(info, file_name);
-        if (j != info->num_of_files) break;
-        info = info->next;
+    if (!isLooseFileAbsent(file_name)) {
+        if ((ret = DirectReader::getFileLength(file_name))) return ret;
+        setLooseFileAbsent(file_name);
     }
-    if (!info) return 0;
+
+    const FileIndex *index = findIndex(file_name);
+    if (!index) return 0;
+    ArchiveInfo *info = index->ai;
+    unsigned int j = index->no;
 
     if (info->fi_list[j].original_length != 0)
         return info->fi_list[j].original_length;
@@ -477,31 +552,144 @@ size_t SarReader::getFileSubByIndex(ArchiveInfo *ai,
                                     unsigned char *buf) {
     if (i == ai->num_of_files) return 0;
 
+    // only the lookups below touch shared state; the data is read with
+    // positional reads or from the mapping, so several entries can be
+    // read at once
+    int type;
+    bool mapped;
+    {
+        std::lock_guard<std::recursive_mutex> lock(reader_mutex);
 #if defined(PSP)
-    if (ai->power_resume_number != psp_power_resume_number) {
-        FILE *fp = fopen(ai->file_name, "rb");
-        ai->file_handle = fp;
-        ai->power_resume_number = psp_power_resume_number;
+        if (ai->power_resume_number != psp_power_resume_number) {
+            FILE *fp = fopen(ai->file_name, "rb");
+            ai->file_handle = fp;
+            ai->power_resume_number = psp_power_resume_number;
+        }
+#endif
+        type = ai->fi_list[i].compression_type;
+        if (type == NO_COMPRESSION)
+            type = getRegisteredCompressionType(ai->fi_list[i].name);
+        mapped = type != NO_COMPRESSION && mapArchive(ai);
     }
+
+    size_t offset = ai->fi_list[i].offset, length = ai->fi_list[i].length;
+    if (type == NBZ_COMPRESSION || type == LZSS_COMPRESSION ||
+        type == SPB_COMPRESSION) {
+        // decode straight from the mapping when there is one, otherwise
+        // from a single read of the compressed bytes
+        const unsigned char *src = NULL;
+        onscripter::Vector<unsigned char> src_buf;
+        if (mapped && offset <= ai->mapped_length &&
+            length <= ai->mapped_length - offset) {
+            src = ai->mapped_data + offset;
+        } else {
+            src_buf.resize(length);
+            length = readAt(ai->file_handle, offset, src_buf.data(), length);
+            src = src_buf.data();
+        }
+
+        if (type == NBZ_COMPRESSION)
+            return decodeNBZ(src, length, buf);
+        else if (type == LZSS_COMPRESSION)
+            return decodeLZSS(src, length, ai->fi_list[i].original_length, buf);
+        return decodeSPB(src, length, buf);
+    }
+
+    size_t ret = readAt(ai->file_handle, offset, buf, length);
+    if (key_table_flag)
+        for (size_t j = 0; j < ret; j++) buf[j] = key_table[buf[j]];
+    return ret;
+}
+
+bool SarReader::mapArchive(ArchiveInfo *ai) {
+    if (ai->mapped_data) return true;
+    if (ai->map_failed) return false;
+#ifdef USE_ARCHIVE_MMAP
+    struct stat st;
+    int fd = fileno(ai->file_handle);
+    if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+        (unsigned long long)st.st_size <= (size_t)-1) {
+        size_t length = (size_t)st.st_size;
+        void *addr = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED) {
+            ai->mapping = onscripter::MakeShared<ArchiveMapping>(addr, length);
+            ai->mapped_data = (const unsigned char *)addr;
+            ai->mapped_length = length;
+            return true;
+        }
+    }
+    // e.g. a multi-GB archive on a 32-bit address space
+    utils::printError("can't map archive %s, falling back to reads\n",
+                      ai->file_name ? ai->file_name : "");
 #endif
+    ai->map_failed = true;
+    return false;
+}
+
+bool SarReader::getFileViewSubByIndex(ArchiveInfo *ai,
+                                      unsigned int i,
+                                      FileView &view) {
+    if (i >= ai->num_of_files || key_table_flag) return false;
 
     int type = ai->fi_list[i].compression_type;
     if (type == NO_COMPRESSION)
         type = getRegisteredCompressionType(ai->fi_list[i].name);
+    if (type != NO_COMPRESSION) return false;
+
+    if (!mapArchive(ai)) return false;
+    size_t offset = ai->fi_list[i].offset, length = ai->fi_list[i].length;
+    if (offset > ai->mapped_length || length > ai->mapped_length - offset)
+        return false;
+
+    view.data = ai->mapped_data + offset;
+    view.length = length;
+    view.handle = ai->mapping;
+    return true;
+}
 
-    if (type == NBZ_COMPRESSION) {
-        return decodeNBZ(ai->file_handle, ai->fi_list[i].offset, buf);
-    } else if (type == LZSS_COMPRESSION) {
-        return decodeLZSS(ai, i, buf);
-    } else if (type == SPB_COMPRESSION) {
-        return decodeSPB(ai->file_handle, ai->fi_list[i].offset, buf);
+bool SarReader::getFileView(const char *file_name,
+                            FileView &view,
+                            int *location) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    // loose files take precedence over archived ones, as in getFile()
+    if (!isLooseFileAbsent(file_name)) {
+        if (DirectReader::getFileLength(file_name)) return false;
+        setLooseFileAbsent(file_name);
     }
 
-    ons_fseek64(ai->file_handle, ai->fi_list[i].offset, SEEK_SET);
-    size_t ret = fread(buf, 1, ai->fi_list[i].length, ai->file_handle);
-    if (key_table_flag)
-        for (size_t j = 0; j < ret; j++) buf[j] = key_table[buf[j]];
-    return ret;
+    const FileIndex *index = findIndex(file_name);
+    if (!index || !getFileViewSubByIndex(index->ai, index->no, view))
+        return false;
+    if (location) *location = index->archive_type;
+
+    return true;
+}
+
+BaseReader::FileStream *SarReader::openFileStream(const char *file_name,
+                                                 int *location) {
+    std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+    // loose files take precedence over archived ones, as in getFile()
+    if (!isLooseFileAbsent(file_name)) {
+        if (DirectReader::getFileLength(file_name))
+            return DirectReader::openFileStream(file_name, location);
+        setLooseFileAbsent(file_name);
+    }
+
+    const FileIndex *index = findIndex(file_name);
+    if (!index) return NULL;
+    ArchiveInfo *ai = index->ai;
+    FileInfo &fi = ai->fi_list[index->no];
+    int type = fi.compression_type;
+    if (type == NO_COMPRESSION) type = getRegisteredCompressionType(fi.name);
+    if (type != NO_COMPRESSION) return NULL;
+
+    // the archive handle is shared with getFile(), so open another one
+    FILE *fp = fopen(ai->file_name, "rb");
+    if (fp == NULL) return NULL;
+    if (location) *location = index->archive_type;
+
+    return new FileStream(
+        fp, fi.offset, fi.length, key_table_flag ? key_table : NULL);
 }
 
 size_t SarReader::getFileSub(ArchiveInfo *ai,
@@ -515,17 +703,21 @@ size_t SarReader::getFile(const char *file_name,
                           unsigned char *buf,
                           int *location) {
     size_t ret;
-    if ((ret = DirectReader::getFile(file_name, buf, location))) return ret;
+    if (!isLooseFileAbsent(file_name)) {
+        if ((ret = DirectReader::getFile(file_name, buf, location))) return ret;
+        setLooseFileAbsent(file_name);
+    }
 
-    ArchiveInfo *info = archive_info.next;
-    size_t j = 0;
-    for (int i = 0; i < num_of_sar_archives; i++) {
-        if ((j = getFileSub(info, file_name, buf)) > 0) break;
-        info = info->next;
+    FileIndex index;
+    {
+        std::lock_guard<std::recursive_mutex> lock(reader_mutex);
+        const FileIndex *found = findIndex(file_name);
+        if (!found) return 0;
+        index = *found;
     }
     if (location) *location = ARCHIVE_TYPE_SAR;
 
-    return j;
+    return getFileSubByIndex(index.ai, index.no, buf);
 }
 
 SarReader::FileInfo SarReader::getFileByIndex(unsigned int index) {
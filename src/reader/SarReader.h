@@ -24,6 +24,8 @@
 #ifndef __SAR_READER_H__
 #define __SAR_READER_H__
 
+#include <config.hpp>
+
 #include "DirectReader.h"
 
 class SarReader : public DirectReader {
@@ -40,10 +42,17 @@ class SarReader : public DirectReader {
     size_t getFile(const char *file_name,
                    unsigned char *buf,
                    int *location = NULL);
+    bool getFileView(const char *file_name,
+                     FileView &view,
+                     int *location = NULL);
+    FileStream *openFileStream(const char *file_name, int *location = NULL);
     FileInfo getFileByIndex(unsigned int index);
     size_t getFileSubByIndex(ArchiveInfo *ai,
                              unsigned int index,
                              unsigned char *buf);
+    bool getFileViewSubByIndex(ArchiveInfo *ai,
+                               unsigned int index,
+                               FileView &view);
 
     int writeHeader(FILE *fp);
     size_t putFile(FILE *fp,
@@ -59,11 +68,35 @@ class SarReader : public DirectReader {
                    size_t offset,
                    unsigned char *buffer);
 
+    size_t getNumLookups() const { return num_of_lookups; }
+    size_t getNumLookupHits() const { return num_of_lookup_hits; }
+
    protected:
     ArchiveInfo archive_info;
     ArchiveInfo *root_archive_info, *last_archive_info;
     int num_of_sar_archives;
 
+    // name (case-folded, '/' delimited) -> entry of the first archive that
+    // contains it, filled in the same order the archives are searched
+    struct FileIndex {
+        ArchiveInfo *ai;
+        unsigned int no;
+        int archive_type;
+        // no loose file was found for this entry, so it is not looked for
+        // again; one added while the game runs does not override it
+        bool loose_absent;
+    };
+    onscripter::UnorderedMap<onscripter::String, FileIndex> file_index;
+    onscripter::String index_key;
+    size_t num_of_lookups, num_of_lookup_hits;
+
+    void indexArchive(ArchiveInfo *ai, int archive_type = ARCHIVE_TYPE_SAR);
+    static void makeIndexKey(onscripter::String &key, const char *file_name);
+    const FileIndex *findIndex(const char *file_name);
+    bool isLooseFileAbsent(const char *file_name);
+    void setLooseFileAbsent(const char *file_name);
+    bool mapArchive(ArchiveInfo *ai);
+
     void readArchive(ArchiveInfo *ai,
                      int archive_type = ARCHIVE_TYPE_SAR,
                      unsigned int offset = 0);
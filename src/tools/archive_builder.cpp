@@ -0,0 +1,320 @@
+/* -*- C++ -*-
+ *
+ *  archive_builder.cpp - Shared archive writer of nsaenc and arcmake
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "archive_builder.h"
+
+#include <bzlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+
+#include "ArchiveDecoder.h"
+#include "private/utils.h"
+
+// a listed directory and what it holds, in the order it was read
+struct ListedDir {
+    struct Item {
+        ArchiveBuilder::Entry file;
+        ListedDir *dir;  // NULL for a file
+    };
+    onscripter::String path, name;
+    onscripter::Vector<Item> items;
+};
+
+static bool readDir(
+    ListedDir *dir,
+    const ArchiveBuilder::Filter &skip,
+    onscripter::Vector<onscripter::UniquePtr<ListedDir>> &found) {
+    std::error_code ec;
+    onscripter::fs::directory_iterator it(dir->path, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        const onscripter::fs::path &path = it->path();
+        if (skip && skip(path)) continue;
+
+        ListedDir::Item item;
+        item.dir = NULL;
+        onscripter::String name = dir->name + path.filename().string();
+        if (onscripter::fs::is_directory(it->status(ec))) {
+            found.push_back(onscripter::MakeUnique<ListedDir>());
+            item.dir = found.back().get();
+            item.dir->path = path.string();
+            item.dir->name = name + '/';
+        } else {
+            item.file.path = path.string();
+            item.file.name = name;
+        }
+        dir->items.push_back(item);
+    }
+    if (ec) {
+        fprintf(stderr,
+                "can't read directory %s: %s\n",
+                dir->path.c_str(),
+                ec.message().c_str());
+        return false;
+    }
+    return true;
+}
+
+static void flattenDir(const ListedDir *dir,
+                       onscripter::Vector<ArchiveBuilder::Entry> &files) {
+    for (const auto &item : dir->items) {
+        if (item.dir)
+            flattenDir(item.dir, files);
+        else
+            files.push_back(item.file);
+    }
+}
+
+bool ArchiveBuilder::listFiles(const onscripter::String &dir,
+                               const onscripter::String &prefix,
+                               const Filter &skip,
+                               int num_threads,
+                               onscripter::Vector<Entry> &files) {
+    onscripter::Vector<onscripter::UniquePtr<ListedDir>> dirs;
+    dirs.push_back(onscripter::MakeUnique<ListedDir>());
+    dirs[0]->path = dir;
+    dirs[0]->name = prefix;
+
+    onscripter::Vector<ListedDir *> pending(1, dirs[0].get());
+    std::mutex mutex;
+    std::condition_variable cond;
+    int busy = 0;
+    bool ok = true;
+
+    // each thread reads one directory at a time and queues the ones in it
+    auto reader = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (1) {
+            cond.wait(lock, [&] { return !pending.empty() || busy == 0; });
+            if (pending.empty()) return;
+            ListedDir *current = pending.back();
+            pending.pop_back();
+            busy++;
+            lock.unlock();
+
+            onscripter::Vector<onscripter::UniquePtr<ListedDir>> found;
+            bool read_ok = readDir(current, skip, found);
+
+            lock.lock();
+            busy--;
+            if (read_ok) {
+                for (auto &it : found) {
+                    pending.push_back(it.get());
+                    dirs.push_back(std::move(it));
+                }
+            } else {
+                ok = false;
+                pending.clear();
+            }
+            cond.notify_all();
+        }
+    };
+
+    onscripter::Vector<std::thread> threads;
+    for (int i = 1; i < num_threads; i++) threads.emplace_back(reader);
+    reader();
+    for (auto &thread : threads) thread.join();
+
+    if (ok) flattenDir(dirs[0].get(), files);
+    return ok;
+}
+
+// the NBZ form of src: its length in big endian and a bzip2 stream made
+// with the settings of DirectReader::encodeNBZ, so the bytes are the same
+static bool compressNBZ(const unsigned char *src,
+                        size_t length,
+                        onscripter::Vector<unsigned char> &dst) {
+    bz_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (BZ2_bzCompressInit(&strm, 9, 0, 30) != BZ_OK) return false;
+
+    dst.resize(4 + length / 4 + 4096);
+    for (int i = 0; i < 4; i++) dst[i] = (length >> (24 - i * 8)) & 0xff;
+
+    // bz_stream counts in unsigned int, so feed large files in pieces
+    const size_t chunk = 1u << 30;
+    const unsigned char *in = src, *in_end = src + length;
+    size_t out = 4;
+    int err = BZ_RUN_OK;
+    while (err == BZ_RUN_OK || err == BZ_FINISH_OK) {
+        if (strm.avail_in == 0 && in < in_end) {
+            size_t n = (size_t)(in_end - in) < chunk ? in_end - in : chunk;
+            strm.next_in = (char *)in;
+            strm.avail_in = n;
+            in += n;
+        }
+        if (out == dst.size()) dst.resize(dst.size() * 2);
+        size_t room = dst.size() - out;
+        strm.next_out = (char *)&dst[out];
+        strm.avail_out = room < chunk ? room : chunk;
+        err = BZ2_bzCompress(&strm, in == in_end ? BZ_FINISH : BZ_RUN);
+        out = (unsigned char *)strm.next_out - &dst[0];
+    }
+    BZ2_bzCompressEnd(&strm);
+
+    dst.resize(out);
+    return err == BZ_STREAM_END;
+}
+
+ArchiveBuilder::ArchiveBuilder(const Classifier &classify,
+                               const Reporter &report,
+                               int num_workers)
+    : classify(classify),
+      report(report),
+      num_workers(num_workers > 0 ? num_workers : 1),
+      ai(NULL),
+      files(NULL),
+      next_job(0),
+      next_write(0),
+      pending_bytes(0),
+      exit_flag(false) {}
+
+bool ArchiveBuilder::build(BaseReader::ArchiveInfo *ai,
+                           const onscripter::Vector<Entry> &files) {
+    this->ai = ai;
+    this->files = &files;
+    jobs.clear();
+    jobs.resize(files.size());
+    for (auto &job : jobs) {
+        job.state = QUEUED;
+        job.reserved = 0;
+    }
+    next_job = next_write = pending_bytes = 0;
+    exit_flag = false;
+
+    onscripter::Vector<std::thread> workers;
+    for (int i = 0; i < num_workers; i++)
+        workers.emplace_back(&ArchiveBuilder::workerMain, this);
+
+    auto start = utils::now();
+    size_t offset = ai->base_offset, total_length = 0;
+    bool ok = ons_fseek64(ai->file_handle, offset, SEEK_SET) == 0;
+    for (size_t no = 0; ok && no < files.size(); no++) {
+        Job &job = jobs[no];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return job.state != QUEUED; });
+        }
+
+        BaseReader::FileInfo &fi = ai->fi_list[no];
+        if (job.state == FAILED) {
+            fprintf(stderr,
+                    "can't read file %s, exiting\n",
+                    files[no].path.c_str());
+            ok = false;
+        } else if (fwrite(job.data.data(),
+                          1,
+                          job.data.size(),
+                          ai->file_handle) != job.data.size()) {
+            fprintf(stderr, "Write error adding archive item %d\n", (int)no);
+            ok = false;
+        } else {
+            fi.offset = offset;
+            offset += fi.length;
+            total_length += fi.original_length;
+            report((int)no, fi);
+        }
+
+        onscripter::Vector<unsigned char>().swap(job.data);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending_bytes -= job.reserved;
+            next_write++;
+        }
+        cond.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        exit_flag = true;
+    }
+    cond.notify_all();
+    for (auto &worker : workers) worker.join();
+
+    if (ok) {
+        float seconds = utils::duration(start) / 1000;
+        double mb = total_length / 1048576.0;
+        printf("%d files, %.1f MB -> %.1f MB in %.1f s "
+               "(%.1f MB/s, %d workers)\n",
+               (int)files.size(),
+               mb,
+               (offset - ai->base_offset) / 1048576.0,
+               seconds,
+               seconds > 0 ? mb / seconds : 0.0,
+               num_workers);
+    }
+    return ok;
+}
+
+void ArchiveBuilder::workerMain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!exit_flag && next_job < jobs.size()) {
+        size_t no = next_job++;
+        lock.unlock();
+        bool ok = load(no);
+        lock.lock();
+        jobs[no].state = ok ? READY : FAILED;
+        cond.notify_all();
+    }
+}
+
+bool ArchiveBuilder::load(size_t no) {
+    Job &job = jobs[no];
+    BaseReader::FileInfo &fi = ai->fi_list[no];
+
+    FILE *fp = ::fopen((*files)[no].path.c_str(), "rb");
+    if (fp == NULL) return false;
+    defer([&fp] { fclose(fp); });
+    ons_fseek64(fp, 0, SEEK_END);
+    size_t length = ons_ftell64(fp);
+    ons_fseek64(fp, 0, SEEK_SET);
+
+    // the file the writer needs next is always let through
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] {
+            return exit_flag || no == next_write ||
+                   pending_bytes + length <= MAX_PENDING_BYTES;
+        });
+        if (exit_flag) return false;
+        pending_bytes += length;
+        job.reserved = length;
+    }
+
+    onscripter::Vector<unsigned char> buffer(length);
+    if (fread(buffer.data(), 1, length, fp) != length) return false;
+
+    fi.compression_type = classify(fi, buffer.data(), length);
+    fi.length = fi.original_length = length;
+    if (fi.compression_type == BaseReader::NBZ_COMPRESSION) {
+        if (length > 3 && buffer[2] == 'B' && buffer[3] == 'Z') {
+            // already compressed, stored as it is
+            fi.original_length =
+                ons_decoder::getNBZLength(buffer.data(), length, NULL);
+        } else {
+            if (!compressNBZ(buffer.data(), length, job.data)) return false;
+            fi.length = job.data.size();
+            return true;
+        }
+    }
+    job.data.swap(buffer);
+
+    return true;
+}
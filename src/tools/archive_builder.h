@@ -0,0 +1,98 @@
+/* -*- C++ -*-
+ *
+ *  archive_builder.h - Shared archive writer of nsaenc and arcmake
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef __ARCHIVE_BUILDER_H__
+#define __ARCHIVE_BUILDER_H__
+
+#include <condition_variable>
+#include <config.hpp>
+#include <functional>
+#include <mutex>
+
+#include "BaseReader.h"
+
+// Writes the files of an archive in three stages: the directories are read
+// on several threads, workers read and compress the files, and the calling
+// thread writes them to the archive in order, so the output is the same as
+// writing them one at a time. Files waiting to be written are limited to
+// MAX_PENDING_BYTES, except the one the writer needs next.
+class ArchiveBuilder {
+   public:
+    enum { MAX_PENDING_BYTES = 256 << 20 };
+
+    struct Entry {
+        onscripter::String path;  // to open the file with
+        onscripter::String name;  // relative to the listed directory
+    };
+    // true to leave a file or directory out of the listing
+    typedef std::function<bool(const onscripter::fs::path &path)> Filter;
+    // picks the compression of a file from its name and contents; runs on
+    // a worker thread
+    typedef std::function<int(const BaseReader::FileInfo &fi,
+                              const unsigned char *data,
+                              size_t length)>
+        Classifier;
+    // called on the writing thread after each file
+    typedef std::function<void(int no, const BaseReader::FileInfo &fi)>
+        Reporter;
+
+    // appends the files under dir depth-first, each directory in the order
+    // it is read, so the list is the one a recursive walk gives; names are
+    // prefix followed by the path under dir, separated by '/'
+    static bool listFiles(const onscripter::String &dir,
+                          const onscripter::String &prefix,
+                          const Filter &skip,
+                          int num_threads,
+                          onscripter::Vector<Entry> &files);
+
+    ArchiveBuilder(const Classifier &classify,
+                   const Reporter &report,
+                   int num_workers);
+
+    // writes files[i] as ai->fi_list[i] from ai->base_offset on, filling in
+    // their offsets, lengths and compression; the header is left to the
+    // caller, since its size is known from the names alone
+    bool build(BaseReader::ArchiveInfo *ai,
+               const onscripter::Vector<Entry> &files);
+
+   private:
+    enum State { QUEUED, READY, FAILED };
+    struct Job {
+        State state;
+        size_t reserved;  // counted in pending_bytes until written
+        onscripter::Vector<unsigned char> data;
+    };
+
+    void workerMain();
+    bool load(size_t no);
+
+    Classifier classify;
+    Reporter report;
+    int num_workers;
+
+    BaseReader::ArchiveInfo *ai;
+    const onscripter::Vector<Entry> *files;
+    onscripter::Vector<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable cond;
+    size_t next_job, next_write, pending_bytes;
+    bool exit_flag;
+};
+
+#endif  // __ARCHIVE_BUILDER_H__
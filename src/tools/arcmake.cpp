@@ -27,18 +27,16 @@
  *  59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
-#include <dirent.h>
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
 
 #include <config.hpp>
+#include <thread>
 
 #define NSA 1
 
+#include "archive_builder.h"
 #include "coding2utf16.h"
 #include "gbk2utf16.h"
 
@@ -56,70 +54,14 @@ typedef NsaReader reader;
 
 Coding2UTF16 *coding2utf16 = new GBK2UTF16();
 
-struct dirnode {
-    DIR *dir;
-    int namelen;
-    dirnode *next;
-    dirnode *prev;
-    dirnode() : dir(NULL), namelen(0), next(NULL), prev(NULL) {}
-};
-static dirnode dirn;
-
-int processFile(reader::ArchiveInfo *ai,
-                reader::FileInfo *fi,
-                char *fullname,
-                char *name,
-                unsigned long &offset,
-                bool enhanced_flag) {
-    FILE *fp = NULL;
-    char magic[5];
-    char fullpath[512];
-
+void processFile(reader::ArchiveInfo *ai,
+                 reader::FileInfo *fi,
+                 const char *name) {
     strcpy(fi->name, name);
     for (unsigned int j = 0; j < strlen(fi->name); j++) {
         if (fi->name[j] == '/') fi->name[j] = '\\';
     }
-    strcpy(fullpath, fullname);
-    for (unsigned int j = 0; j < strlen(fullpath); j++) {
-        if ((fullpath[j] == '/') || (fullpath[j] == '\\'))
-            fullpath[j] = DELIMITER;
-    }
-    if ((fp = fopen(fullpath, "rb")) == NULL) {
-        fprintf(stderr, "can't open file %s, skipping\n", fullpath);
-        return -1;
-    }
-    defer([&fp]{fclose(fp);});
-    ons_fseek64(fp, 0, SEEK_END);
-    fi->length = ons_ftell64(fp);
-    ons_fseek64(fp, 0, SEEK_SET);
-    magic[0] = 0;
-    int len = fread(magic, 1, 4, fp);
-    magic[len] = 0;
 
-    if ((strstr(fi->name, ".nbz") != NULL) ||
-        (strstr(fi->name, ".NBZ") != NULL))
-        fi->compression_type = BaseReader::NBZ_COMPRESSION;
-#ifdef NSA
-    else if (enhanced_flag && ((((strstr(fi->name, ".bmp") != NULL) ||
-                                 (strstr(fi->name, ".BMP") != NULL)) &&
-                                (magic[0] == 'B') && (magic[1] == 'M')) ||
-                               (((strstr(fi->name, ".wav") != NULL) ||
-                                 (strstr(fi->name, ".WAV") != NULL)) &&
-                                (magic[0] == 'R') && (magic[1] == 'I') &&
-                                (magic[2] == 'F') && (magic[3] == 'F')) ||
-                               (strstr(fi->name, ".ogg") != NULL) ||
-                               strstr(fi->name, ".ogg") != NULL)) {
-        // If enhanced, use NBZ compression on (true) BMP & WAV files in NSA
-        // archive
-        fi->compression_type = BaseReader::NBZ_COMPRESSION;
-    }
-#endif
-    else
-        fi->compression_type = BaseReader::NO_COMPRESSION;
-
-    fi->original_length = fi->length;
-    fi->offset = offset;
-    offset += fi->length;
 #if defined(SAR)
     ai->base_offset += strlen(fi->name) + 9;  //'\0', offset, length
 #elif defined(NSA)
@@ -130,23 +72,53 @@ int processFile(reader::ArchiveInfo *ai,
 #endif
 
     ai->num_of_files++;
-    return 0;
+}
+
+// runs on the workers of ArchiveBuilder, once the file is read
+int compressionType(const reader::FileInfo &fi,
+                    const unsigned char *data,
+                    size_t length,
+                    bool enhanced_flag) {
+    char magic[5]{0};
+    memcpy(magic, data, length < 4 ? length : 4);
+
+#ifdef NSA
+    if (!enhanced_flag) return BaseReader::NO_COMPRESSION;
+#endif
+    if ((strstr(fi.name, ".nbz") != NULL) || (strstr(fi.name, ".NBZ") != NULL))
+        return BaseReader::NBZ_COMPRESSION;
+#ifdef NSA
+    if ((((strstr(fi.name, ".bmp") != NULL) ||
+          (strstr(fi.name, ".BMP") != NULL)) &&
+         (magic[0] == 'B') && (magic[1] == 'M')) ||
+        (((strstr(fi.name, ".wav") != NULL) ||
+          (strstr(fi.name, ".WAV") != NULL)) &&
+         (magic[0] == 'R') && (magic[1] == 'I') && (magic[2] == 'F') &&
+         (magic[3] == 'F')) ||
+        (strstr(fi.name, ".ogg") != NULL)) {
+        // If enhanced, use NBZ compression on (true) BMP & WAV files in NSA
+        // archive
+        return BaseReader::NBZ_COMPRESSION;
+    }
+#endif
+    return BaseReader::NO_COMPRESSION;
+}
+
+// don't process dotted files/dirs
+bool skipFile(const onscripter::fs::path &path) {
+    return path.filename().string()[0] == '.';
 }
 
 int main(int argc, char **argv) {
     reader cSR;
-    unsigned long length, offset = 0, buffer_length = 0;
-    unsigned char *buffer = NULL;
-    char file_name[512], file_path[512], *indir = NULL, *arcname = NULL;
-    unsigned int i, count, total;
+    char *indir = NULL, *arcname = NULL;
 #if defined(NS2)
     int archive_type = BaseReader::ARCHIVE_TYPE_NS2;
 #elif defined(NSA)
     int archive_type = BaseReader::ARCHIVE_TYPE_NSA;
 #endif
     bool enhanced_flag = false;
-    FILE *fp = NULL;
-    char *fnptr = (char *)&file_name;
+    int num_threads = std::thread::hardware_concurrency();
 
     argc--;  // skip command name
     argv++;
@@ -155,6 +127,11 @@ int main(int argc, char **argv) {
         argc--;
         argv++;
     }
+    if ((argc > 1) && !strcmp(argv[0], "-j")) {
+        num_threads = atoi(argv[1]);
+        argc -= 2;
+        argv += 2;
+    }
 #ifdef NSA
     if ((argc > 0) && !strcmp(argv[0], "-e")) {
         enhanced_flag = true;
@@ -168,212 +145,124 @@ int main(int argc, char **argv) {
     }
     if (!indir && (argc < 1)) {
 #if defined(SAR)
-        fprintf(stderr, "Usage: sarmake arc_file -d in_dir\n");
-        fprintf(stderr, "       sarmake arc_file in_file(s)\n");
+        fprintf(stderr, "Usage: sarmake arc_file [-j threads] -d in_dir\n");
+        fprintf(stderr, "       sarmake arc_file [-j threads] in_file(s)\n");
 #elif defined(NS2)
-        fprintf(stderr, "Usage: ns2make arc_file -d in_dir\n");
-        fprintf(stderr, "       ns2make arc_file in_file(s)\n");
+        fprintf(stderr, "Usage: ns2make arc_file [-j threads] -d in_dir\n");
+        fprintf(stderr, "       ns2make arc_file [-j threads] in_file(s)\n");
 #else
-        fprintf(stderr, "Usage: nsamake arc_file [-e] -d in_dir\n");
-        fprintf(stderr, "       nsamake arc_file [-e] in_file(s)\n");
+        fprintf(stderr,
+                "Usage: nsamake arc_file [-j threads] [-e] -d in_dir\n");
+        fprintf(stderr,
+                "       nsamake arc_file [-j threads] [-e] in_file(s)\n");
 #endif
         exit(-1);
     }
 
     reader::ArchiveInfo *sAI;
-#ifdef SAR
+#if defined(SAR)
     if ((sAI = cSR.openForCreate(arcname)) == NULL) {
-#elseif defined(NS2)
-        if ((sAI = cSR.openForCreate(arcname, archive_type, 1)) == NULL) {
+#elif defined(NS2)
+    if ((sAI = cSR.openForCreate(arcname, archive_type, 1)) == NULL) {
 #else
     if ((sAI = cSR.openForCreate(arcname, archive_type, 0)) == NULL) {
 #endif
-            fprintf(stderr, "can't open file %s for writing.\n", arcname);
+        fprintf(stderr, "can't open file %s for writing.\n", arcname);
+        exit(-1);
+    }
+
+    // the files in the order a recursive walk finds them
+    onscripter::Vector<ArchiveBuilder::Entry> files;
+    if (indir) {
+        printf("using directory %s\n", indir);
+        if (!onscripter::fs::is_directory(indir)) {
+            if (onscripter::fs::exists(indir))
+                fprintf(stderr, "'%s' is not a directory\n", indir);
+            else
+                fprintf(stderr, "can't open directory '%s'\n", indir);
             exit(-1);
         }
-
-        if (indir) printf("using directory %s\n", indir);
-
-        total = 0;
-        reader::FileInfo *sFI = NULL;
-
-        for (int t = 0; t < 2; t++) {
-            // recurse through directories
-            // first pass - count, second pass - process file info
-            fnptr = (char *)&file_name;
-            dirnode *cur = &dirn;
-            int j = 0;
-            count = 0;
-            if (indir) j = -1;
-            cur->dir = NULL;
-            cur->next = cur->prev = NULL;
-            cur->namelen = 0;
-
-            while (j < argc) {
-                if (indir) {
-                    cur->dir = opendir(indir);
-                    if (!cur->dir) {
-                        if (errno == ENOTDIR)
-                            fprintf(stderr, "'%s' is not a directory\n", indir);
-                        else
-                            fprintf(
-                                stderr, "can't open directory '%s'\n", indir);
-                        exit(-1);
-                    }
-                    sprintf(fnptr, "%s%c", indir, DELIMITER);
-                    fnptr += strlen(indir) + 1;
-                } else {
-                    if (strlen(argv[j]) > 255) {
-                        fprintf(stderr, "filename too long: %s\n", argv[j]);
-                        continue;
-                    }
-                    sprintf(fnptr, "%s", argv[j]);
-                    cur->dir = opendir(file_name);
-                    if (!cur->dir) {
-                        if (errno == ENOTDIR) {
-                            if (t) {
-                                processFile(sAI,
-                                            sFI,
-                                            (char *)&file_name,
-                                            fnptr,
-                                            offset,
-                                            enhanced_flag);
-                                sFI++;
-                            }
-                            count++;
-                        } else {
-                            fprintf(
-                                stderr, "can't open directory '%s'\n", fnptr);
-                            exit(-1);
-                        }
-                        j++;
-                        continue;
-                    } else {
-                        cur->namelen = strlen(fnptr);
-                        fnptr[cur->namelen] = DELIMITER;
-                        cur->namelen++;
-                    }
-                }
-                struct dirent *drnt = NULL;
-                while (1) {
-                    if ((drnt = readdir(cur->dir)) == NULL) {
-                        closedir(cur->dir);
-                        if (cur->prev == NULL) break;
-                        cur = cur->prev;
-                        delete cur->next;
-                        cur->next = NULL;
-                    } else {
-                        if (drnt->d_name[0] !=
-                            '.') {  // don't process dotted files/dirs
-                            sprintf(fnptr + cur->namelen, "%s", drnt->d_name);
-                            DIR *dir = opendir(file_name);
-                            if (dir) {
-                                cur->next = new dirnode;
-                                cur->next->prev = cur;
-                                cur->next->namelen =
-                                    cur->namelen + strlen(drnt->d_name);
-                                cur = cur->next;
-                                cur->dir = dir;
-                                fnptr[cur->namelen] = DELIMITER;
-                                cur->namelen++;
-                            } else {
-                                if (t) {
-                                    processFile(sAI,
-                                                sFI,
-                                                (char *)&file_name,
-                                                fnptr,
-                                                offset,
-                                                enhanced_flag);
-                                    sFI++;
-                                }
-                                count++;
-                            }
-                        }
-                    }
-                }
-                j++;
+        if (!ArchiveBuilder::listFiles(indir, "", skipFile, num_threads, files))
+            exit(-1);
+    }
+    for (int j = 0; j < argc; j++) {
+        if (strlen(argv[j]) > 255) {
+            fprintf(stderr, "filename too long: %s\n", argv[j]);
+            continue;
+        }
+        if (onscripter::fs::is_directory(argv[j])) {
+            onscripter::String prefix = argv[j];
+            if (!ArchiveBuilder::listFiles(
+                    argv[j], prefix + DELIMITER, skipFile, num_threads, files))
+                exit(-1);
+        } else if (onscripter::fs::exists(argv[j])) {
+            ArchiveBuilder::Entry entry;
+            entry.path = entry.name = argv[j];
+            for (auto &ch : entry.path) {
+                if ((ch == '/') || (ch == '\\')) ch = DELIMITER;
             }
-            total = count;
-            if (!t) {
-                sAI->num_of_files = 0;
+            files.push_back(entry);
+        } else {
+            fprintf(stderr, "can't open directory '%s'\n", argv[j]);
+            exit(-1);
+        }
+    }
+
+    sAI->num_of_files = 0;
 #ifdef NS2
-                sAI->base_offset = 5;
+    sAI->base_offset = 5;
 #else
-            sAI->base_offset = 6;
+    sAI->base_offset = 6;
 #endif
-                offset = 0;
-                sAI->fi_list = new reader::FileInfo[count];
-                sFI = sAI->fi_list;
-            }
-        }
+    sAI->fi_list = new reader::FileInfo[files.size()];
+    for (size_t i = 0; i < files.size(); i++)
+        processFile(sAI, &sAI->fi_list[i], files[i].name.c_str());
+
 #if defined(SAR)
-        printf("creating SAR archive '%s', %d files total\n", arcname, total);
+    printf("creating SAR archive '%s', %d files total\n",
+           arcname,
+           (int)files.size());
 #elif defined(NS2)
-    printf("creating NS2 archive '%s', %d files total\n", arcname, total);
+    printf("creating NS2 archive '%s', %d files total\n",
+           arcname,
+           (int)files.size());
 #else
-printf("creating NSA archive '%s', %d files total\n", arcname, total);
+    printf("creating NSA archive '%s', %d files total\n",
+           arcname,
+           (int)files.size());
 #endif
-        fflush(stdout);
+    fflush(stdout);
 
-        sFI = sAI->fi_list;
-        for (i = 0; i < sAI->num_of_files; i++, sFI++)
-            sFI->offset += sAI->base_offset;
-#ifdef SAR
-        cSR.writeHeader(sAI->file_handle);
-#else
-    cSR.writeHeader(sAI->file_handle, archive_type);
-#endif
-        sFI = sAI->fi_list;
-#ifdef NSA
-        unsigned long offset_sub = 0;
-#endif
-        for (i = 0; i < sAI->num_of_files; i++, sFI++) {
-            // now add the file
+    ArchiveBuilder builder(
+        [enhanced_flag](const reader::FileInfo &fi,
+                        const unsigned char *data,
+                        size_t length) {
+            return compressionType(fi, data, length, enhanced_flag);
+        },
+        [sAI](int no, const reader::FileInfo &fi) {
             printf("adding %d of %d (%s), length=%d\n",
-                   i + 1,
+                   no + 1,
                    sAI->num_of_files,
-                   sFI->name,
-                   (int)sFI->original_length);
-            fflush(stdout);
-            length = sFI->original_length;
-            if (length > buffer_length) {
-                if (buffer) delete[] buffer;
-                buffer = new unsigned char[length];
-                buffer_length = length;
-            }
-            sprintf(fnptr, "%s", sFI->name);
-            sprintf(file_path, "%s", file_name);
-            for (unsigned int j = 0; j < strlen(file_path); j++) {
-                if ((file_path[j] == '\\') || (file_path[j] == '/'))
-                    file_path[j] = DELIMITER;
-            }
-            if ((fp = fopen(file_path, "rb")) == NULL) {
-                fprintf(stderr, "can't open file %s, exiting\n", file_path);
-                exit(-1);
-            }
+                   fi.name,
+                   (int)fi.original_length);
 #ifdef NSA
-            if (!enhanced_flag)
-                sFI->compression_type = BaseReader::NO_COMPRESSION;
-            sFI->offset -= offset_sub;
-            cSR.addFile(sAI, fp, i, sFI->offset, buffer);
-            if (sFI->original_length != sFI->length) {
-                offset_sub += sFI->original_length - sFI->length;
+            if (fi.original_length != fi.length) {
                 printf("    NBZ compressed: %d -> %d (%d%%)\n",
-                       (int)sFI->original_length,
-                       (int)sFI->length,
-                       (int)(sFI->length * 100 / sFI->original_length));
+                       (int)fi.original_length,
+                       (int)fi.length,
+                       (int)(fi.length * 100 / fi.original_length));
             }
-#else
-        cSR.addFile(sAI, fp, i, sFI->offset, buffer);
-#endif
-            fclose(fp);
-        }
-#ifdef NSA
-        cSR.writeHeader(sAI->file_handle, archive_type);
 #endif
-        fclose(sAI->file_handle);
+            fflush(stdout);
+        },
+        num_threads);
+    if (!builder.build(sAI, files)) exit(-1);
 
-        if (buffer) delete[] buffer;
+#ifdef SAR
+    cSR.writeHeader(sAI->file_handle);
+#else
+    cSR.writeHeader(sAI->file_handle, archive_type);
+#endif
 
-        return 0;
-    }
+    return 0;
+}
@@ -2,17 +2,24 @@
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "NsaReader.h"
+#include "archive_builder.h"
 #include "charset/utf8.h"
 #include "gbk2utf16.h"
 
 Coding2UTF16 *coding2utf16 = new GBK2UTF16();
 
 void help() {
-    fprintf(stderr, "Usage: nsaenc [-ns version] src_dir dst_archive_file\n");
+    fprintf(stderr,
+            "Usage: nsaenc [-ns version] [-e] [-u] [-j threads] src_dir "
+            "dst_archive_file\n");
     fprintf(stderr, "           version   ... 1, 2(default is 1)\n");
+    fprintf(stderr,
+            "           threads   ... files read and compressed at once "
+            "(default is the number of cores)\n");
     exit(-1);
 }
 
@@ -31,20 +38,10 @@ bool endsWith(const std::string &str, const std::string suffix) {
     return (str.rfind(suffix) == (str.length() - suffix.length()));
 }
 
-std::string normalPath(const std::string p) {
-    onscripter::fs::path path(p);
-    return path.string();
-}
-
-int processFile(NsaReader::ArchiveInfo *ai,
-                NsaReader::FileInfo *fi,
-                const std::string &fullname,
-                const std::string &name,
-                unsigned long &offset,
-                bool enhanced_flag,
-                int base_offset) {
-    std::FILE *fp = NULL;
-    char magic[5];
+void processFile(NsaReader::ArchiveInfo *ai,
+                 NsaReader::FileInfo *fi,
+                 const std::string &name,
+                 int base_offset) {
     char filename[4096]{0};
     char unicode_name[4096]{0};
     strcpy(filename, name.c_str());
@@ -62,26 +59,28 @@ int processFile(NsaReader::ArchiveInfo *ai,
 #endif
     strcpy(fi->unicode_name, unicode_name);
     strcpy(fi->name, filename);
-    std::string fullpath = normalPath(fullname);
-    if ((fp = std::fopen(fullpath.c_str(), "rb")) == NULL) {
-        fprintf(stderr, "can't open file %s, skipping\n", fullpath.c_str());
-        return -1;
-    }
-    ons_fseek64(fp, 0, SEEK_END);
-    fi->length = ons_ftell64(fp);
-    ons_fseek64(fp, 0, SEEK_SET);
-    magic[0] = 0;
-    int len = std::fread(magic, 1, 4, fp);
-    magic[len] = 0;
-    std::fclose(fp);
 
-    if (enhanced_flag) {
-        fi->compression_type = BaseReader::NBZ_COMPRESSION;
-    }
+    ai->base_offset +=
+        strlen((ai->flags & BaseReader::ArchiveFlag::ARCHIVE_FLAG_ENCODING_UTF8)
+                   ? fi->unicode_name
+                   : fi->name) +
+        base_offset;
+    ai->num_of_files++;
+}
+
+// runs on the workers of ArchiveBuilder, once the file is read
+int compressionType(const NsaReader::FileInfo &fi,
+                    const unsigned char *data,
+                    size_t length,
+                    bool enhanced_flag) {
+    const char *filename = fi.name;
+    char magic[5]{0};
+    memcpy(magic, data, length < 4 ? length : 4);
 
+    int compression_type;
     if ((strstr(filename, ".nbz") != NULL) ||
         (strstr(filename, ".NBZ") != NULL))
-        fi->compression_type = BaseReader::NBZ_COMPRESSION;
+        compression_type = BaseReader::NBZ_COMPRESSION;
     else if (enhanced_flag && ((((strstr(filename, ".bmp") != NULL) ||
                                  (strstr(filename, ".BMP") != NULL)) &&
                                 (magic[0] == 'B') && (magic[1] == 'M')) ||
@@ -93,45 +92,20 @@ int processFile(NsaReader::ArchiveInfo *ai,
                                 (strstr(filename, ".ogg") != NULL)))) {
         // If enhanced, use NBZ compression on (true) BMP & WAV files in NSA
         // archive
-        fi->compression_type = BaseReader::NBZ_COMPRESSION;
+        compression_type = BaseReader::NBZ_COMPRESSION;
     } else {
-        fi->compression_type = BaseReader::NO_COMPRESSION;
+        compression_type = BaseReader::NO_COMPRESSION;
     }
 
-    if (fi->compression_type > BaseReader::NO_COMPRESSION &&
-        fi->length < 10 * 1024) {
-        fi->compression_type = BaseReader::NO_COMPRESSION;
-    }
+    if (compression_type > BaseReader::NO_COMPRESSION && length < 10 * 1024)
+        compression_type = BaseReader::NO_COMPRESSION;
+    if (!enhanced_flag) compression_type = BaseReader::NO_COMPRESSION;
 
-    fi->original_length = fi->length;
-    fi->offset = offset;
-    offset += fi->length;
-    ai->base_offset +=
-        strlen((ai->flags & BaseReader::ArchiveFlag::ARCHIVE_FLAG_ENCODING_UTF8)
-                   ? fi->unicode_name
-                   : fi->name) +
-        base_offset;
-    ai->num_of_files++;
-    return 0;
+    return compression_type;
 }
 
-int file_iterator(onscripter::fs::path dirPath, onscripter::Vector<onscripter::String> &files) {
-    int code = 0;
-    for (auto &itr : onscripter::fs::directory_iterator(dirPath)) {
-        if (!startsWith(itr.path().string(), "..") &&
-            startsWith(itr.path().string(), ".")) {
-            continue;
-        }
-        if (onscripter::fs::is_directory(itr.status())) {
-            code = file_iterator(itr.path(), files);
-            if (code != 0) {
-                return code;
-            }
-        } else {
-            files.push_back(itr.path().string());
-        }
-    }
-    return code;
+bool skipFile(const onscripter::fs::path &path) {
+    return !startsWith(path.string(), "..") && startsWith(path.string(), ".");
 }
 
 // https://github.com/playmer/onscripter-en/blob/22135bb2ac543cfad5b9e6b6b5820cb219a48ca3/tools/arcmake.cpp
@@ -144,6 +118,7 @@ int main(int argc, char *argv[]) {
     int archive_type = 0;
     int base_offset = 14;
     int init_base_offset = 6;
+    int num_threads = std::thread::hardware_concurrency();
     while (argc > 2) {
         if (!strcmp(argv[0], "-ns")) {
             argc--;
@@ -162,6 +137,10 @@ int main(int argc, char *argv[]) {
         } else if (!strcmp(argv[0], "-u")) {
             archive_flags |=
                 BaseReader::ArchiveFlag::ARCHIVE_FLAG_ENCODING_UTF8;
+        } else if (!strcmp(argv[0], "-j")) {
+            argc--;
+            argv++;
+            num_threads = atoi(argv[0]);
         }
         argc--;
         argv++;
@@ -195,81 +174,49 @@ int main(int argc, char *argv[]) {
         cSR.openForCreate(output.c_str(), archive_type, nsa_offset);
     sAI->flags = archive_flags;
 
-    onscripter::Vector<onscripter::String> files;
-    int code = file_iterator(dirPath, files);
-    if (code != 0) {
+    onscripter::Vector<ArchiveBuilder::Entry> files;
+    if (!ArchiveBuilder::listFiles(
+            basePath, "", skipFile, num_threads, files)) {
         fprintf(stderr, "file iter error.\n");
         exit(-1);
     }
-    std::sort(files.begin(), files.end());
+    std::sort(files.begin(),
+              files.end(),
+              [](const ArchiveBuilder::Entry &a,
+                 const ArchiveBuilder::Entry &b) { return a.path < b.path; });
     sAI->num_of_files = 0;
     sAI->base_offset = init_base_offset;
-    unsigned long offset = 0;
     int count = files.size();
     sAI->fi_list = new NsaReader::FileInfo[count];
-    NsaReader::FileInfo *sFI = sAI->fi_list;
-    size_t dirLength = dirPath.string().size();
-    if (dirLength > 0) {
-        dirLength++;
-    }
-    for (auto &itr : files) {
-        processFile(sAI,
-                    sFI,
-                    itr,
-                    itr.substr(dirLength),
-                    offset,
-                    enhanced_flag,
-                    base_offset);
-        sFI++;
-    }
-    sFI = sAI->fi_list;
-    for (int i = 0; i < sAI->num_of_files; i++, sFI++) {
-        sFI->offset += sAI->base_offset;
-    }
-    cSR.writeHeader(sAI->file_handle, archive_type, nsa_offset);
-
-    unsigned long offset_sub = 0;
-    unsigned long length, buffer_length = 0;
-    unsigned char *buffer = NULL;
-    std::FILE *fp = nullptr;
-    sFI = sAI->fi_list;
-    for (int i = 0; i < sAI->num_of_files; i++, sFI++) {
+    for (int i = 0; i < count; i++)
+        processFile(sAI, &sAI->fi_list[i], files[i].name, base_offset);
+
+    ArchiveBuilder builder(
+        [enhanced_flag](const NsaReader::FileInfo &fi,
+                        const unsigned char *data,
+                        size_t length) {
+            return compressionType(fi, data, length, enhanced_flag);
+        },
+        [sAI](int no, const NsaReader::FileInfo &fi) {
 #ifdef UTF8_FILESYSTEM
-        const char *name = sFI->unicode_name;
+            const char *name = fi.unicode_name;
 #else
-        const char *name = sFI->name;
+            const char *name = fi.name;
 #endif
-        printf("adding %d of %d (%s), length=%d\n",
-               i + 1,
-               sAI->num_of_files,
-               name,
-               (int)sFI->original_length);
-        length = sFI->original_length;
-        if (length > buffer_length) {
-            if (buffer) delete[] buffer;
-            buffer = new unsigned char[length];
-            buffer_length = length;
-        }
-        std::string file_path = files.at(i);
-        if ((fp = fopen(file_path.c_str(), "rb")) == NULL) {
-            fprintf(stderr, "can't open file %s, exiting\n", file_path.c_str());
-            exit(-1);
-        }
-        if (!enhanced_flag) {
-            sFI->compression_type = BaseReader::NO_COMPRESSION;
-        }
-        sFI->offset -= offset_sub;
-        cSR.addFile(sAI, fp, i, sFI->offset, buffer);
-        if (sFI->original_length != sFI->length) {
-            offset_sub += sFI->original_length - sFI->length;
-            printf("    NBZ compressed: %d -> %d (%d%%)\n",
-                   (int)sFI->original_length,
-                   (int)sFI->length,
-                   (int)(sFI->length * 100 / sFI->original_length));
-        }
-        fclose(fp);
-    }
+            printf("adding %d of %d (%s), length=%d\n",
+                   no + 1,
+                   sAI->num_of_files,
+                   name,
+                   (int)fi.original_length);
+            if (fi.original_length != fi.length) {
+                printf("    NBZ compressed: %d -> %d (%d%%)\n",
+                       (int)fi.original_length,
+                       (int)fi.length,
+                       (int)(fi.length * 100 / fi.original_length));
+            }
+        },
+        num_threads);
+    if (!builder.build(sAI, files)) exit(-1);
     cSR.writeHeader(sAI->file_handle, archive_type, nsa_offset);
-    if (buffer) delete[] buffer;
     return 0;
 }
@@ -40,6 +40,12 @@ option("android_16k")
     set_showmenu(true)
 option_end()
 
+option("bench")
+    set_default(false)
+    set_showmenu(true)
+    set_description('编译 bench 性能测试（google benchmark）')
+option_end()
+
 add_defines(
     "ONS_ZERO_VERSION=\""..VERSION.."\"",
     "ONS_JH_VERSION=\"0.8.0\"",
@@ -133,6 +139,9 @@ else
     sdl2_image_config["jpeg"] = true
 end
 add_requires("sdl2_image", {system=false, configs=sdl2_image_config})
+if has_config("bench") then
+    add_requires("benchmark")
+end
 
 
 local function use_binary()
@@ -146,23 +155,9 @@ local function use_binary()
     add_defines("UTF8_FILESYSTEM=1")
 end
 
-target("onscripter")
-    -- add_defines("ONS_RESIZE_SURFACE_IMPLEMENT=2")
+-- 引擎的源码、依赖和编译选项，onscripter 和 bench 共用
+local function use_engine()
     set_pcxxheader("src/config.hpp")
-    if is_plat("android") then
-        set_kind("shared")
-    elseif is_plat("iphoneos") then
-        -- codesign --force --deep --sign - xxx.app
-        -- ideviceinstaller -i xxx.app
-        -- ideviceinstaller -i xxx.ipa
-        set_kind("static")
-        add_cxflags("-fembed-bitcode")
-        add_mxflags("-fembed-bitcode")
-        add_defines("ONSCRIPTER_MAIN_RENAME=onscripter_main")
-        add_defines("ONSCRIPTER_MAIN_EXTREN=extern \"C\"")
-    else
-        use_binary()
-    end
     add_packages(
         "zlib",
         "bzip2",
@@ -181,8 +176,6 @@ target("onscripter")
         "fmt",
         "luajit"
     )
-    add_defines("ONSCRIPTER_EXTEND_INIT=1")
-    add_files("src/entry/onscripter_main.cpp")
     if not is_plat("windows", "mingw") then
         add_defines("RENDER_COPY_RECT_FULL=1")
     end
@@ -245,6 +238,9 @@ target("onscripter")
     if get_config("omp") then
         add_defines("USE_OMP_PARALLEL=1")
     end
+    if is_plat("linux", "android") then
+        add_defines("USE_ARCHIVE_MMAP=1")
+    end
     add_files(
         "src/*.cpp",
         "src/charset/*.c",
@@ -258,6 +254,27 @@ target("onscripter")
     )
     add_files("src/resize/*.cpp")
     remove_files("src/AVIWrapper.cpp")
+end
+
+target("onscripter")
+    -- add_defines("ONS_RESIZE_SURFACE_IMPLEMENT=2")
+    if is_plat("android") then
+        set_kind("shared")
+    elseif is_plat("iphoneos") then
+        -- codesign --force --deep --sign - xxx.app
+        -- ideviceinstaller -i xxx.app
+        -- ideviceinstaller -i xxx.ipa
+        set_kind("static")
+        add_cxflags("-fembed-bitcode")
+        add_mxflags("-fembed-bitcode")
+        add_defines("ONSCRIPTER_MAIN_RENAME=onscripter_main")
+        add_defines("ONSCRIPTER_MAIN_EXTREN=extern \"C\"")
+    else
+        use_binary()
+    end
+    use_engine()
+    add_defines("ONSCRIPTER_EXTEND_INIT=1")
+    add_files("src/entry/onscripter_main.cpp")
     after_build(function (target)
         if target:is_plat("android") then
             local outDir = "project/android/app/libs/"..target:arch().."/"
@@ -330,6 +347,17 @@ if is_plat("iphoneos") then
         add_links("sdl2_main")
 end
 
+-- xmake f --bench=y && xmake build bench && xmake run bench
+-- simd 是编译期选项，标量版本的数据用 --simd=n 重新编译
+if has_config("bench") then
+    target("bench")
+        use_binary()
+        use_engine()
+        add_packages("benchmark")
+        add_files("bench/*.cpp")
+    target_end()
+end
+
 target("nsdec")
     use_binary()
     add_files(
@@ -346,6 +374,7 @@ target("sardec")
         "src/coding2utf16.cpp",
         "src/tools/sardec.cpp",
         "src/reader/SarReader.cpp",
+        "src/reader/ArchiveDecoder.cpp",
         "src/reader/DirectReader.cpp"
     )
 
@@ -356,8 +385,10 @@ target("nsaenc")
         "src/config.cpp",
         "src/charset/*.c",
         "src/tools/nsaenc.cpp",
+        "src/tools/archive_builder.cpp",
         "src/coding2utf16.cpp",
         "src/gbk2utf16.cpp",
+        "src/reader/ArchiveDecoder.cpp",
         "src/reader/DirectReader.cpp",
         "src/reader/NsaReader.cpp",
         "src/reader/SarReader.cpp",
@@ -378,6 +409,7 @@ target("nsadec")
         "src/gbk2utf16.cpp",
         "src/sjis2utf16.cpp",
         "src/reader/NsaReader.cpp",
+        "src/reader/ArchiveDecoder.cpp",
         "src/reader/DirectReader.cpp",
         "src/reader/SarReader.cpp",
         "src/language/*.cpp",
@@ -392,8 +424,10 @@ target("arcmake")
         "src/private/uitls.cpp",
         "src/config.cpp",
         "src/tools/arcmake.cpp",
+        "src/tools/archive_builder.cpp",
         "src/coding2utf16.cpp",
         "src/gbk2utf16.cpp",
+        "src/reader/ArchiveDecoder.cpp",
         "src/reader/DirectReader.cpp",
         "src/reader/NsaReader.cpp",
         "src/reader/SarReader.cpp",